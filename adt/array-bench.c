@@ -0,0 +1,77 @@
+#include "array.h"
+#include "utils/bench.h"
+#include <stdio.h>
+
+// persistent array operations on arrays of 1e3 to 1e7 elements
+
+#define SLICE_OPS 1000000
+
+static const char* _size_label(size_t n) {
+  switch (n) {
+    case 1000: return "1e3";
+    case 10000: return "1e4";
+    case 100000: return "1e5";
+    case 1000000: return "1e6";
+    default: return "1e7";
+  }
+}
+
+static Val _append_n(size_t n) {
+  Val a = nb_array_new_empty();
+  for (size_t i = 0; i < n; i++) {
+    REPLACE(a, nb_array_append(a, VAL_FROM_INT(i)));
+  }
+  return a;
+}
+
+static void _append(size_t n) {
+  char name[64];
+  snprintf(name, sizeof(name), "nb_array_append (%s elements)", _size_label(n));
+  Val a;
+  bench_run(name, n) {
+    a = _append_n(n);
+  }
+  RELEASE(a);
+}
+
+// slices at moving offsets, reading the first and last element of each
+static void _slice(size_t n) {
+  Val a = _append_n(n);
+  char name[64];
+  snprintf(name, sizeof(name), "nb_array_slice + get (%s elements)", _size_label(n));
+  bench_run(name, SLICE_OPS) {
+    for (size_t i = 0; i < SLICE_OPS; i++) {
+      Val s = nb_array_slice(a, i % (n / 2), n / 2);
+      RELEASE(nb_array_get(s, 0));
+      RELEASE(nb_array_get(s, -1));
+      RELEASE(s);
+    }
+  }
+  RELEASE(a);
+}
+
+// pushes at front are buffered in the slice head, a full head is copied with the leaves shared,
+// so the cost grows with n / W_MAX**2 per op
+static void _prepend(size_t n) {
+  char name[64];
+  snprintf(name, sizeof(name), "nb_array_prepend (%s elements)", _size_label(n));
+  Val a = nb_array_new_empty();
+  bench_run(name, n) {
+    for (size_t i = 0; i < n; i++) {
+      REPLACE(a, nb_array_prepend(a, VAL_FROM_INT(i)));
+    }
+  }
+  RELEASE(a);
+}
+
+void array_bench() {
+  for (size_t n = 1000; n <= 10000000; n *= 10) {
+    _append(n);
+  }
+  for (size_t n = 1000; n <= 10000000; n *= 10) {
+    _slice(n);
+  }
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    _prepend(n);
+  }
+}
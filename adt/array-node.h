@@ -56,6 +56,17 @@ static Node* NODE_DUP_APPEND(Node* n, int level, Val v) {
   return r;
 }
 
+static size_t NODE_BYTE_SIZE(void* vn) {
+  return NODE_BYTES((Node*)vn);
+}
+
+static void NODE_TRACE(void* vn, ValVisitFunc visit, void* ctx) {
+  Node* n = vn;
+  for (int i = 0; i < NODE_SIZE(n); i++) {
+    visit(n->slots + i, ctx);
+  }
+}
+
 static void NODE_DESTROY(void* vn) {
   Node* n = vn;
   if (val_is_tracing()) {
@@ -161,4 +161,96 @@ void array_suite() {
     RELEASE(a);
     val_end_check_memory();
   }
+
+  ccut_test("append through tail into 4 layers") {
+    val_begin_check_memory();
+    long sz = 32 * 32 * 32 + 32 * 3 + 7;
+    Val a = nb_array_new_empty();
+    Val half = VAL_NIL;
+    for (long i = 0; i < sz; i++) {
+      REPLACE(a, nb_array_append(a, VAL_FROM_INT(i)));
+      if (i == sz / 2) {
+        half = a;
+        RETAIN(half);
+      }
+    }
+    assert_eq(sz, nb_array_size(a));
+    for (long i = 0; i < sz; i++) {
+      if (i != VAL_TO_INT(nb_array_get(a, i))) {
+        assert_true(false, "%ld != %lld", i, VAL_TO_INT(nb_array_get(a, i)));
+      }
+    }
+
+    // older versions are not changed
+    assert_eq(sz / 2 + 1, nb_array_size(half));
+    assert_eq(sz / 2, VAL_TO_INT(nb_array_get(half, -1)));
+
+    // set in tree and in tail
+    Val b = nb_array_set(a, 100, VAL_FROM_INT(-1));
+    REPLACE(b, nb_array_set(b, sz - 1, VAL_FROM_INT(-2)));
+    assert_eq(-1, VAL_TO_INT(nb_array_get(b, 100)));
+    assert_eq(-2, VAL_TO_INT(nb_array_get(b, sz - 1)));
+    assert_eq(100, VAL_TO_INT(nb_array_get(a, 100)));
+    assert_eq(sz - 1, VAL_TO_INT(nb_array_get(a, sz - 1)));
+
+    RELEASE(b);
+    RELEASE(half);
+    RELEASE(a);
+    val_end_check_memory();
+  }
+
+  ccut_test("new from elements") {
+    val_begin_check_memory();
+    Val elems[1100];
+    for (long i = 0; i < 1100; i++) {
+      elems[i] = VAL_FROM_INT(i);
+    }
+    long sizes[] = {0, 31, 32, 33, 64, 1024, 1056, 1100};
+    for (int k = 0; k < sizeof(sizes) / sizeof(long); k++) {
+      Val a = nb_array_new_a(sizes[k], elems);
+      assert_eq(sizes[k], nb_array_size(a));
+      for (long i = 0; i < sizes[k]; i++) {
+        assert_eq(i, VAL_TO_INT(nb_array_get(a, i)));
+      }
+      // appending continues on the built structure
+      REPLACE(a, nb_array_append(a, VAL_FROM_INT(-1)));
+      assert_eq(-1, VAL_TO_INT(nb_array_get(a, sizes[k])));
+      RELEASE(a);
+    }
+    val_end_check_memory();
+  }
+
+  ccut_test("prepend") {
+    val_begin_check_memory();
+    long sz = 2000;
+    Val a = nb_array_build_test_546();
+    for (long i = 1; i <= sz; i++) {
+      REPLACE(a, nb_array_prepend(a, VAL_FROM_INT(-i)));
+    }
+    assert_eq(sz + 546, nb_array_size(a));
+    for (long i = 0; i < sz + 546; i++) {
+      if (i - sz != VAL_TO_INT(nb_array_get(a, i))) {
+        assert_true(false, "%ld != %lld", i - sz, VAL_TO_INT(nb_array_get(a, i)));
+      }
+    }
+
+    // other operations on a slice with head
+    Val b = nb_array_slice(a, 3, 40);
+    assert_eq(40, nb_array_size(b));
+    assert_eq(3 - sz, VAL_TO_INT(nb_array_get(b, 0)));
+    REPLACE(b, nb_array_prepend(b, VAL_FROM_INT(100)));
+    assert_eq(100, VAL_TO_INT(nb_array_get(b, 0)));
+    assert_eq(3 - sz, VAL_TO_INT(nb_array_get(b, 1)));
+    REPLACE(b, nb_array_append(b, VAL_FROM_INT(200)));
+    assert_eq(42, nb_array_size(b));
+    assert_eq(200, VAL_TO_INT(nb_array_get(b, -1)));
+    assert_eq(42 - sz, VAL_TO_INT(nb_array_get(b, -2)));
+    REPLACE(b, nb_array_remove(b, 1));
+    assert_eq(41, nb_array_size(b));
+    assert_eq(4 - sz, VAL_TO_INT(nb_array_get(b, 1)));
+
+    RELEASE(b);
+    RELEASE(a);
+    val_end_check_memory();
+  }
 }
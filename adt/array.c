@@ -1,5 +1,6 @@
 #include "array.h"
 #include "array-node.h"
+#include "utils/mut-array.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,160 +9,220 @@
 // immutable array implemented as W_MAX-way tree
 
 // for optimized queue-like operations, a copy-on-write ArraySlice is generated when shifting or slicing elements.
-// nodes are allocated by reference counting GC, and transient in-place updates are performed on nodes of refcount == 1
-// no tail-inlining, only root-inlining, optimization for appending is done by transient updates.
+// nodes are allocated by reference counting GC.
 
-// todo add head and tail to slice, then we can reduce all of the re-allocation of data append actions to 1/32
+// the last (size % W_MAX) elements, or a full leaf, are inlined in the array object as the tail,
+// so an append only dups the tail, and the tree is touched once every W_MAX appends.
+// likewise, a slice holds up to W_MAX prepended elements inlined as the head,
+// when the head is full, the slice is copied into a new array, sharing the aligned leaves of the referenced array.
 
 // the `size` field is shared by both Array and Slice
 // depth: start from 0
-//   0:  0..W_MAX leaf nodes
-//   W:  W_MAX+1..W_MAX**2 leaf nodes
-//   2W: W_MAX**2+1..W_MAX**3 leaf nodes
+//   0:  root is the only leaf node (or NULL for empty tree)
+//   W:  2..W_MAX leaf nodes
+//   2W: W_MAX+1..W_MAX**2 leaf nodes
 //   ...
+// elements in the tree are always full leaves (tree size = size - tail_size is a multiple of W_MAX)
 
 typedef struct {
   ValHeader h; // flags: depth
   uint64_t size;
-  uint64_t root_size;
-  Val slots[];
+  Val root;
+  uint64_t tail_size;
+  Val tail[];
 } Array;
 
 typedef struct {
-  ValHeader h;
-  uint64_t size;
+  ValHeader h; // flags: head_size
+  uint64_t size; // including head
   uint64_t offset;
   Val ref;
+  Val head[];
 } Slice;
 
-#define ROOT_SIZE(a) ((Array*)(a))->root_size
+#define TAIL_SIZE(a) ((Array*)(a))->tail_size
 #define ARR_SIZE(a) ((Array*)(a))->size
-#define ARR_BYTES(a) (sizeof(Array) + sizeof(Val) * ROOT_SIZE(a))
+#define TAIL_OFFSET(a) (ARR_SIZE(a) - TAIL_SIZE(a))
+#define ARR_BYTES(a) (sizeof(Array) + sizeof(Val) * TAIL_SIZE(a))
 
 #define ARR_IS_SLICE(a) ((ValHeader*)(a))->user1
 #define ARR_DEPTH(a) ((ValHeader*)(a))->flags
+#define HEAD_SIZE(s) ((ValHeader*)(s))->flags
+#define SLICE_BYTES(s) (sizeof(Slice) + sizeof(Val) * HEAD_SIZE(s))
 
-inline static bool NODE_INDEX_OVERFLOW(Node* n, int level, uint64_t pos) {
-  return ((pos >> level) & W_MASK) >= NODE_SIZE(n);
-}
-
-inline static Array* ARR_NEW(uint64_t root_size) {
-  Array* a = val_alloc(KLASS_ARRAY, sizeof(Array) + sizeof(Val) * root_size);
+inline static Array* ARR_NEW(uint64_t tail_size) {
+  Array* a = val_alloc(KLASS_ARRAY, sizeof(Array) + sizeof(Val) * tail_size);
   // ARR_IS_SLICE(a) = 0;
-  ROOT_SIZE(a) = root_size;
+  TAIL_SIZE(a) = tail_size;
   return a;
 }
 
+inline static void ARR_RETAIN_SLOTS(Array* a) {
+  if (a->root) {
+    RETAIN(a->root);
+  }
+  // check immediates inline, the tail is retained on every append
+  for (int i = 0; i < TAIL_SIZE(a); i++) {
+    if (!VAL_IS_IMM(a->tail[i])) {
+      RETAIN(a->tail[i]);
+    }
+  }
+}
+
 inline static Array* ARR_DUP(Array* a) {
   size_t sz = ARR_BYTES(a);
-  for (int i = 0; i < ROOT_SIZE(a); i++) {
-    RETAIN(a->slots[i]);
-  }
+  ARR_RETAIN_SLOTS(a);
 
   Array* r = val_dup(a, sz, sz);
   return r;
 }
 
 // a can be 0-sized
-// dup and append 1 slot of v
+// dup and append v to the tail
 inline static Array* ARR_DUP_APPEND(Array* a, Val v) {
-  assert(ROOT_SIZE(a) < W_MAX);
+  assert(TAIL_SIZE(a) < W_MAX);
   size_t sz = ARR_BYTES(a);
   Array* r = val_dup(a, sz, sz + sizeof(Val));
-  for (int i = 0; i < ROOT_SIZE(a); i++) {
-    RETAIN(a->slots[i]);
-  }
+  ARR_RETAIN_SLOTS(a);
 
-  RETAIN(v); // retain before `while` loop changes it
-  for (int level = ARR_DEPTH(a); level; level -= W) {
+  RETAIN(v);
+  r->tail[TAIL_SIZE(r)++] = v;
+  r->size++;
+  return r;
+}
+
+// wrap v with single-slot nodes, so it can be put in a node of the level
+inline static Val WRAP(Val v, int level) {
+  for (; level; level -= W) {
     Node* wrapper = NODE_NEW(1);
     wrapper->slots[0] = v;
     v = (Val)wrapper;
   }
-  r->slots[ROOT_SIZE(r)++] = v;
-  r->size++;
-  return r;
+  return v;
 }
 
-// NOTE 0-sized array is surely not full
-inline static bool ARR_IS_FULL(Array* a) {
-  return a->size == (W_MAX << ARR_DEPTH(a));
+inline static Slice* SLICE_NEW(int head_size) {
+  Slice* s = val_alloc(KLASS_ARRAY, sizeof(Slice) + sizeof(Val) * head_size);
+  ARR_IS_SLICE(s) = true;
+  HEAD_SIZE(s) = head_size;
+  return s;
 }
 
-// every elem of root is full
-// NOTE 0-sized array is surely partial full
-inline static bool ARR_IS_PARTIAL_FULL(Array* a) {
-  return ((a->size >> ARR_DEPTH(a)) << ARR_DEPTH(a)) == a->size;
+static void ARR_DESTROY(void* p) {
+  if (ARR_IS_SLICE(p)) {
+    Slice* s = p;
+    for (int i = 0; i < HEAD_SIZE(s); i++) {
+      val_release(s->head[i]);
+    }
+    val_release(s->ref);
+  } else {
+    Array* a = p;
+    if (a->root) {
+      val_release(a->root);
+    }
+    for (int i = 0; i < TAIL_SIZE(a); i++) {
+      if (!VAL_IS_IMM(a->tail[i])) {
+        val_release(a->tail[i]);
+      }
+    }
+  }
 }
 
-inline static Slice* SLICE_NEW() {
-  Slice* s = val_alloc(KLASS_ARRAY, sizeof(Slice));
-  ARR_IS_SLICE(s) = true;
-  return s;
+static size_t ARR_BYTE_SIZE(void* p) {
+  return ARR_IS_SLICE(p) ? SLICE_BYTES(p) : ARR_BYTES(p);
 }
 
-// raised array will ensure there are 2 slots in root, and append v
-inline static Array* ARR_RAISE_DEPTH(Array* a, Val v) {
-  Array* r = ARR_NEW(2);
-  r->size = a->size + 1;
-  ARR_DEPTH(r) = ARR_DEPTH(a) + W;
-  ROOT_SIZE(r) = 2;
-
-  Node* root_dup = NODE_NEW(ROOT_SIZE(a));
-  for (int i = 0; i < ROOT_SIZE(a); i++) {
-    root_dup->slots[i] = a->slots[i];
-    RETAIN(root_dup->slots[i]);
+static void ARR_TRACE(void* p, ValVisitFunc visit, void* ctx) {
+  if (ARR_IS_SLICE(p)) {
+    Slice* s = p;
+    for (int i = 0; i < HEAD_SIZE(s); i++) {
+      visit(s->head + i, ctx);
+    }
+    visit(&s->ref, ctx);
+  } else {
+    Array* a = p;
+    if (a->root) {
+      visit(&a->root, ctx);
+    }
+    for (int i = 0; i < TAIL_SIZE(a); i++) {
+      visit(a->tail + i, ctx);
+    }
   }
-  r->slots[0] = (Val)root_dup;
+}
 
-  RETAIN(v);
-  for (int level = ARR_DEPTH(r); level; level -= W) {
-    Node* wrapper = NODE_NEW(1);
-    wrapper->slots[0] = v;
-    v = (Val)wrapper;
-  }
-  r->slots[1] = v;
+#pragma mark --- builder
 
-  return r;
+// builds an array from elements (or full leaves) pushed in order, the last partial leaf becomes the tail
+
+MUT_ARRAY_DECL(ArrLeaves, Val);
+
+typedef struct {
+  struct ArrLeaves leaves;
+  Val leaves_buf[W_MAX];
+  Val tail[W_MAX];
+  uint32_t tail_size;
+} ArrBuilder;
+
+static void _builder_init(ArrBuilder* b) {
+  ArrLeaves.init_buf(&b->leaves, b->leaves_buf, W_MAX);
+  b->tail_size = 0;
 }
 
-inline static int DEPTH_FOR(uint64_t sz) {
-  int d = 0;
-  while (sz > (W_MAX << d)) {
-    d += W;
+// e should be retained by caller
+static void _builder_push(ArrBuilder* b, Val e) {
+  b->tail[b->tail_size++] = e;
+  if (b->tail_size == W_MAX) {
+    Node* leaf = NODE_NEW(W_MAX);
+    memcpy(leaf->slots, b->tail, sizeof(Val) * W_MAX);
+    ArrLeaves.push(&b->leaves, (Val)leaf);
+    b->tail_size = 0;
   }
-  return d;
 }
 
-inline static int ROOT_SIZE_FOR(uint64_t size, int depth) {
-  // root_size must satisfy:
-  //   root_size * (1ULL << depth) >= size
-  int r = size >> depth;
-  if ((r << depth) < size) {
-    r++;
-  }
-  return r;
+// leaf should be full and retained by caller, and the pushed elements should fill whole leaves
+static void _builder_push_leaf(ArrBuilder* b, Node* leaf) {
+  assert(b->tail_size == 0 && NODE_SIZE(leaf) == W_MAX);
+  ArrLeaves.push(&b->leaves, (Val)leaf);
 }
 
-static void ARR_DESTROY(void* p) {
-  if (ARR_IS_SLICE(p)) {
-    Slice* s = p;
-    val_release(s->ref);
-  } else {
-    Array* a = p;
-    for (int i = 0; i < ROOT_SIZE(a); i++) {
-      val_release(a->slots[i]);
+static Array* _builder_finish(ArrBuilder* b) {
+  size_t leaves_size = ArrLeaves.size(&b->leaves);
+  Val* nodes = b->leaves.data;
+  size_t n = leaves_size;
+  int depth = 0;
+
+  // group nodes bottom-up (in place) until there is only root
+  for (; n > 1; depth += W) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; i += W_MAX) {
+      size_t node_size = (n - i < W_MAX) ? n - i : W_MAX;
+      Node* node = NODE_NEW(node_size);
+      memcpy(node->slots, nodes + i, sizeof(Val) * node_size);
+      nodes[m++] = (Val)node;
     }
+    n = m;
   }
+
+  Array* r = ARR_NEW(b->tail_size);
+  r->root = n ? nodes[0] : 0;
+  ARR_DEPTH(r) = depth;
+  memcpy(r->tail, b->tail, sizeof(Val) * b->tail_size);
+  r->size = (leaves_size << W) + b->tail_size;
+  ArrLeaves.cleanup(&b->leaves);
+  return r;
 }
 
 #pragma mark --- helpers decl
 
-static Val _array_get(Array* a, int64_t pos);
-static void _array_transient_set(Array* a, int64_t pos, Val e);
+static Val _array_get(Array* a, uint64_t pos);
+static Val _slice_get(Slice* s, uint64_t pos);
+static Node* _array_leaf(Array* a, uint64_t pos);
 static Array* _array_set(Array* a, int64_t pos, Val e);
 static Array* _slice_set(Slice* s, int64_t pos, Val e);
 static Array* _array_append(Array* a, Val e);
+static Array* _array_push_tail(Array* a, Val e);
+static Val _tree_push_leaf(Array* a, Node* leaf, int* depth);
+static Array* _slice_flatten(Slice* s);
 void _node_debug(Node* node, int depth);
 
 #pragma mark --- interface
@@ -175,8 +236,12 @@ void nb_array_init_module() {
 
   klass_def_internal(KLASS_ARRAY_NODE, val_strlit_new_c("ArrayNode"));
   klass_set_destruct_func(KLASS_ARRAY_NODE, NODE_DESTROY);
+  klass_set_size_func(KLASS_ARRAY_NODE, NODE_BYTE_SIZE);
+  klass_set_trace_func(KLASS_ARRAY_NODE, NODE_TRACE);
   klass_def_internal(KLASS_ARRAY, val_strlit_new_c("Array"));
   klass_set_destruct_func(KLASS_ARRAY, ARR_DESTROY);
+  klass_set_size_func(KLASS_ARRAY, ARR_BYTE_SIZE);
+  klass_set_trace_func(KLASS_ARRAY, ARR_TRACE);
 }
 
 Val nb_array_new_empty() {
@@ -184,47 +249,42 @@ Val nb_array_new_empty() {
 }
 
 Val nb_array_new(size_t size, ...) {
-  int depth = DEPTH_FOR(size);
-  int root_size = ROOT_SIZE_FOR(size, depth);
-  Array* r = ARR_NEW(root_size);
-  r->size = size;
-  ARR_DEPTH(r) = depth;
+  ArrBuilder b;
+  _builder_init(&b);
 
   va_list vl;
   va_start(vl, size);
   for (size_t i = 0; i < size; i++) {
     Val e = va_arg(vl, Val);
-    _array_transient_set(r, i, e);
+    RETAIN(e);
+    _builder_push(&b, e);
   }
   va_end(vl);
 
-  return (Val)r;
+  return (Val)_builder_finish(&b);
 }
 
 Val nb_array_new_v(size_t size, va_list vl) {
-  int depth = DEPTH_FOR(size);
-  int root_size = ROOT_SIZE_FOR(size, depth);
-  Array* r = ARR_NEW(root_size);
-  r->size = size;
-  ARR_DEPTH(r) = depth;
+  ArrBuilder b;
+  _builder_init(&b);
 
   for (size_t i = 0; i < size; i++) {
-    _array_transient_set(r, i, va_arg(vl, Val));
+    Val e = va_arg(vl, Val);
+    RETAIN(e);
+    _builder_push(&b, e);
   }
-  return (Val)r;
+  return (Val)_builder_finish(&b);
 }
 
 Val nb_array_new_a(size_t size, Val* p) {
-  int depth = DEPTH_FOR(size);
-  int root_size = ROOT_SIZE_FOR(size, depth);
-  Array* r = ARR_NEW(root_size);
-  r->size = size;
-  ARR_DEPTH(r) = depth;
+  ArrBuilder b;
+  _builder_init(&b);
 
   for (size_t i = 0; i < size; i++) {
-    _array_transient_set(r, i, p[i]);
+    RETAIN(p[i]);
+    _builder_push(&b, p[i]);
   }
-  return (Val)r;
+  return (Val)_builder_finish(&b);
 }
 
 size_t nb_array_size(Val v) {
@@ -244,17 +304,11 @@ Val nb_array_get(Val v, int64_t pos) {
     return VAL_UNDEF;
   }
 
-  // get real array
-  Array* a;
   if (ARR_IS_SLICE(v)) {
-    Slice* s = (Slice*)v;
-    a = (Array*)s->ref;
-    pos += s->offset;
+    return _slice_get((Slice*)v, pos);
   } else {
-    a = (Array*)v;
+    return _array_get((Array*)v, pos);
   }
-
-  return _array_get(a, pos);
 }
 
 Val nb_array_set(Val v, int64_t pos, Val e) {
@@ -275,29 +329,88 @@ Val nb_array_set(Val v, int64_t pos, Val e) {
 
 Val nb_array_append(Val v, Val e) {
   if (ARR_IS_SLICE(v)) {
-    return (Val)_slice_set((Slice*)v, ARR_SIZE(v), e);
+    Array* a = _slice_flatten((Slice*)v);
+    Array* r = _array_append(a, e);
+    RELEASE(a);
+    return (Val)r;
   } else {
     return (Val)_array_append((Array*)v, e);
   }
 }
 
+Val nb_array_prepend(Val v, Val e) {
+  Slice* r;
+  RETAIN(e);
+
+  if (!ARR_IS_SLICE(v)) {
+    r = SLICE_NEW(1);
+    r->head[0] = e;
+    r->size = ARR_SIZE(v) + 1;
+    r->offset = 0;
+    r->ref = v;
+    RETAIN(v);
+    return (Val)r;
+  }
+
+  Slice* s = (Slice*)v;
+  if (HEAD_SIZE(s) == W_MAX) {
+    // the full head becomes the first leaf of the new array, and e starts a new head
+    Array* a = _slice_flatten(s);
+    r = SLICE_NEW(1);
+    r->head[0] = e;
+    r->size = a->size + 1;
+    r->offset = 0;
+    r->ref = (Val)a;
+    return (Val)r;
+  }
+
+  r = SLICE_NEW(HEAD_SIZE(s) + 1);
+  r->head[0] = e;
+  for (int i = 0; i < HEAD_SIZE(s); i++) {
+    r->head[i + 1] = s->head[i];
+    RETAIN(s->head[i]);
+  }
+  r->size = s->size + 1;
+  r->offset = s->offset;
+  r->ref = s->ref;
+  RETAIN(r->ref);
+  return (Val)r;
+}
+
 Val nb_array_slice(Val v, uint64_t from, uint64_t len) {
   if (from >= ARR_SIZE(v)) {
     return empty_arr;
   }
+  if (from + len >= ARR_SIZE(v)) {
+    len = ARR_SIZE(v) - from;
+  }
 
-  Slice* r = SLICE_NEW();
-
+  Slice* r;
   if (ARR_IS_SLICE(v)) {
     Slice* s = (Slice*)v;
-    r->offset = s->offset + from;
-    r->size = (from + len < s->size) ? len : s->size - from;
+    if (from < HEAD_SIZE(s)) {
+      // copy the sliced part of head
+      int head_size = HEAD_SIZE(s) - from;
+      if (head_size > len) {
+        head_size = len;
+      }
+      r = SLICE_NEW(head_size);
+      for (int i = 0; i < head_size; i++) {
+        r->head[i] = s->head[from + i];
+        RETAIN(r->head[i]);
+      }
+      r->offset = s->offset;
+    } else {
+      r = SLICE_NEW(0);
+      r->offset = s->offset + from - HEAD_SIZE(s);
+    }
     r->ref = s->ref;
   } else {
+    r = SLICE_NEW(0);
     r->offset = from;
-    r->size = (from + len < ARR_SIZE(v)) ? len : ARR_SIZE(v) - from;
     r->ref = v;
   }
+  r->size = len;
   RETAIN(r->ref);
 
   return (Val)r;
@@ -321,35 +434,15 @@ Val nb_array_remove(Val v, int64_t pos) {
   } else if (pos == ARR_SIZE(v) - 1) {
     return nb_array_slice(v, 0, ARR_SIZE(v) - 1);
   } else {
-    int64_t offset;
-    Array* src_arr;
-    if (ARR_IS_SLICE(v)) {
-      Slice* s = (Slice*)v;
-      offset = s->offset;
-      src_arr = (Array*)s->ref;
-    } else {
-      offset = 0;
-      src_arr = (Array*)v;
-    }
-
     // dirty copy
-
-    int64_t size = ARR_SIZE(v) - 1;
-    int depth = DEPTH_FOR(size);
-    int root_size = ROOT_SIZE_FOR(size, depth);
-    Array* r = ARR_NEW(root_size);
-    r->size = size;
-    ARR_DEPTH(r) = depth;
-
-    int64_t j = offset;
-    for (int64_t i = 0; i < pos; i++) {
-      _array_transient_set(r, i, _array_get(src_arr, j++));
-    }
-    j++;
-    for (int64_t i = pos; i < size ; i++) {
-      _array_transient_set(r, i, _array_get(src_arr, j++));
+    ArrBuilder b;
+    _builder_init(&b);
+    for (int64_t i = 0; i < ARR_SIZE(v); i++) {
+      if (i != pos) {
+        _builder_push(&b, nb_array_get(v, i));
+      }
     }
-    return (Val)r;
+    return (Val)_builder_finish(&b);
   }
 }
 
@@ -358,30 +451,30 @@ Val nb_array_build_test_10() {
   a->size = 10;
   ARR_DEPTH(a) = 0;
   for (long i = 0; i < 10; i++) {
-    a->slots[i] = VAL_FROM_INT(i);
+    a->tail[i] = VAL_FROM_INT(i);
   }
   return (Val)a;
 }
 
-// 17 * 32 + 1 * 2
+// 17 * 32 in tree + 2 in tail
 Val nb_array_build_test_546() {
-  Array* a = ARR_NEW(18);
+  Array* a = ARR_NEW(2);
   a->size = 546;
   ARR_DEPTH(a) = W;
+  Node* root = NODE_NEW(17);
+  a->root = (Val)root;
 
   long e = 0;
   for (long i = 0; i < 17; i++) {
     Node* n = NODE_NEW(32);
-    a->slots[i] = (Val)n;
+    root->slots[i] = (Val)n;
     for (long j = 0; j < 32; j++) {
       n->slots[j] = VAL_FROM_INT(e++);
     }
   }
-  Node* n = NODE_NEW(2);
   for (long i = 0; i < 2; i++) {
-    n->slots[i] = VAL_FROM_INT(e++);
+    a->tail[i] = VAL_FROM_INT(e++);
   }
-  a->slots[17] = (Val)n;
   return (Val)a;
 }
 
@@ -392,21 +485,19 @@ void nb_array_debug(Val v) {
       printf("<array addr=%p size=%llu extra_rc=%hu>\n",
       a, a->size, ((ValHeader*)a)->extra_rc);
 
-      printf("<root depth=%d size=%llu slots=[", ARR_DEPTH(a), ROOT_SIZE(a));
-      for (long i = 0; i < ROOT_SIZE(a); i++) {
-        printf("%p, ", (void*)a->slots[i]);
+      if (a->root) {
+        _node_debug((Node*)a->root, ARR_DEPTH(a));
       }
-      printf("]>\n");
 
-      if (ARR_DEPTH(a) > 0) {
-        for (int i = 0; i < ROOT_SIZE(a); i++) {
-          _node_debug((Node*)a->slots[i], ARR_DEPTH(a) - W);
-        }
+      printf("<tail size=%llu slots=[", TAIL_SIZE(a));
+      for (long i = 0; i < TAIL_SIZE(a); i++) {
+        printf("%lu, ", a->tail[i]);
       }
+      printf("]>\n");
     } else {
       Slice* s = (Slice*)v;
-      printf("<array_slice size=%llu offset=%llu ref=%p extra_rc=%hu>\n",
-      s->size, s->offset, (void*)s->ref, ((ValHeader*)s)->extra_rc);
+      printf("<array_slice size=%llu head_size=%d offset=%llu ref=%p extra_rc=%hu>\n",
+      s->size, HEAD_SIZE(s), s->offset, (void*)s->ref, ((ValHeader*)s)->extra_rc);
     }
   } else {
     printf("not array\n");
@@ -415,125 +506,176 @@ void nb_array_debug(Val v) {
 
 #pragma mark --- helpers impl
 
-static Val _array_get(Array* a, int64_t pos) {
+static Val _array_get(Array* a, uint64_t pos) {
   assert(pos < a->size);
-  Val* slots = a->slots;
-  for (int i = ARR_DEPTH(a); i; i -= W) {
-    size_t index = ((pos >> i) & W_MASK);
-    Node* node = (Node*)slots[index];
-    assert(node);
-    slots = node->slots;
+  uint64_t tail_offset = TAIL_OFFSET(a);
+  if (pos >= tail_offset) {
+    Val v = a->tail[pos - tail_offset];
+    RETAIN(v);
+    return v;
   }
-  Val v = slots[pos & W_MASK];
+
+  Val v = _array_leaf(a, pos)->slots[pos & W_MASK];
   RETAIN(v);
   return v;
 }
 
-// assume we are building an array, the slot to be filled is empty in the beginning
-static void _array_transient_set(Array* a, int64_t pos, Val e) {
-  Val* slots = a->slots;
-  size_t slots_size = ROOT_SIZE(a);
-  for (int i = ARR_DEPTH(a); i ; i -= W) {
-    size_t index = ((pos >> i) & W_MASK);
-    if (!slots[index]) {
-      bool is_last_node = (index == slots_size - 1);
-      size_t node_size = is_last_node ? (a->size >> i) : W_MAX;
-      slots[index] = (Val)NODE_NEW(node_size);
-    }
-    slots = ((Node*)slots[index])->slots;
-    slots_size = NODE_SIZE(slots);
+static Val _slice_get(Slice* s, uint64_t pos) {
+  if (pos < HEAD_SIZE(s)) {
+    Val v = s->head[pos];
+    RETAIN(v);
+    return v;
   }
-  size_t index = (pos & W_MASK);
-  slots[index] = e;
-  RETAIN(e);
+  return _array_get((Array*)s->ref, s->offset + pos - HEAD_SIZE(s));
+}
+
+// the leaf node containing pos, pos should be in tree
+static Node* _array_leaf(Array* a, uint64_t pos) {
+  assert(pos < TAIL_OFFSET(a));
+  Node* node = (Node*)a->root;
+  for (int i = ARR_DEPTH(a); i; i -= W) {
+    node = (Node*)node->slots[(pos >> i) & W_MASK];
+    assert(node);
+  }
+  return node;
 }
 
 static Array* _array_set(Array* a, int64_t pos, Val e) {
   if (pos >= a->size) {
+    Val r = (Val)a;
+    RETAIN(r);
     for (int64_t i = a->size; i < pos; i++) {
-      a = _array_append(a, VAL_NIL);
+      REPLACE(r, (Val)_array_append((Array*)r, VAL_NIL));
     }
-    return _array_append(a, e);
+    REPLACE(r, (Val)_array_append((Array*)r, e));
+    return (Array*)r;
+  }
+
+  Array* r = ARR_DUP(a);
+  uint64_t tail_offset = TAIL_OFFSET(a);
+  Val* slot;
+  if (pos >= tail_offset) {
+    slot = r->tail + (pos - tail_offset);
   } else {
-    // dup path and set
-    Array* r = ARR_DUP(a);
-
-    Val* slots = r->slots;
-    // Node* node = &r->root;
-    size_t index;
-    for (int i = ARR_DEPTH(a); i; i -= W) {
-      index = ((pos >> i) & W_MASK);
-      RELEASE(slots[index]);
-      slots[index] = (Val)NODE_DUP((Node*)slots[index]);
-      slots = ((Node*)slots[index])->slots;
+    // dup path
+    slot = &r->root;
+    for (int i = ARR_DEPTH(a); ; i -= W) {
+      Node* node = NODE_DUP((Node*)*slot);
+      RELEASE(*slot);
+      *slot = (Val)node;
+      slot = node->slots + ((pos >> i) & W_MASK);
+      if (!i) {
+        break;
+      }
     }
-    index = (pos & W_MASK);
-    RELEASE(slots[index]);
-    slots[index] = e;
-    RETAIN(e);
-    return r;
   }
+  RELEASE(*slot);
+  *slot = e;
+  RETAIN(e);
+  return r;
 }
 
 static Array* _slice_set(Slice* s, int64_t pos, Val e) {
-  Array* a = (Array*)s->ref;
-  Val r = empty_arr;
-  int64_t j = s->offset;
+  Array* a = _slice_flatten(s);
+  Array* r = _array_set(a, pos, e);
+  RELEASE(a);
+  return r;
+}
 
-  if (pos < s->size) {
-    for (int64_t i = 0; i < s->size; i++) {
-      REPLACE(r, (Val)_array_append((Array*)r, i == pos ? e : _array_get(a, j++)));
-    }
-    return (Array*)r;
+static Array* _array_append(Array* a, Val e) {
+  if (TAIL_SIZE(a) < W_MAX) { // covers 0-sized array
+    return ARR_DUP_APPEND(a, e);
   } else {
-    for (int64_t i = 0; i < s->size; i++) {
-      REPLACE(r, (Val)_array_append((Array*)r, _array_get(a, j++)));
-    }
-    for (int64_t i = s->size; i < pos; i++) {
-      REPLACE(r, (Val)_array_append((Array*)r, VAL_NIL));
-    }
-    REPLACE(r, (Val)_array_append((Array*)r, e));
-    return (Array*)r;
+    return _array_push_tail(a, e);
   }
 }
 
-static Array* _array_append(Array* a, Val e) {
-  Array* r;
-  if (ARR_IS_FULL(a)) {
-    return ARR_RAISE_DEPTH(a, e);
-  } else if (ARR_IS_PARTIAL_FULL(a)) { // covers ARR_DEPTH(a) == 0
-    return ARR_DUP_APPEND(a, e);
+// push the full tail into tree as a leaf, the new tail is [e]
+static Array* _array_push_tail(Array* a, Val e) {
+  assert(TAIL_SIZE(a) == W_MAX);
+  Node* leaf = NODE_NEW(W_MAX);
+  for (int i = 0; i < W_MAX; i++) {
+    leaf->slots[i] = a->tail[i];
+    RETAIN(leaf->slots[i]);
   }
-  assert(ARR_DEPTH(a));
 
-  r = ARR_DUP(a);
+  Array* r = ARR_NEW(1);
+  int depth = ARR_DEPTH(a);
+  r->size = a->size + 1;
+  r->root = _tree_push_leaf(a, leaf, &depth);
+  ARR_DEPTH(r) = depth;
+  RETAIN(e);
+  r->tail[0] = e;
+  return r;
+}
 
-  size_t pos = r->size;
-  r->size++;
-  Val* parent_slots = r->slots;
-
-  // hierarchical dup slot
-  int i;
-  size_t index;
-  size_t next_index;
-  for (i = ARR_DEPTH(r); i; i -= W) {
-    index = ((pos >> i) & W_MASK);
-    Node* child = (Node*)parent_slots[index];
-    if (NODE_INDEX_OVERFLOW(child, i - W, pos)) { // covers i - W == 0
-      Val new_child = (Val)NODE_DUP_APPEND(child, i - W, e);
-      RELEASE(child);
-      parent_slots[index] = new_child;
-      return r;
+// returns the new root with leaf appended to the tree of a, depth is increased when the tree is raised
+static Val _tree_push_leaf(Array* a, Node* leaf, int* depth) {
+  uint64_t tree_size = TAIL_OFFSET(a);
+
+  if (tree_size == 0) {
+    return (Val)leaf;
+  }
+
+  if (tree_size == (W_MAX << *depth)) {
+    // tree is full, raise depth
+    Node* root = NODE_NEW(2);
+    root->slots[0] = a->root;
+    RETAIN(a->root);
+    root->slots[1] = WRAP((Val)leaf, *depth);
+    *depth += W;
+    return (Val)root;
+  }
+
+  // hierarchical dup slot, until a node has room for the leaf
+  Val root = a->root;
+  RETAIN(root);
+  Val* slot = &root;
+  for (int i = *depth; i; i -= W) {
+    Node* node = (Node*)*slot;
+    size_t index = ((tree_size >> i) & W_MASK);
+    if (index == NODE_SIZE(node)) {
+      *slot = (Val)NODE_DUP_APPEND(node, i - W, (Val)leaf);
+      RELEASE(node);
+      RELEASE(leaf); // retained by NODE_DUP_APPEND
+      return root;
     }
 
-    Val new_child = (Val)NODE_DUP(child);
-    RELEASE(child);
-    parent_slots[index] = new_child;
-    parent_slots = child->slots;
+    Node* new_node = NODE_DUP(node);
+    RELEASE(node);
+    *slot = (Val)new_node;
+    slot = new_node->slots + index;
   }
   NB_UNREACHABLE();
 }
 
+// copy slice into a new array, aligned full leaves of the referenced array are shared
+static Array* _slice_flatten(Slice* s) {
+  Array* a = (Array*)s->ref;
+  ArrBuilder b;
+  _builder_init(&b);
+
+  for (int i = 0; i < HEAD_SIZE(s); i++) {
+    RETAIN(s->head[i]);
+    _builder_push(&b, s->head[i]);
+  }
+
+  uint64_t pos = s->offset;
+  uint64_t end = s->offset + s->size - HEAD_SIZE(s);
+  uint64_t tail_offset = TAIL_OFFSET(a);
+  while (pos < end) {
+    if (b.tail_size == 0 && (pos & W_MASK) == 0 && pos + W_MAX <= end && pos + W_MAX <= tail_offset) {
+      Node* leaf = _array_leaf(a, pos);
+      RETAIN(leaf);
+      _builder_push_leaf(&b, leaf);
+      pos += W_MAX;
+    } else {
+      _builder_push(&b, _array_get(a, pos++));
+    }
+  }
+  return _builder_finish(&b);
+}
+
 void _node_debug(Node* node, int depth) {
   if (depth > 0) {
     printf("<node depth=%d size=%hu extra_rc=%hu slots=[", depth, NODE_SIZE(node), ((ValHeader*)node)->extra_rc);
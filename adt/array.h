@@ -26,6 +26,10 @@ Val nb_array_set(Val v, int64_t pos, Val e);
 
 Val nb_array_append(Val v, Val e);
 
+// returns a slice with e inserted at front, W_MAX prepends are buffered in the slice head,
+// then the slice is copied into an array (aligned leaves are shared)
+Val nb_array_prepend(Val v, Val e);
+
 Val nb_array_slice(Val v, uint64_t from, uint64_t len);
 
 // pos can be negative, when pos out of range, just returns the last array
@@ -0,0 +1,18 @@
+#include "val.h"
+#include "utils/bench.h"
+
+void gens_bench();
+void val_bench();
+void utils_bench();
+void array_bench();
+
+#pragma mark ### run them all
+
+int main (int argc, char const *argv[]) {
+  val_trap_backtrace(argv[0]);
+  bench_suite(gens_bench);
+  bench_suite(val_bench);
+  bench_suite(utils_bench);
+  bench_suite(array_bench);
+  return 0;
+}
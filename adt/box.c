@@ -20,10 +20,19 @@ static uint64_t _box_hash(Val b) {
   return val_hash_mem(&v, sizeof(uint64_t));
 }
 
+static size_t _box_size(void* p) {
+  return sizeof(Box);
+}
+
+static void _box_trace(void* p, ValVisitFunc visit, void* ctx) {
+}
+
 void nb_box_init_module() {
   klass_def_internal(KLASS_BOX, val_strlit_new_c("Box"));
   klass_set_eq_func(KLASS_BOX, _box_eq);
   klass_set_hash_func(KLASS_BOX, _box_hash);
+  klass_set_size_func(KLASS_BOX, _box_size);
+  klass_set_trace_func(KLASS_BOX, _box_trace);
 }
 
 Val nb_box_new(uint64_t data) {
@@ -33,11 +33,23 @@ void _cons_destruct(void* p) {
   RELEASE(cons->tail);
 }
 
+static size_t _cons_size(void* p) {
+  return sizeof(Cons);
+}
+
+static void _cons_trace(void* p, ValVisitFunc visit, void* ctx) {
+  Cons* cons = p;
+  visit(&cons->head, ctx);
+  visit(&cons->tail, ctx);
+}
+
 void nb_cons_init_module() {
   klass_def_internal(KLASS_CONS, val_strlit_new_c("Cons"));
   klass_set_destruct_func(KLASS_CONS, _cons_destruct);
   klass_set_hash_func(KLASS_CONS, _cons_hash);
   klass_set_eq_func(KLASS_CONS, _cons_eq);
+  klass_set_size_func(KLASS_CONS, _cons_size);
+  klass_set_trace_func(KLASS_CONS, _cons_trace);
 }
 
 Val nb_cons_new(Val head, Val tail) {
@@ -151,6 +151,18 @@ static Bucket* BUCKET_DUP(Bucket* b) {
   return r;
 }
 
+static size_t BUCKET_BYTE_SIZE(void* bucket) {
+  return sizeof(Bucket) + BUCKET_BYTES(bucket);
+}
+
+static void BUCKET_TRACE(void* bucket, ValVisitFunc visit, void* ctx) {
+  Bucket* b = bucket;
+  visit(&b->v, ctx);
+  for (BucketIter it = BUCKET_ITER_NEW(b); !BUCKET_ITER_IS_END(&it) ; BUCKET_ITER_NEXT(b, &it)) {
+    visit(it.v, ctx);
+  }
+}
+
 static void BUCKET_DESTROY(void* bucket) {
   Bucket* b = bucket;
   RELEASE(b->v);
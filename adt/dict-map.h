@@ -96,6 +96,18 @@ static Map* MAP_DUP(Map* m) {
   return r;
 }
 
+static size_t MAP_BYTE_SIZE(void* node) {
+  return sizeof(Map) + sizeof(Val) * MAP_SIZE(node);
+}
+
+static void MAP_TRACE(void* node, ValVisitFunc visit, void* ctx) {
+  Map* m = node;
+  for (int i = 0; i < MAP_SIZE(m); i++) {
+    visit(m->slots + i, ctx);
+  }
+  visit(&m->v, ctx);
+}
+
 static void MAP_DESTROY(void* node) {
   Map* m = node;
   for (int i = 0; i < MAP_SIZE(m); i++) {
@@ -76,6 +76,15 @@ inline static void DICT_DESTROY(void* p) {
   RELEASE(d->root);
 }
 
+static size_t DICT_BYTE_SIZE(void* p) {
+  return sizeof(Dict);
+}
+
+static void DICT_TRACE(void* p, ValVisitFunc visit, void* ctx) {
+  Dict* d = p;
+  visit(&d->root, ctx);
+}
+
 #pragma mark ### helper decl
 
 static BucketIter _prefix_of_k(Bucket* b, const char* k, size_t ksize);
@@ -106,10 +115,16 @@ void nb_dict_init_module() {
 
   klass_def_internal(KLASS_DICT_MAP, val_strlit_new_c("DictMap"));
   klass_set_destruct_func(KLASS_DICT_MAP, MAP_DESTROY);
+  klass_set_size_func(KLASS_DICT_MAP, MAP_BYTE_SIZE);
+  klass_set_trace_func(KLASS_DICT_MAP, MAP_TRACE);
   klass_def_internal(KLASS_DICT_BUCKET, val_strlit_new_c("DictBucket"));
   klass_set_destruct_func(KLASS_DICT_BUCKET, BUCKET_DESTROY);
+  klass_set_size_func(KLASS_DICT_BUCKET, BUCKET_BYTE_SIZE);
+  klass_set_trace_func(KLASS_DICT_BUCKET, BUCKET_TRACE);
   klass_def_internal(KLASS_DICT, val_strlit_new_c("Dict"));
   klass_set_destruct_func(KLASS_DICT, DICT_DESTROY);
+  klass_set_size_func(KLASS_DICT, DICT_BYTE_SIZE);
+  klass_set_trace_func(KLASS_DICT, DICT_TRACE);
 }
 
 Val nb_dict_new() {
@@ -0,0 +1,68 @@
+#include "double.h"
+#include "map.h"
+#include <ccut.h>
+
+void double_suite() {
+  ccut_test("immediate and boxed doubles") {
+    val_begin_check_memory();
+    double ds[] = {3.6, -3600.0, 1e100, 1.0, 0.5, 0.0, -0.0, 1e-310, 1e200, -1e300};
+    bool imm[] = {true, true, true, false, false, false, false, false, false, false};
+    for (int i = 0; i < sizeof(ds) / sizeof(double); i++) {
+      Val v = nb_double_new(ds[i]);
+      assert_eq(imm[i], VAL_IS_IMM(v));
+      assert_true(nb_val_is_double(v), "should be double");
+      assert_eq(KLASS_DOUBLE, VAL_KLASS(v));
+      assert_eq(VAL_DBL_AS_UINT(ds[i]), VAL_DBL_AS_UINT(nb_double_get(v)));
+      RELEASE(v);
+    }
+    assert_false(nb_val_is_double(VAL_FROM_INT(3)), "int should not be double");
+    val_end_check_memory();
+  }
+
+  ccut_test("boxed double hash and eq") {
+    val_begin_check_memory();
+    Val a = nb_double_new(0.25);
+    Val b = nb_double_new(0.25);
+    Val z = nb_double_new(0.0);
+    Val nz = nb_double_new(-0.0);
+    assert_neq(a, b);
+    assert_true(val_eq(a, b), "should eq");
+    assert_eq(val_hash(a), val_hash(b));
+    assert_false(val_eq(z, nz), "should compare bits");
+    assert_false(val_eq(a, nb_double_new(3.6)), "should not eq immediate");
+    assert_false(val_eq(nb_double_new(3.6), a), "immediate should not eq");
+    assert_false(val_eq(a, VAL_FROM_INT(0)), "should not eq int");
+
+    Val m = nb_map_new();
+    REPLACE(m, nb_map_insert(m, a, VAL_TRUE));
+    assert_eq(VAL_TRUE, nb_map_find(m, b));
+    assert_eq(VAL_UNDEF, nb_map_find(m, z));
+
+    RELEASE(m);
+    RELEASE(a);
+    RELEASE(b);
+    RELEASE(z);
+    RELEASE(nz);
+    val_end_check_memory();
+  }
+
+  ccut_test("boxed doubles are pooled in gen 0") {
+    Val a = nb_double_new(0.125);
+    void* p = (void*)a;
+    RELEASE(a);
+    Val b = nb_double_new(1.5);
+    assert_eq(p, (void*)b);
+    assert_eq(1, VAL_REF_COUNT(b));
+    assert_true(1.5 == nb_double_get(b), "should be reinitialized");
+    RELEASE(b);
+  }
+
+  ccut_test("pooled boxes are freed on thread detach") {
+    Val ds[] = {nb_double_new(0.125), nb_double_new(0.25), nb_double_new(0.375)};
+    for (int i = 0; i < 3; i++) {
+      RELEASE(ds[i]);
+    }
+    assert_true(nb_double_thread_detach() >= 3, "should free pooled boxes");
+    assert_eq(0, nb_double_thread_detach());
+  }
+}
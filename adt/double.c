@@ -0,0 +1,106 @@
+#include "double.h"
+#include <assert.h>
+
+// freed boxes of gen 0 are kept in a per-thread free list,
+// so numeric code producing many short-lived doubles doesn't go through the allocator
+#define DOUBLE_POOL_MAX 256
+
+typedef struct DoubleStruct Double;
+struct DoubleStruct {
+  ValHeader header;
+  union {
+    double d;
+    Double* next; // in pool
+  };
+};
+
+static __thread struct {
+  Double* head;
+  uint32_t size;
+} pool;
+
+static bool _double_eq(Val l, Val r) {
+  if (VAL_KLASS(r) == KLASS_DOUBLE) {
+    // bit equality, same as immediate values
+    return VAL_DBL_AS_UINT(nb_double_get(l)) == VAL_DBL_AS_UINT(nb_double_get(r));
+  } else {
+    return false;
+  }
+}
+
+// same as the hash of an immediate value with the bits
+static uint64_t _double_hash(Val v) {
+  Val bits = VAL_FROM_DBL(nb_double_get(v));
+  return val_hash_mem(&bits, sizeof(Val));
+}
+
+static size_t _double_size(void* p) {
+  return sizeof(Double);
+}
+
+static void _double_trace(void* p, ValVisitFunc visit, void* ctx) {
+}
+
+// NOTE the pool is only used in gen 0, boxes of other gens are freed with their gens
+static void _double_delete(void* p) {
+  if (pool.size < DOUBLE_POOL_MAX && val_gens_get_current() == 0) {
+    val_recycle(p);
+    Double* b = p;
+    b->next = pool.head;
+    pool.head = b;
+    pool.size++;
+  } else {
+    val_free(p);
+  }
+}
+
+void nb_double_init_module() {
+  klass_def_internal(KLASS_DOUBLE, val_strlit_new_c("Double"));
+  klass_set_eq_func(KLASS_DOUBLE, _double_eq);
+  klass_set_hash_func(KLASS_DOUBLE, _double_hash);
+  klass_set_size_func(KLASS_DOUBLE, _double_size);
+  klass_set_trace_func(KLASS_DOUBLE, _double_trace);
+  klass_set_delete_func(KLASS_DOUBLE, _double_delete);
+}
+
+Val nb_double_new(double d) {
+  if (VAL_DBL_CAN_IMM(d)) {
+    return VAL_FROM_DBL(d);
+  }
+
+  Double* b;
+  if (pool.head && val_gens_get_current() == 0) {
+    b = pool.head;
+    pool.head = b->next;
+    pool.size--;
+    val_alloc_recycled(b, KLASS_DOUBLE, sizeof(Double));
+  } else {
+    b = val_alloc(KLASS_DOUBLE, sizeof(Double));
+  }
+  b->d = d;
+  return (Val)b;
+}
+
+size_t nb_double_thread_detach() {
+  size_t n = pool.size;
+  while (pool.head) {
+    Double* b = pool.head;
+    pool.head = b->next;
+    val_free_recycled(b);
+  }
+  pool.size = 0;
+  return n;
+}
+
+double nb_double_get(Val v) {
+  if (VAL_IS_DBL(v)) {
+    return VAL_TO_DBL(v);
+  }
+  Double* b = (Double*)v;
+  assert(b->header.klass == KLASS_DOUBLE);
+  return b->d;
+}
+
+bool nb_val_is_double(Val v) {
+  return VAL_IS_IMM(v) ? VAL_IS_DBL(v) : ((Double*)v)->header.klass == KLASS_DOUBLE;
+}
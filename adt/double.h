@@ -0,0 +1,20 @@
+#pragma once
+
+// doubles that can't be immediate values (see VAL_DBL_CAN_IMM) are boxed,
+// so every double has exactly one representation and val_eq / val_hash don't need to convert
+
+#include "val.h"
+
+void nb_double_init_module();
+
+// free the boxes pooled by the calling thread, called by val_thread_detach.
+// returns the number of freed boxes
+size_t nb_double_thread_detach();
+
+// immediate value if possible, else a boxed double
+Val nb_double_new(double d);
+
+// for both immediate and boxed doubles
+double nb_double_get(Val v);
+
+bool nb_val_is_double(Val v);
@@ -0,0 +1,149 @@
+#include "val.h"
+#include "gens.h"
+#include "array.h"
+#include "map.h"
+#include "utils/bench.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#define ROUNDS 2000
+#define SIZE 1000
+
+static void _array_append_churn() {
+  for (int r = 0; r < ROUNDS; r++) {
+    Val a = nb_array_new_empty();
+    for (int i = 0; i < SIZE; i++) {
+      REPLACE(a, nb_array_append(a, VAL_FROM_INT(i)));
+    }
+    RELEASE(a);
+  }
+}
+
+static void _map_insert_churn() {
+  for (int r = 0; r < ROUNDS / 4; r++) {
+    Val m = nb_map_new();
+    for (int i = 0; i < SIZE; i++) {
+      REPLACE(m, nb_map_insert(m, VAL_FROM_INT(i), VAL_FROM_INT(i)));
+    }
+    RELEASE(m);
+  }
+}
+
+// builds a map in a temporary gen, only the final map survives
+static void _evacuate_map() {
+  int32_t gen = val_gens_new_gen();
+  val_gens_set_current(gen);
+  Val m = nb_map_new();
+  for (int i = 0; i < SIZE * 10; i++) {
+    REPLACE(m, nb_map_insert(m, VAL_FROM_INT(i), VAL_FROM_INT(i)));
+  }
+
+  ValEvacuateStats stats;
+  Val res;
+  bench_run("val_gens_evacuate (map of 10000)", stats.copied_objects) {
+    res = val_gens_evacuate(m, gen - 1, &stats);
+  }
+  printf("    copied %zu objects, %zu bytes, dropped %zu bytes\n", stats.copied_objects, stats.copied_bytes, stats.dropped_bytes);
+
+  val_gens_set_current(gen - 1);
+  val_gens_drop();
+  RELEASE(res);
+}
+
+// transient updates in a long-lived gen, replaced objects are released
+static void _map_churn_in_gen() {
+  int32_t gen = val_gens_new_gen();
+  val_gens_set_current(gen);
+  bench_run("nb_map_insert churn (gen > 0)", ROUNDS / 4 * SIZE) {
+    _map_insert_churn();
+  }
+  printf("    reclaimed %lu bytes\n", (unsigned long)val_gens_reclaimed_bytes(gen));
+  val_gens_set_current(gen - 1);
+  val_gens_drop();
+}
+
+// a parse-like cycle: allocate in a temporary gen then drop it
+static void _gen_cycle(Gens* g) {
+  for (int r = 0; r < ROUNDS; r++) {
+    int32_t gen = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen);
+    for (int i = 0; i < SIZE; i++) {
+      nb_gens_malloc(g, 48);
+    }
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+  }
+}
+
+static void _gen_cycle_bench(const char* name, size_t cache_limit) {
+  Gens* g = nb_gens_new_gens();
+  nb_gens_set_chunk_cache_limit(g, cache_limit);
+  bench_run(name, ROUNDS) {
+    _gen_cycle(g);
+  }
+  NbGensChunkCacheStats stats = nb_gens_chunk_cache_stats(g);
+  printf("    chunk cache hits %lu, misses %lu\n", (unsigned long)stats.hits, (unsigned long)stats.misses);
+  nb_gens_delete_gens(g);
+}
+
+// a parse-sized gen: many small objects then a linear walk over them
+#define PARSE_OBJECTS 200000
+
+static void _parse_sized_gen(Gens* g, int32_t gen) {
+  nb_gens_set_current(g, gen);
+  uint64_t** objs = malloc(sizeof(uint64_t*) * PARSE_OBJECTS);
+  for (int i = 0; i < PARSE_OBJECTS; i++) {
+    objs[i] = nb_gens_malloc(g, 48);
+    objs[i][0] = i;
+  }
+  uint64_t sum = 0;
+  for (int i = 0; i < PARSE_OBJECTS; i++) {
+    sum += objs[(i * 7919) % PARSE_OBJECTS][0];
+  }
+  assert(sum == (uint64_t)PARSE_OBJECTS * (PARSE_OBJECTS - 1) / 2);
+  free(objs);
+  nb_gens_set_current(g, 0);
+  nb_gens_drop(g);
+}
+
+static void _parse_sized_gen_bench() {
+  Gens* g = nb_gens_new_gens();
+  bench_run("parse-sized gen (chunks)", PARSE_OBJECTS) {
+    _parse_sized_gen(g, nb_gens_new_gen(g));
+  }
+  bench_run("parse-sized gen (reserved region)", PARSE_OBJECTS) {
+    _parse_sized_gen(g, nb_gens_new_gen_reserved(g, 64 * 1024 * 1024, false));
+  }
+  bench_run("parse-sized gen (reserved region, huge pages)", PARSE_OBJECTS) {
+    _parse_sized_gen(g, nb_gens_new_gen_reserved(g, 64 * 1024 * 1024, true));
+  }
+  nb_gens_delete_gens(g);
+}
+
+void gens_bench() {
+  val_gens_set_slab_enabled(false);
+  bench_run("nb_array_append churn (malloc)", ROUNDS * SIZE) {
+    _array_append_churn();
+  }
+  val_gens_set_slab_enabled(true);
+  bench_run("nb_array_append churn (slab)", ROUNDS * SIZE) {
+    _array_append_churn();
+  }
+
+  val_gens_set_slab_enabled(false);
+  bench_run("nb_map_insert churn (malloc)", ROUNDS / 4 * SIZE) {
+    _map_insert_churn();
+  }
+  val_gens_set_slab_enabled(true);
+  bench_run("nb_map_insert churn (slab)", ROUNDS / 4 * SIZE) {
+    _map_insert_churn();
+  }
+
+  _evacuate_map();
+  _map_churn_in_gen();
+
+  _gen_cycle_bench("new_gen / drop cycle (no chunk cache)", 0);
+  _gen_cycle_bench("new_gen / drop cycle (chunk cache)", 4 * 1024 * 1024);
+
+  _parse_sized_gen_bench();
+}
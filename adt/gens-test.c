@@ -1,5 +1,17 @@
 #include "gens.h"
 #include <ccut.h>
+#include <string.h>
+#include <setjmp.h>
+
+static int budget_calls;
+static void _raise_budget(Gens* g, int32_t gen, size_t size, void* ctx) {
+  budget_calls++;
+  nb_gens_set_budget(g, gen, nb_gens_stats(g, gen).budget * 2);
+}
+
+static void _jump_out(Gens* g, int32_t gen, size_t size, void* ctx) {
+  longjmp(*(jmp_buf*)ctx, 1);
+}
 
 void gens_suite() {
   ccut_test("gen 0: heap") {
@@ -8,7 +20,25 @@ void gens_suite() {
     void* ptr = nb_gens_malloc(g, 10);
     assert_neq(NULL, ptr);
     ptr = nb_gens_realloc(g, ptr, 10, 20);
-    nb_gens_free(g, ptr);
+    nb_gens_free(g, ptr, 20);
+
+    nb_gens_delete_gens(g);
+  }
+
+  ccut_test("gen 0: slab and malloc") {
+    Gens* g = nb_gens_new_gens();
+
+    void* small = nb_gens_malloc(g, 32);
+    void* large = nb_gens_malloc(g, 1000);
+    small = nb_gens_realloc(g, small, 32, 300);
+    assert_eq(0, ((char*)small)[299]);
+    nb_gens_free(g, small, 300);
+    nb_gens_free(g, large, 1000);
+
+    nb_gens_set_slab_enabled(g, false);
+    small = nb_gens_malloc(g, 32);
+    nb_gens_set_slab_enabled(g, true);
+    nb_gens_free(g, small, 32);
 
     nb_gens_delete_gens(g);
   }
@@ -20,15 +50,167 @@ void gens_suite() {
     void* ptr = nb_gens_malloc(g, 10);
     assert_neq(NULL, ptr);
     ptr = nb_gens_realloc(g, ptr, 10, 20);
-    nb_gens_free(g, ptr);
+    nb_gens_free(g, ptr, 20);
 
     nb_gens_delete_gens(g);
   }
 
   ccut_test("gen >0: arena") {
     Gens* g = nb_gens_new_gens();
+    int32_t gen = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen);
+
+    char* small = nb_gens_malloc(g, 10);
+    char* big = nb_gens_malloc(g, 16 * 1024);
+    assert_neq(NULL, small);
+    memset(big, 1, 16 * 1024);
+    big = nb_gens_realloc(g, big, 16 * 1024, 32 * 1024);
+    assert_eq(1, big[16 * 1024 - 1]);
+    assert_eq(0, big[32 * 1024 - 1]);
+
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+    nb_gens_delete_gens(g);
+  }
+
+  ccut_test("gen >0: free lists") {
+    Gens* g = nb_gens_new_gens();
+    int32_t gen = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen);
+
+    void* p = nb_gens_malloc(g, 40);
+    nb_gens_free(g, p, 40);
+    assert_eq(p, nb_gens_malloc(g, 40));
+    nb_gens_free(g, nb_gens_malloc(g, 100), 0); // unknown size is not reclaimed
+    assert_eq(40, nb_gens_reclaimed_bytes(g, gen));
+
+    // realloc gives back the old memory
+    char* s = nb_gens_malloc(g, 200);
+    s = nb_gens_realloc(g, s, 200, 400);
+    assert_eq(240, nb_gens_reclaimed_bytes(g, gen));
+
+    // memory of another gen is not reused in current gen
+    int32_t gen2 = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen2);
+    char* q = nb_gens_malloc(g, 40);
+    nb_gens_set_current(g, gen);
+    nb_gens_free(g, q, 40);
+    assert_eq(240, nb_gens_reclaimed_bytes(g, gen));
+    assert_true(nb_gens_malloc(g, 40) != q, "should not reuse memory of gen2");
+    nb_gens_set_current(g, gen2);
+    nb_gens_free(g, s, 400);
+    assert_eq(0, nb_gens_reclaimed_bytes(g, gen2));
+
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+    assert_eq(0, nb_gens_reclaimed_bytes(g, gen));
+    nb_gens_delete_gens(g);
+  }
+
+  ccut_test("gen >0: stats and budget") {
+    Gens* g = nb_gens_new_gens();
+    int32_t gen = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen);
+
+    void* p = nb_gens_malloc(g, 100);
+    nb_gens_malloc(g, 200);
+    nb_gens_free(g, p, 100);
+    NbGensStats stats = nb_gens_stats(g, gen);
+    assert_eq(200, stats.bytes);
+    assert_eq(300, stats.high_water);
+    assert_eq(UINT64_MAX, stats.budget);
+    assert_eq(104, stats.reclaimed_bytes); // rounded up to 8
+
+    // a handler raising the budget lets the allocation proceed
+    nb_gens_set_budget(g, gen, 1000);
+    nb_gens_set_budget_handler(g, _raise_budget, NULL);
+    budget_calls = 0;
+    for (int i = 0; i < 10; i++) {
+      nb_gens_malloc(g, 100);
+    }
+    assert_eq(1, budget_calls);
+    stats = nb_gens_stats(g, gen);
+    assert_eq(1200, stats.bytes);
+    assert_eq(2000, stats.budget);
+
+    // a handler jumping out fails the work in gen cleanly
+    jmp_buf jb;
+    nb_gens_set_budget_handler(g, _jump_out, &jb);
+    volatile int allocated = 0;
+    if (setjmp(jb) == 0) {
+      for (;;) {
+        nb_gens_malloc(g, 100);
+        allocated++;
+      }
+    }
+    assert_eq(8, allocated);
+    assert_eq(2000, nb_gens_stats(g, gen).bytes);
+
+    nb_gens_set_budget_handler(g, NULL, NULL);
+    assert_eq(0, nb_gens_stats(g, 0).bytes);
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+    nb_gens_delete_gens(g);
+  }
+
+  ccut_test("gen >0: reserved region") {
+    Gens* g = nb_gens_new_gens();
+    int32_t gen = nb_gens_new_gen_reserved(g, 16 * 1024 * 1024, true);
+    nb_gens_set_current(g, gen);
+
+    char* first = nb_gens_malloc(g, 48);
+    char* last = first;
+    for (int i = 0; i < 100000; i++) {
+      last = nb_gens_malloc(g, 48);
+    }
+    assert_eq(100000 * 48, last - first); // contiguous
+    char* big = nb_gens_malloc(g, 16 * 1024);
+    memset(big, 1, 16 * 1024);
+    big = nb_gens_realloc(g, big, 16 * 1024, 32 * 1024);
+    assert_eq(1, big[16 * 1024 - 1]);
+    assert_eq(0, big[32 * 1024 - 1]);
+
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+    assert_eq(0, nb_gens_max_gen(g));
+    nb_gens_delete_gens(g);
+  }
+
+  ccut_test("gen >0: chunk cache") {
+    Gens* g = nb_gens_new_gens();
+    for (int r = 0; r < 10; r++) {
+      int32_t gen = nb_gens_new_gen(g);
+      assert_eq(1, gen);
+      nb_gens_set_current(g, gen);
+      for (int i = 0; i < 1000; i++) {
+        nb_gens_malloc(g, 48);
+      }
+      nb_gens_set_current(g, 0);
+      nb_gens_drop(g);
+
+      NbGensChunkCacheStats stats = nb_gens_chunk_cache_stats(g);
+      if (r == 0) {
+        assert_eq(0, stats.hits);
+        assert_true(stats.misses > 0, "first round should malloc");
+      }
+    }
+    // steady state: chunks of later rounds all come from the cache
+    NbGensChunkCacheStats stats = nb_gens_chunk_cache_stats(g);
+    assert_eq(stats.misses * 9, stats.hits);
+    assert_true(stats.retained_bytes > 0, "chunks should be retained");
+
+    nb_gens_trim_chunk_cache(g, 0);
+    stats = nb_gens_chunk_cache_stats(g);
+    assert_eq(0, stats.retained_bytes);
 
-    // todo
+    nb_gens_set_chunk_cache_limit(g, 0);
+    int32_t gen = nb_gens_new_gen(g);
+    nb_gens_set_current(g, gen);
+    nb_gens_malloc(g, 48);
+    nb_gens_set_current(g, 0);
+    nb_gens_drop(g);
+    stats = nb_gens_chunk_cache_stats(g);
+    assert_eq(0, stats.retained_bytes);
 
     nb_gens_delete_gens(g);
   }
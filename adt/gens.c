@@ -1,39 +1,64 @@
 #include "gens.h"
 #include "utils/arena.h"
+#include "utils/hash.h"
 #include "utils/mut-array.h"
-#include "utils/mut-map.h"
+#include "utils/swiss-map.h"
+#include "utils/slab.h"
 #include "val.h"
 #include <assert.h>
-#include <siphash.h>
 #include <stdint.h>
 
 // generational memory management
 // TODO atomicity for concurrency
 
-static uint8_t hash_key[16];
-static void _init() __attribute__((constructor(0)));
-static void _init() {
-  for (long i = 0; i < 16; i++) {
-    hash_key[i] = i*i + 5;
-  }
-}
+// a gen > 0
+typedef struct {
+  Arena arena;
+  uint64_t bytes;      // bytes of allocations not freed
+  uint64_t high_water; // max of bytes, updated lazily (see _gen_arena_update_high_water)
+  uint64_t budget;     // allocating beyond it calls the budget handler
+} GenArena;
 
-MUT_ARRAY_DECL(Arenas, Arena*);
+MUT_ARRAY_DECL(Arenas, GenArena);
 
 static uint64_t mm_hash(uint64_t k) {
-  return siphash(hash_key, (const uint8_t*)&k, 8);
+  return fast_hash_u64(k);
 }
 
 static bool mm_eq(uint64_t k1, uint64_t k2) {
   return k1 == k2;
 }
 
-MUT_MAP_DECL(MM, uint64_t, uint64_t, mm_hash, mm_eq);
+SWISS_MAP_DECL(MM, uint64_t, uint64_t, mm_hash, mm_eq);
+
+typedef struct {
+  uintptr_t begin;
+  uintptr_t end;
+} Range;
 
+MUT_ARRAY_DECL(Ranges, Range);
+
+struct NbGensSpanStruct {
+  struct Ranges ranges; // sorted by begin
+  size_t bytes;
+};
+
+// chunks (and large objects) searched when freeing in a gen > 0
+#define GENS_FREE_SCAN_LIMIT 16
+
+// chunks retained across new_gen / drop cycles
+#define GENS_CHUNK_CACHE_LIMIT (4 * 1024 * 1024)
+
+// NOTE Gens is thread local (see val.c), so the slab and the chunk cache are also per-thread
 struct GensStruct {
-  struct Arenas arenas;
+  struct Arenas arenas; // stored by value so a new gen doesn't malloc
   int current; // -1 for checked memory, 0 for normal heap
   struct MM checked_memory_map;
+  Slab slab; // small objects in gen 0
+  bool slab_enabled;
+  ArenaChunkCache chunk_cache; // shared by arenas of gens > 0
+  NbGensBudgetHandler budget_handler;
+  void* budget_handler_ctx;
 };
 
 static void _heap_mem_insert(Gens* gens, void* p, uint64_t size) {
@@ -65,14 +90,44 @@ static void _heap_mem_remove(Gens* gens, void* p) {
   }
 }
 
+// bytes only grow in malloc, so the mark is taken before bytes decrease,
+// then the allocation fast path only compares bytes with budget.
+static void _gen_arena_update_high_water(GenArena* ga) {
+  if (ga->bytes > ga->high_water) {
+    ga->high_water = ga->bytes;
+  }
+}
+
+static void _gen_arena_init(GenArena* ga) {
+  ga->bytes = 0;
+  ga->high_water = 0;
+  ga->budget = UINT64_MAX;
+}
+
+static void _default_budget_handler(Gens* g, int32_t gen, size_t size, void* ctx) {
+  NbGensStats stats = nb_gens_stats(g, gen);
+  fatal_err("gen %d exceeds memory budget %lu bytes, allocating %lu bytes",
+    gen, (unsigned long)stats.budget, (unsigned long)size);
+}
+
 Gens* nb_gens_new_gens() {
   Gens* g = malloc(sizeof(Gens));
   Arenas.init(&g->arenas, 4);
 
-  Arenas.push(&g->arenas, NULL); // arenas[0] is not used
+  GenArena unused;
+  arena_init(&unused.arena);
+  _gen_arena_init(&unused);
+  Arenas.push(&g->arenas, unused); // arenas[0] is not used
 
   MM.init(&g->checked_memory_map);
 
+  slab_init(&g->slab);
+  g->slab_enabled = true;
+
+  arena_chunk_cache_init(&g->chunk_cache, GENS_CHUNK_CACHE_LIMIT);
+  g->budget_handler = _default_budget_handler;
+  g->budget_handler_ctx = NULL;
+
   g->current = 0;
   return g;
 }
@@ -80,24 +135,37 @@ Gens* nb_gens_new_gens() {
 void nb_gens_delete_gens(Gens* g) {
   // skip 0 which doesn't require free
   for (int i = 1; i < Arenas.size(&g->arenas); i++) {
-    Arena* arena = *Arenas.at(&g->arenas, i);
-    arena_delete(arena);
+    arena_cleanup(&Arenas.at(&g->arenas, i)->arena);
   }
   Arenas.cleanup(&g->arenas);
+  arena_chunk_cache_cleanup(&g->chunk_cache);
   MM.cleanup(&g->checked_memory_map);
+  slab_cleanup(&g->slab);
   free(g);
 }
 
 void* nb_gens_malloc(Gens* g, size_t size) {
   if (g->current == 0) {
+    if (g->slab_enabled) {
+      void* p = slab_alloc(&g->slab, size);
+      if (p) {
+        return p;
+      }
+    }
     return malloc(size);
   } else if (g->current > 0) {
-    Arena* arena = *Arenas.at(&g->arenas, g->current);
-    int qword_count = (size + 7) / 8;
-    void* p = arena_slot_alloc(arena, qword_count);
+    GenArena* ga = Arenas.at(&g->arenas, g->current);
+    ga->bytes += size;
+    if (ga->bytes > ga->budget) {
+      ga->bytes -= size; // not counted if the handler doesn't return
+      g->budget_handler(g, g->current, size, g->budget_handler_ctx);
+      ga->bytes += size;
+    }
+    Arena* arena = &ga->arena;
+    void* p = arena_alloc(arena, size);
     if (val_is_tracing()) {
-      printf("[nb_gens_malloc] gen: %d, arena: %p, size: %lu, qword: %u, res: %p\n",
-        g->current, arena, size, (unsigned)qword_count, p);
+      printf("[nb_gens_malloc] gen: %d, arena: %p, size: %lu, res: %p\n",
+        g->current, arena, size, p);
     }
     return p;
   } else {
@@ -107,11 +175,27 @@ void* nb_gens_malloc(Gens* g, size_t size) {
   }
 }
 
-void nb_gens_free(Gens* g, void* p) {
+void nb_gens_free(Gens* g, void* p, size_t size) {
   if (g->current == 0) {
-    free(p);
+    // NOTE slab pointers are checked regardless of slab_enabled, since it can be toggled
+    if (slab_contains(p)) {
+      slab_free(&g->slab, p);
+    } else {
+      free(p);
+    }
   } else if (g->current > 0) {
-    // TODO mark object as freed
+    // only memory of the current gen is reused, memory of other gens is kept until they are dropped.
+    // NOTE the ownership check only scans the newest chunks, older objects are also kept until drop.
+    if (slab_contains(p)) {
+      slab_free(&g->slab, p);
+    } else if (size) {
+      GenArena* ga = Arenas.at(&g->arenas, g->current);
+      if (arena_contains(&ga->arena, p, GENS_FREE_SCAN_LIMIT)) {
+        _gen_arena_update_high_water(ga);
+        ga->bytes = ga->bytes > size ? ga->bytes - size : 0;
+        arena_free(&ga->arena, p, size);
+      }
+    }
   } else {
     _heap_mem_remove(g, p);
     free(p);
@@ -121,15 +205,26 @@ void nb_gens_free(Gens* g, void* p) {
 void* nb_gens_realloc(Gens* g, void* p, size_t osize, size_t nsize) {
   void* new_p;
   if (g->current == 0) {
-    new_p = realloc(p, nsize);
+    if (slab_contains(p)) {
+      if (nsize <= slab_slot_bytes(p)) {
+        new_p = p;
+      } else {
+        new_p = nb_gens_malloc(g, nsize);
+        memcpy(new_p, p, osize);
+        slab_free(&g->slab, p);
+      }
+    } else {
+      new_p = realloc(p, nsize);
+    }
   } else if (g->current > 0) {
     new_p = nb_gens_malloc(g, nsize);
     assert(new_p != p);
     memcpy(new_p, p, osize);
-    nb_gens_free(g, p);
+    nb_gens_free(g, p, osize);
   } else {
-    new_p = realloc(p, nsize);
+    // remove before realloc, it reads the header of p
     _heap_mem_remove(g, p);
+    new_p = realloc(p, nsize);
     _heap_mem_insert(g, new_p, nsize);
   }
 
@@ -139,9 +234,22 @@ void* nb_gens_realloc(Gens* g, void* p, size_t osize, size_t nsize) {
 
 // add new gen, and return the number (doesn't select it)
 int32_t nb_gens_new_gen(Gens* g) {
-  Arena* arena = arena_new();
+  GenArena ga;
+  arena_init_cached(&ga.arena, &g->chunk_cache);
+  _gen_arena_init(&ga);
+  int index = Arenas.size(&g->arenas);
+  Arenas.push(&g->arenas, ga);
+  return index;
+}
+
+// add new gen backed by a lazily committed region of reserve_bytes
+int32_t nb_gens_new_gen_reserved(Gens* g, size_t reserve_bytes, bool huge_pages) {
+  GenArena ga;
+  arena_init_region(&ga.arena, reserve_bytes, huge_pages);
+  ga.arena.cache = &g->chunk_cache; // for chunks after the region is exhausted
+  _gen_arena_init(&ga);
   int index = Arenas.size(&g->arenas);
-  Arenas.push(&g->arenas, arena);
+  Arenas.push(&g->arenas, ga);
   return index;
 }
 
@@ -167,13 +275,121 @@ void nb_gens_set_current(Gens* g, int32_t i) {
   g->current = i;
 }
 
-// drop generations after current
+void nb_gens_set_slab_enabled(Gens* g, bool enabled) {
+  g->slab_enabled = enabled;
+}
+
+void nb_gens_set_chunk_cache_limit(Gens* g, size_t bytes) {
+  g->chunk_cache.limit_bytes = bytes;
+  arena_chunk_cache_trim(&g->chunk_cache, bytes);
+}
+
+void nb_gens_trim_chunk_cache(Gens* g, size_t keep_bytes) {
+  arena_chunk_cache_trim(&g->chunk_cache, keep_bytes);
+}
+
+NbGensChunkCacheStats nb_gens_chunk_cache_stats(Gens* g) {
+  NbGensChunkCacheStats stats = {
+    .hits = g->chunk_cache.hits,
+    .misses = g->chunk_cache.misses,
+    .retained_bytes = g->chunk_cache.retained_bytes
+  };
+  return stats;
+}
+
+uint64_t nb_gens_reclaimed_bytes(Gens* g, int32_t gen) {
+  return nb_gens_stats(g, gen).reclaimed_bytes;
+}
+
+NbGensStats nb_gens_stats(Gens* g, int32_t gen) {
+  NbGensStats stats = {.budget = UINT64_MAX};
+  if (gen <= 0 || gen >= Arenas.size(&g->arenas)) {
+    return stats;
+  }
+  GenArena* ga = Arenas.at(&g->arenas, gen);
+  _gen_arena_update_high_water(ga);
+  stats.bytes = ga->bytes;
+  stats.high_water = ga->high_water;
+  stats.budget = ga->budget;
+  stats.reclaimed_bytes = ga->arena.reclaimed_bytes;
+  return stats;
+}
+
+void nb_gens_set_budget(Gens* g, int32_t gen, uint64_t bytes) {
+  assert(0 < gen && gen < (int32_t)Arenas.size(&g->arenas));
+  Arenas.at(&g->arenas, gen)->budget = bytes;
+}
+
+void nb_gens_set_budget_handler(Gens* g, NbGensBudgetHandler handler, void* ctx) {
+  g->budget_handler = handler ? handler : _default_budget_handler;
+  g->budget_handler_ctx = ctx;
+}
+
+// drop generations after current, their chunks go back to the chunk cache
 void nb_gens_drop(Gens* g) {
-  for (int i = g->current + 1; i < Arenas.size(&g->arenas); i++) {
-    Arena* arena = *Arenas.at(&g->arenas, i);
-    arena_delete(arena);
+  int keep = g->current < 0 ? 1 : g->current + 1; // arenas[0] is always kept
+  for (int i = keep; i < Arenas.size(&g->arenas); i++) {
+    arena_cleanup(&Arenas.at(&g->arenas, i)->arena);
+  }
+  if (keep < Arenas.size(&g->arenas)) {
+    g->arenas.size = keep;
   }
-  g->arenas.size = g->current;
+}
+
+#pragma mark ## span of gens
+
+static int _range_compare(const void* l, const void* r) {
+  uintptr_t lb = ((const Range*)l)->begin;
+  uintptr_t rb = ((const Range*)r)->begin;
+  return lb < rb ? -1 : lb > rb;
+}
+
+NbGensSpan* nb_gens_span_new(Gens* g, int32_t gen) {
+  NbGensSpan* span = malloc(sizeof(NbGensSpan));
+  Ranges.init(&span->ranges, 0);
+  span->bytes = 0;
+
+  for (int i = (gen < 0 ? 0 : gen) + 1; i < Arenas.size(&g->arenas); i++) {
+    Arena* arena = &Arenas.at(&g->arenas, i)->arena;
+    for (ArenaChunk* chunk = arena->head; chunk; chunk = chunk->next) {
+      Range r = {(uintptr_t)chunk->data, (uintptr_t)chunk->data + chunk->i};
+      Ranges.push(&span->ranges, r);
+    }
+    for (ArenaLarge* large = arena->large; large; large = large->next) {
+      Range r = {(uintptr_t)ARENA_LARGE_DATA(large), (uintptr_t)ARENA_LARGE_DATA(large) + large->bytes};
+      Ranges.push(&span->ranges, r);
+    }
+    span->bytes += arena_used_bytes(arena);
+  }
+
+  qsort(span->ranges.data, span->ranges.size, sizeof(Range), _range_compare);
+  return span;
+}
+
+void nb_gens_span_delete(NbGensSpan* span) {
+  Ranges.cleanup(&span->ranges);
+  free(span);
+}
+
+bool nb_gens_span_contains(NbGensSpan* span, void* p) {
+  uintptr_t u = (uintptr_t)p;
+  Range* ranges = span->ranges.data;
+  size_t lo = 0;
+  size_t hi = span->ranges.size;
+  // find the last range with begin <= u
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (ranges[mid].begin <= u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo && u < ranges[lo - 1].end;
+}
+
+size_t nb_gens_span_bytes(NbGensSpan* span) {
+  return span->bytes;
 }
 
 #pragma mark ## debug functions
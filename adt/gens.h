@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 struct GensStruct;
 typedef struct GensStruct Gens;
@@ -15,6 +16,12 @@ void nb_gens_delete_gens(Gens* gens);
 // add new gen, and return the number (doesn't select it)
 int32_t nb_gens_new_gen(Gens* g);
 
+// add new gen that allocates from one contiguous region of reserve_bytes address space.
+// memory is committed lazily as the gen grows, and dropping the gen unmaps the region at once.
+// use it for big gens (for example a parse of a large file) to reduce malloc calls and TLB misses.
+// huge_pages advises transparent huge pages (linux only).
+int32_t nb_gens_new_gen_reserved(Gens* g, size_t reserve_bytes, bool huge_pages);
+
 // return max gen number
 int32_t nb_gens_max_gen(Gens* g);
 
@@ -24,19 +31,85 @@ int32_t nb_gens_get_current(Gens* g);
 // set current gen number
 void nb_gens_set_current(Gens* g, int32_t i);
 
+// small objects in gen 0 are served by a size-class slab (see utils/slab.h), enabled by default.
+// disable it to let every object go through malloc (for example when checking memory with external tools)
+void nb_gens_set_slab_enabled(Gens* g, bool enabled);
+
 // drop generations after current
 void nb_gens_drop(Gens* g);
 
+// total bytes freed for reuse in gen (> 0), a gen with fewer reclaimed bytes grows faster
+uint64_t nb_gens_reclaimed_bytes(Gens* g, int32_t gen);
+
+#pragma mark ## memory accounting of gens > 0
+
+typedef struct {
+  uint64_t bytes;      // bytes allocated and not freed (objects freed with unknown size are still counted)
+  uint64_t high_water; // max of bytes since the gen is created
+  uint64_t budget;     // UINT64_MAX if unlimited
+  uint64_t reclaimed_bytes;
+} NbGensStats;
+
+// called when an allocation would make bytes of gen exceed its budget.
+// the default handler logs an error and exits.
+// a handler may longjmp out (for example to abort a parse), or raise the budget and return,
+// then the allocation proceeds.
+typedef void (*NbGensBudgetHandler)(Gens* g, int32_t gen, size_t size, void* ctx);
+
+// stats of gen, all zero (budget unlimited) for gen <= 0 which are not accounted
+NbGensStats nb_gens_stats(Gens* g, int32_t gen);
+
+// budget of gen (> 0) in bytes, unlimited by default
+void nb_gens_set_budget(Gens* g, int32_t gen, uint64_t bytes);
+
+// NULL to restore the default handler
+void nb_gens_set_budget_handler(Gens* g, NbGensBudgetHandler handler, void* ctx);
+
+#pragma mark ## chunk cache
+
+// arena chunks of dropped gens are retained per Gens and reused by later gens,
+// so a steady new_gen / drop cycle doesn't call malloc for chunks.
+
+typedef struct {
+  uint64_t hits;   // chunks served from the cache
+  uint64_t misses; // chunks served by malloc
+  uint64_t retained_bytes;
+} NbGensChunkCacheStats;
+
+// max bytes retained by the cache (default 4MB), extra chunks are freed on drop
+void nb_gens_set_chunk_cache_limit(Gens* g, size_t bytes);
+
+// free retained chunks until at most keep_bytes remain
+void nb_gens_trim_chunk_cache(Gens* g, size_t keep_bytes);
+
+NbGensChunkCacheStats nb_gens_chunk_cache_stats(Gens* g);
+
 #pragma mark ## alloc functions
 
 void* nb_gens_malloc(Gens* g, size_t size);
 
-void nb_gens_free(Gens* g, void* p);
+// size can be 0 if unknown, then the memory of an object in gens > 0 is not reused until drop.
+// in gens > 0, freed objects are kept in size-segregated free lists and reused before bump allocation.
+void nb_gens_free(Gens* g, void* p, size_t size);
 
 // for special mutable node. prereq: rc=1
 void* nb_gens_realloc(Gens* g, void* p, size_t osize, size_t nsize);
 
-// TODO evacuate functions
+#pragma mark ## span of gens, for evacuation (see val_gens_evacuate)
+
+struct NbGensSpanStruct;
+typedef struct NbGensSpanStruct NbGensSpan;
+
+// snapshot address ranges of gens > gen
+NbGensSpan* nb_gens_span_new(Gens* g, int32_t gen);
+
+void nb_gens_span_delete(NbGensSpan* span);
+
+// if p is allocated in the span, O(log(chunks))
+bool nb_gens_span_contains(NbGensSpan* span, void* p);
+
+// bytes allocated in the span
+size_t nb_gens_span_bytes(NbGensSpan* span);
 
 #pragma mark ## debug functions
 
@@ -4,7 +4,15 @@
 
 #include "val.h"
 #include "utils/mut-array.h"
-#include "utils/mut-map.h"
+#include "utils/swiss-map.h"
+#include "utils/hash.h"
+#include <stdatomic.h>
+
+// calls a c function taking obj and exactly N args from argv
+typedef ValPair (*MethodThunk)(Val obj, ValMethodFunc func, Val* argv);
+
+// thunks are generated up to this arity, larger ones go through val_c_call2
+#define METHOD_THUNK_MAX_ARGC 6
 
 // def foo a b c      # min_argc = max_argc = 3
 // case def foo       # min_argc = -1, max_argc = -1
@@ -15,6 +23,7 @@ typedef struct {
   int32_t min_argc;
   int32_t max_argc; // -1 if not limited
   int32_t func_takes_argv;
+  MethodThunk thunk; // NULL if not a func or argc > METHOD_THUNK_MAX_ARGC
   union {
     void* code;
     ValMethodFunc func;
@@ -45,6 +54,8 @@ static ValPair METHOD_INVOKE(Val obj, Method* m, int argc, Val* argv) {
     }
     if (m->func_takes_argv) {
       return m->as.func2(obj, argc, argv);
+    } else if (m->thunk) {
+      return m->thunk(obj, m->as.func, argv);
     } else {
       return val_c_call2(obj, m->as.func, argc, argv);
     }
@@ -55,16 +66,16 @@ static ValPair METHOD_INVOKE(Val obj, Method* m, int argc, Val* argv) {
 }
 
 static uint64_t ID_HASH(uint32_t id) {
-  return val_hash_mem(&id, sizeof(uint32_t));
+  return fast_hash_u64(id);
 }
 
 static uint64_t ID_EQ(uint32_t idl, uint32_t idr) {
   return idl == idr;
 }
 
-MUT_MAP_DECL(IdMethods, uint32_t, Method*, ID_HASH, ID_EQ);
+SWISS_MAP_DECL(IdMethods, uint32_t, Method*, ID_HASH, ID_EQ);
 MUT_ARRAY_DECL(Includes, uint32_t);
-MUT_MAP_DECL(IdFieldIndexes, uint32_t, uint32_t, ID_HASH, ID_EQ);
+SWISS_MAP_DECL(IdFieldIndexes, uint32_t, uint32_t, ID_HASH, ID_EQ);
 MUT_ARRAY_DECL(Fields, NbStructField);
 
 // class metadata
@@ -77,6 +88,10 @@ typedef struct {
   struct IdMethods id_methods; // {id => Method*}
   struct Includes includes; // [uint32_t]
 
+  // own methods merged with methods of includes, built on lookup when flat_epoch is stale
+  struct IdMethods flat_methods; // {id => Method*}
+  _Atomic(uint32_t) flat_epoch;  // 0 if not built
+
   // struct only:
   struct IdFieldIndexes id_field_indexes; // {id => field_index}
   struct Fields fields; // [NbStructField]
@@ -86,6 +101,8 @@ typedef struct {
   ValCallbackFunc destruct_func;
   ValCallbackFunc delete_func;
   ValCallbackFunc debug_func;
+  ValSizeFunc size_func;
+  ValTraceFunc trace_func;
   void* data; // some klasses require custom data
   // todo cache hash and eq func?
 } Klass;
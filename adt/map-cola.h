@@ -127,6 +127,20 @@ static Slot COLA_REMOVE(Cola* old, Val k, Val* prev_v, bool* size_decreased) {
   return res;
 }
 
+static size_t COLA_BYTE_SIZE(void* ptr) {
+  return COLA_BYTES(SIZE((Cola*)ptr));
+}
+
+static void COLA_TRACE(void* ptr, ValVisitFunc visit, void* ctx) {
+  Cola* cola = ptr;
+  for (int i = 0; i < SIZE(cola); i++) {
+    visit(&cola->kvs[i].k, ctx);
+    if (!IS_INT_VALUED(cola)) {
+      visit(&cola->kvs[i].v, ctx);
+    }
+  }
+}
+
 static void COLA_DESTROY(void* ptr) {
   Cola* cola = ptr;
   for (int i = 0; i < SIZE(cola); i++) {
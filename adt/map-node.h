@@ -103,6 +103,17 @@ static void SLOT_RELEASE(Slot* slot, bool is_int_valued) {
   }
 }
 
+static void SLOT_TRACE(Slot* slot, bool is_int_valued, ValVisitFunc visit, void* ctx) {
+  if (SLOT_IS_KV(slot)) {
+    visit(&slot->kv.k, ctx);
+    if (!is_int_valued) {
+      visit(&slot->kv.v, ctx);
+    }
+  } else {
+    visit(&slot->h, ctx);
+  }
+}
+
 #pragma mark ### node
 
 static Node* NODE_ALLOC(size_t size, int level, bool is_int_valued) {
@@ -250,6 +261,17 @@ static NodeBm NODE_BM_REMOVE(NodeBm nb, uint64_t hash) {
   return res;
 }
 
+static size_t NODE_BYTE_SIZE(void* ptr) {
+  return sizeof(Node) + sizeof(Slot) * SIZE((Node*)ptr);
+}
+
+static void NODE_TRACE(void* ptr, ValVisitFunc visit, void* ctx) {
+  Node* node = ptr;
+  for (int i = 0; i < SIZE(node); i++) {
+    SLOT_TRACE(node->slots + i, IS_INT_VALUED(node), visit, ctx);
+  }
+}
+
 static void NODE_DESTROY(void* ptr) {
   Node* node = ptr;
 
@@ -48,6 +48,18 @@ static void MAP_DESTROY(void* p) {
   }
 }
 
+static size_t MAP_BYTE_SIZE(void* p) {
+  return sizeof(Map) + sizeof(Slot) * MAP_ROOT_SIZE((Map*)p);
+}
+
+static void MAP_TRACE(void* p, ValVisitFunc visit, void* ctx) {
+  Map* map = p;
+  int size = MAP_ROOT_SIZE(map);
+  for (int i = 0; i < size; i++) {
+    SLOT_TRACE(map->slots + i, MAP_IS_INT_VALUED(map), visit, ctx);
+  }
+}
+
 // similar to NODE_FIND_SLOT
 // return NULL if not found
 static Slot* MAP_FIND_SLOT(Map* h, uint64_t hash) {
@@ -151,10 +163,16 @@ void nb_map_init_module() {
   // destructor func
   klass_def_internal(KLASS_MAP, val_strlit_new_c("Map"));
   klass_set_destruct_func(KLASS_MAP, MAP_DESTROY);
+  klass_set_size_func(KLASS_MAP, MAP_BYTE_SIZE);
+  klass_set_trace_func(KLASS_MAP, MAP_TRACE);
   klass_def_internal(KLASS_MAP_NODE, val_strlit_new_c("MapNode"));
   klass_set_destruct_func(KLASS_MAP_NODE, NODE_DESTROY);
+  klass_set_size_func(KLASS_MAP_NODE, NODE_BYTE_SIZE);
+  klass_set_trace_func(KLASS_MAP_NODE, NODE_TRACE);
   klass_def_internal(KLASS_MAP_COLA, val_strlit_new_c("MapCola"));
   klass_set_destruct_func(KLASS_MAP_COLA, COLA_DESTROY);
+  klass_set_size_func(KLASS_MAP_COLA, COLA_BYTE_SIZE);
+  klass_set_trace_func(KLASS_MAP_COLA, COLA_TRACE);
 }
 
 Val nb_map_new() {
@@ -17,7 +17,7 @@ void string_suite() {
     REPLACE(s1, nb_string_concat(s1, s2));
 
     size_t sz = nb_string_byte_size(s1);
-    const char* s = nb_string_ptr(s1);
+    const char* s = NB_STRING_BYTES(s1);
     assert_eq(strlen("sliceconcat"), sz);
     assert_eq(0, memcmp(s, "sliceconcat", sz));
 
@@ -41,7 +41,7 @@ void string_suite() {
     val_begin_check_memory();
     Val s = nb_string_new_literal_c("foo");
     assert_eq(3, nb_string_byte_size(s));
-    assert_mem_eq("foo", nb_string_ptr(s), 3);
+    assert_mem_eq("foo", NB_STRING_BYTES(s), 3);
     val_end_check_memory();
   }
 
@@ -71,4 +71,59 @@ void string_suite() {
     RELEASE(s2);
     val_end_check_memory();
   }
+
+  ccut_test("short strings") {
+    val_begin_check_memory();
+    Val s1 = nb_string_new(3, "foo");
+    assert_true(VAL_IS_SSTR(s1), "should be packed");
+    assert_eq(KLASS_STRING, VAL_KLASS(s1));
+    assert_eq(-1, VAL_REF_COUNT(s1));
+    assert_eq(3, nb_string_byte_size(s1));
+    char buf[8];
+    assert_true(nb_string_bytes(s1, buf) == buf, "should decode into buf, not intern");
+    assert_mem_eq("foo", buf, 3);
+    assert_eq(s1, nb_string_new_c("foo"));
+
+    Val lit = nb_string_new_literal_c("foo");
+    Val heap = nb_string_new_transient(3);
+    memcpy((char*)nb_string_ptr(heap), "foo", 3);
+    assert_true(val_eq(s1, lit), "should eq literal");
+    assert_true(val_eq(lit, s1), "literal should eq");
+    assert_true(val_eq(s1, heap), "should eq heap string");
+    assert_true(val_eq(heap, s1), "heap string should eq");
+    assert_false(val_eq(s1, nb_string_new_c("fob")), "should not eq");
+    assert_false(val_eq(s1, nb_string_new_literal_c("bar")), "should not eq other literal");
+    assert_eq(val_hash(lit), val_hash(s1));
+    assert_eq(val_hash(heap), val_hash(s1));
+    assert_eq(0, nb_string_cmp(s1, heap));
+
+    Val empty = nb_string_new(0, NULL);
+    assert_true(VAL_IS_SSTR(empty), "empty should be packed");
+    assert_eq(0, nb_string_byte_size(empty));
+    assert_eq(empty, nb_string_slice(s1, 5, 1));
+
+    // grows out of the value at 8 bytes, and back into it when sliced
+    Val s7 = nb_string_concat(s1, nb_string_new_c("barz"));
+    assert_true(VAL_IS_SSTR(s7), "7 bytes should be packed");
+    assert_mem_eq("foobarz", NB_STRING_BYTES(s7), 7);
+    Val s8 = nb_string_concat(s7, nb_string_new_c("!"));
+    assert_false(VAL_IS_IMM(s8), "8 bytes should be allocated");
+    assert_mem_eq("foobarz!", NB_STRING_BYTES(s8), 8);
+    Val s2 = nb_string_slice(s8, 3, 3);
+    assert_true(VAL_IS_SSTR(s2), "short slice should be packed");
+    assert_eq(nb_string_new_c("bar"), s2);
+    assert_eq(nb_string_new_c("oob"), nb_string_concat(nb_string_slice(s1, 1, 10), nb_string_slice(s7, 3, 1)));
+
+    // bytes of a long slice start at its offset
+    Val s9 = nb_string_concat(s8, nb_string_new_c("9"));
+    Val long_slice = nb_string_slice(s9, 1, 8);
+    assert_false(VAL_IS_IMM(long_slice), "8 bytes slice should be allocated");
+    assert_mem_eq("oobarz!9", nb_string_ptr(long_slice), 8);
+
+    RELEASE(long_slice);
+    RELEASE(s9);
+    RELEASE(s8);
+    RELEASE(heap);
+    val_end_check_memory();
+  }
 }
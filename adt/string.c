@@ -22,22 +22,28 @@ typedef struct {
 #define IS_SLICE(s) (s)->h.user1
 #define BYTE_SIZE(s) (s)->byte_size
 
-static uint64_t _hash_func(Val str);
-static bool _eq_func(Val l, Val r);
 static void _destructor(void* p);
+static size_t _size_func(void* p);
+static void _trace_func(void* p, ValVisitFunc visit, void* ctx);
 
 static String* _alloc_string(size_t size);
 static SSlice* _alloc_s_slice();
-static Val _slice_from_literal(Val v, size_t from, size_t len);
+static Val _sstr_new(size_t size, const char* p);
+static const char* _bytes(Val s, char* buf, size_t* size);
 
 void nb_string_init_module() {
   klass_def_internal(KLASS_STRING, val_strlit_new_c("String"));
-  klass_set_hash_func(KLASS_STRING, _hash_func);
-  klass_set_eq_func(KLASS_STRING, _eq_func);
+  klass_set_hash_func(KLASS_STRING, nb_string_hash);
+  klass_set_eq_func(KLASS_STRING, nb_string_eq);
   klass_set_destruct_func(KLASS_STRING, _destructor);
+  klass_set_size_func(KLASS_STRING, _size_func);
+  klass_set_trace_func(KLASS_STRING, _trace_func);
 }
 
 Val nb_string_new(size_t size, const char* p) {
+  if (size <= VAL_SSTR_MAX) {
+    return _sstr_new(size, p);
+  }
   String* s = _alloc_string(size);
   memcpy(s->str, p, size);
   return (Val)s;
@@ -74,6 +80,9 @@ size_t nb_string_byte_size(Val s) {
   if (VAL_IS_STR(s)) {
     return val_strlit_byte_size(VAL_TO_STR(s));
   }
+  if (VAL_IS_SSTR(s)) {
+    return VAL_SSTR_SIZE(s);
+  }
   assert(!VAL_IS_IMM(s));
   return BYTE_SIZE((String*)s);
 }
@@ -83,29 +92,40 @@ const char* nb_string_ptr(Val s) {
     return val_strlit_ptr(VAL_TO_STR(s));
   }
   assert(!VAL_IS_IMM(s));
-  Val ref;
   if (IS_SLICE((String*)s)) {
-    ref = ((SSlice*)s)->ref;
-  } else {
-    ref = s;
+    SSlice* slice = (SSlice*)s;
+    return ((String*)slice->ref)->str + slice->offset;
   }
-  return ((String*)ref)->str;
+  return ((String*)s)->str;
+}
+
+const char* nb_string_bytes(Val s, char* buf) {
+  size_t size;
+  return _bytes(s, buf, &size);
 }
 
 Val nb_string_concat(Val s1, Val s2) {
-  size_t bytesize1 = nb_string_byte_size(s1);
-  size_t bytesize2 = nb_string_byte_size(s2);
+  char buf1[8], buf2[8];
+  size_t bytesize1, bytesize2;
+  const char* p1 = _bytes(s1, buf1, &bytesize1);
+  const char* p2 = _bytes(s2, buf2, &bytesize2);
+  if (bytesize1 + bytesize2 <= VAL_SSTR_MAX) {
+    char buf[8];
+    memcpy(buf, p1, bytesize1);
+    memcpy(buf + bytesize1, p2, bytesize2);
+    return _sstr_new(bytesize1 + bytesize2, buf);
+  }
   String* r = _alloc_string(bytesize1 + bytesize2);
-  memcpy(r->str, nb_string_ptr(s1), bytesize1);
-  memcpy(r->str + bytesize1, nb_string_ptr(s2), bytesize2);
+  memcpy(r->str, p1, bytesize1);
+  memcpy(r->str + bytesize1, p2, bytesize2);
   return (Val)r;
 }
 
 int nb_string_cmp(Val s1, Val s2) {
-  const char* p1 = nb_string_ptr(s1);
-  size_t l1 = nb_string_byte_size(s1);
-  const char* p2 = nb_string_ptr(s2);
-  size_t l2 = nb_string_byte_size(s2);
+  char buf1[8], buf2[8];
+  size_t l1, l2;
+  const char* p1 = _bytes(s1, buf1, &l1);
+  const char* p2 = _bytes(s2, buf2, &l2);
   int res = strncmp(p1, p2, l1 > l2 ? l2 : l1);
   if (res == 0) {
     return l1 < l2 ? 1 : l1 > l2 ? -1 : 0;
@@ -115,55 +135,47 @@ int nb_string_cmp(Val s1, Val s2) {
 }
 
 Val nb_string_slice(Val v, size_t from, size_t len) {
-  if (VAL_IS_STR(v)) {
-    return _slice_from_literal(v, from, len);
+  char buf[8];
+  size_t size;
+  const char* p = _bytes(v, buf, &size);
+  if (from > size) {
+    from = size;
+  }
+  if (len > size - from) {
+    len = size - from;
+  }
+  // short results and slices of literals are copied
+  if (len <= VAL_SSTR_MAX || VAL_IS_IMM(v)) {
+    return nb_string_new(len, p + from);
   }
 
-  String* h = (String*)v;
   SSlice* r = _alloc_s_slice();
-  if (IS_SLICE(h)) {
+  if (IS_SLICE((String*)v)) {
     SSlice* s = (SSlice*)v;
     r->ref = s->ref;
-    if (from > BYTE_SIZE(s)) {
-      // todo use static empty string
-      BYTE_SIZE(r) = 0;
-      r->offset = 0;
-    } else if (len > BYTE_SIZE(s) - from) {
-      BYTE_SIZE(r) = BYTE_SIZE(s) - from;
-      r->offset = s->offset + from;
-    } else {
-      BYTE_SIZE(r) = len;
-      r->offset = s->offset + from;
-    }
+    r->offset = s->offset + from;
   } else {
-    String* s = (String*)v;
     r->ref = v;
-    if (from > BYTE_SIZE(s)) {
-      // todo use static empty string
-      BYTE_SIZE(r) = 0;
-      r->offset = 0;
-    } else if (len > BYTE_SIZE(s) - from) {
-      BYTE_SIZE(r) = BYTE_SIZE(s) - from;
-      r->offset = from;
-    } else {
-      BYTE_SIZE(r) = len;
-      r->offset = from;
-    }
+    r->offset = from;
   }
+  BYTE_SIZE(r) = len;
   RETAIN(r->ref);
   return (Val)r;
 }
 
-static uint64_t _hash_func(Val v) {
-  return val_hash_mem(nb_string_ptr(v), nb_string_byte_size(v));
+uint64_t nb_string_hash(Val v) {
+  char buf[8];
+  size_t size;
+  const char* p = _bytes(v, buf, &size);
+  return val_hash_mem(p, size);
 }
 
-static bool _eq_func(Val l, Val r) {
+bool nb_string_eq(Val l, Val r) {
   if (VAL_KLASS(r) == KLASS_STRING) {
-    const char* lptr = nb_string_ptr(l);
-    size_t lsize = nb_string_byte_size(l);
-    const char* rptr = nb_string_ptr(r);
-    size_t rsize = nb_string_byte_size(r);
+    char lbuf[8], rbuf[8];
+    size_t lsize, rsize;
+    const char* lptr = _bytes(l, lbuf, &lsize);
+    const char* rptr = _bytes(r, rbuf, &rsize);
     return !str_compare(lsize, lptr, rsize, rptr);
   }
   return false;
@@ -177,20 +189,17 @@ static void _destructor(void* p) {
   }
 }
 
-static Val _slice_from_literal(Val v, size_t from, size_t len) {
-  uint32_t sid = VAL_TO_STR(v);
-  size_t lsize = val_strlit_byte_size(sid);
-  if (from >= lsize) {
-    return nb_string_new(0, NULL);
-  }
+static size_t _size_func(void* p) {
+  String* h = p;
+  return IS_SLICE(h) ? sizeof(SSlice) : sizeof(String) + BYTE_SIZE(h);
+}
 
-  const char* lptr = val_strlit_ptr(sid);
-  if (from + len > lsize) {
-    len = lsize - from;
+static void _trace_func(void* p, ValVisitFunc visit, void* ctx) {
+  String* h = p;
+  if (IS_SLICE(h)) {
+    SSlice* slice = p;
+    visit(&slice->ref, ctx);
   }
-  String* s = _alloc_string(len);
-  memcpy(s, lptr + from, len);
-  return (Val)s;
 }
 
 static String* _alloc_string(size_t bytesize) {
@@ -207,3 +216,24 @@ static SSlice* _alloc_s_slice() {
   // m->h.bytesize = 0;
   return m;
 }
+
+// NOTE little endian: the first byte of the string is in the second lowest byte of the value
+static Val _sstr_new(size_t size, const char* p) {
+  uint64_t bytes = 0;
+  if (size) {
+    memcpy(&bytes, p, size);
+  }
+  return (Val)(bytes << 8) | 0x8c | (size << 4);
+}
+
+// buf should hold 8 bytes, it is used when s is a short string
+static const char* _bytes(Val s, char* buf, size_t* size) {
+  if (VAL_IS_SSTR(s)) {
+    uint64_t bytes = s >> 8;
+    memcpy(buf, &bytes, 8);
+    *size = VAL_SSTR_SIZE(s);
+    return buf;
+  }
+  *size = nb_string_byte_size(s);
+  return nb_string_ptr(s);
+}
@@ -4,6 +4,7 @@
 
 void nb_string_init_module();
 
+// strings of up to VAL_SSTR_MAX bytes are packed into the value (see VAL_IS_SSTR)
 Val nb_string_new(size_t size, const char* p);
 
 // put into a permanent symbol table
@@ -15,16 +16,31 @@ Val nb_string_new_literal_c(const char* p) __attribute__((const));
 
 Val nb_string_new_f(const char* template, ...) __attribute__((format (printf, 1, 2)));
 
+// always allocated, so the bytes can be written through nb_string_ptr()
 Val nb_string_new_transient(size_t size);
 
 size_t nb_string_byte_size(Val s);
 
+// s should not be a short string, which has no bytes in memory (use nb_string_bytes instead),
+// mainly for writing bytes of a transient string
 const char* nb_string_ptr(Val s);
 
+// returns the bytes of any string, a short string is decoded into buf (of at least 8 bytes).
+// NOTE the bytes are not NUL-terminated
+const char* nb_string_bytes(Val s, char* buf);
+
+// nb_string_bytes with a buffer living until the end of the enclosing block
+#define NB_STRING_BYTES(s) nb_string_bytes((s), (char[8]){0})
+
 Val nb_string_concat(Val s1, Val s2);
 
 // returns 1, 0 or -1
 int nb_string_cmp(Val s1, Val s2);
 
+// also called directly by the val_hash / val_eq fast path
+uint64_t nb_string_hash(Val s);
+
+bool nb_string_eq(Val l, Val r);
+
 // todo negative index
 Val nb_string_slice(Val s, size_t from, size_t len);
@@ -20,6 +20,11 @@ void struct_suite() {
     };
     uint32_t klass = nb_struct_def(nb_string_new_literal_c("Foo"), 0, 3, fields);
     klass_def_method_v(klass, val_strlit_new_c("sum"), 2, 2, foo_sum, true);
+    NbStructField node_fields[] = {
+      {.matcher = VAL_UNDEF, .field_id = val_strlit_new_c("value")},
+      {.matcher = VAL_UNDEF, .field_id = val_strlit_new_c("next")}
+    };
+    nb_struct_def(nb_string_new_literal_c("Node"), 0, 2, node_fields);
     klass_prepared = true;
   }
 
@@ -79,4 +84,44 @@ void struct_suite() {
     RELEASE(st);
     val_end_check_memory();
   }
+
+  ccut_test("gens evacuate") {
+    int n = 100;
+    uint32_t klass_id = klass_find(nb_string_new_literal_c("Node"), 0);
+    int32_t gen = val_gens_new_gen();
+    val_gens_set_current(gen);
+
+    // node list ending with a string, the last node is also referenced by the head node
+    Val last = nb_struct_new(klass_id, 2, (Val[]){nb_string_new_c("tail of the list"), VAL_NIL});
+    RETAIN(last);
+    Val list = last;
+    for (int i = 0; i < n; i++) {
+      list = nb_struct_new(klass_id, 2, (Val[]){VAL_FROM_INT(i), list});
+    }
+    Val root = nb_struct_new(klass_id, 2, (Val[]){last, list});
+    Val garbage = nb_struct_new(klass_id, 2, (Val[]){nb_string_new_c("garbage"), VAL_NIL});
+    (void)garbage;
+
+    ValEvacuateStats stats;
+    Val res = val_gens_evacuate(root, gen - 1, &stats);
+    assert_neq(root, res);
+    assert_eq(n + 3, stats.copied_objects);
+    assert_true(stats.dropped_bytes > 0, "garbage should be dropped");
+
+    val_gens_set_current(gen - 1);
+    val_gens_drop();
+
+    Val shared = nb_struct_get(res, 0);
+    list = nb_struct_get(res, 1);
+    for (int i = n - 1; i >= 0; i--) {
+      assert_eq(VAL_FROM_INT(i), nb_struct_get(list, 0));
+      list = nb_struct_get(list, 1);
+    }
+    assert_eq(shared, list);
+    Val s = nb_struct_get(shared, 0);
+    assert_eq(16, nb_string_byte_size(s));
+    assert_mem_eq("tail of the list", NB_STRING_BYTES(s), 16);
+    assert_eq(VAL_NIL, nb_struct_get(shared, 1));
+    RELEASE(res);
+  }
 }
@@ -19,6 +19,21 @@ static void _struct_destruct(void* ptr) {
   }
 }
 
+static size_t _struct_size(void* ptr) {
+  Struct* st = ptr;
+  Klass* k = (Klass*)klass_val(st->h.klass);
+  return STRUCT_BYTE_SIZE(Fields.size(&k->fields));
+}
+
+static void _struct_trace(void* ptr, ValVisitFunc visit, void* ctx) {
+  Struct* st = ptr;
+  Klass* k = (Klass*)klass_val(st->h.klass);
+  int attr_size = Fields.size(&k->fields);
+  for (int i = 0; i < attr_size; i++) {
+    visit(&st->fields[i], ctx);
+  }
+}
+
 uint32_t nb_struct_def(Val name, uint32_t parent_id, uint32_t field_size, NbStructField* fields) {
   uint32_t klass_id = klass_def(name, parent_id);
   Klass* k = (Klass*)klass_val(klass_id);
@@ -26,6 +41,8 @@ uint32_t nb_struct_def(Val name, uint32_t parent_id, uint32_t field_size, NbStru
     Fields.push(&k->fields, fields[i]);
   }
   klass_set_destruct_func(klass_id, _struct_destruct);
+  klass_set_size_func(klass_id, _struct_size);
+  klass_set_trace_func(klass_id, _struct_trace);
   return klass_id;
 }
 
@@ -34,7 +51,7 @@ ValPair nb_struct_new_empty(uint32_t klass_id) {
   assert(k);
   int argc = Fields.size(&k->fields);
   Struct* s = val_alloc(klass_id, STRUCT_BYTE_SIZE(argc));
-  memset(s->fields, 0, STRUCT_BYTE_SIZE(argc));
+  memset(s->fields, 0, sizeof(Val) * argc);
   return (ValPair){(Val)s, (Val)argc};
 }
 
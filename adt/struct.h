@@ -7,7 +7,8 @@
 
 #include "val.h"
 
-void* nb_struct_def(uint32_t klass_id);
+// define struct klass with fields, returns klass_id
+uint32_t nb_struct_def(Val name, uint32_t parent_id, uint32_t field_size, NbStructField* fields);
 
 // create a new struct with the given klass id
 void nb_struct_def_fields(void* st, uint32_t field_size, NbStructField* fields);
@@ -1,5 +1,42 @@
 #include "sym-table.h"
 #include <ccut.h>
+#include <tinycthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define INTERN_THREADS 4
+#define INTERN_KEYS 2048
+
+typedef struct {
+  NbSymTable* table;
+  uint64_t ids[INTERN_KEYS];
+} InternArg;
+
+// read back an image into 8-byte aligned memory
+static void* _dump_to_mem(NbSymTable* table, size_t* size) {
+  FILE* f = tmpfile();
+  assert_true(nb_sym_table_dump(table, f), "should dump");
+  *size = ftell(f);
+  rewind(f);
+  void* image = malloc(*size);
+  assert_eq(1, fread(image, *size, 1, f));
+  fclose(f);
+  return image;
+}
+
+// every thread interns the same keys in a different order
+static int _intern_in_thread(void* p) {
+  InternArg* arg = p;
+  int step = (int)(arg->ids[0]) * 2 + 1; // odd step visits every key of the power of 2
+  for (int i = 0; i < INTERN_KEYS; i++) {
+    int key = (i * step) % INTERN_KEYS;
+    char buf[32];
+    int size = snprintf(buf, sizeof(buf), "key%d", key);
+    nb_sym_table_get_set(arg->table, size, buf, arg->ids + key);
+  }
+  return 0;
+}
 
 void sym_table_suite() {
   ccut_test("id incremental") {
@@ -46,4 +83,80 @@ void sym_table_suite() {
     nb_sym_table_delete(table);
     val_end_check_memory();
   }
+
+  ccut_test("dump and map image") {
+    NbSymTable* table = nb_sym_table_new();
+    nb_sym_table_get_set(table, strlen("hello"), "hello", NULL);
+    nb_sym_table_get_set(table, strlen("world!"), "world!", NULL);
+    size_t size;
+    void* image = _dump_to_mem(table, &size);
+    nb_sym_table_delete(table);
+    assert_eq(0, size % 8);
+
+    NbSymTable* mapped = nb_sym_table_new_mapped(image, size);
+    assert_true(mapped, "should map the image");
+    uint64_t id;
+    assert_true(nb_sym_table_get(mapped, strlen("world!"), "world!", &id), "should find in image");
+    assert_eq(1, id);
+    size_t sz;
+    char* ptr;
+    assert_true(nb_sym_table_reverse_get(mapped, &sz, &ptr, 0), "should reverse get from image");
+    assert_eq(5, sz);
+    assert_mem_eq("hello", ptr, 5);
+
+    // new strings are appended after the image
+    nb_sym_table_get_set(mapped, strlen("new"), "new", &id);
+    assert_eq(2, id);
+    nb_sym_table_get_set(mapped, strlen("hello"), "hello", &id);
+    assert_eq(0, id);
+    assert_eq(3, nb_sym_table_size(mapped));
+
+    // dump again includes both layers
+    size_t size2;
+    void* image2 = _dump_to_mem(mapped, &size2);
+    nb_sym_table_delete(mapped);
+    free(image);
+    NbSymTable* mapped2 = nb_sym_table_new_mapped(image2, size2);
+    assert_true(nb_sym_table_get(mapped2, strlen("new"), "new", &id), "should find in image");
+    assert_eq(2, id);
+    nb_sym_table_delete(mapped2);
+
+    // version mismatch and truncation are rejected
+    ((uint32_t*)image2)[2]++;
+    assert_false(nb_sym_table_new_mapped(image2, size2), "should reject another version");
+    ((uint32_t*)image2)[2]--;
+    assert_false(nb_sym_table_new_mapped(image2, size2 - 8), "should reject truncated image");
+    free(image2);
+  }
+
+  ccut_test("concurrent interning") {
+    NbSymTable* table = nb_sym_table_new();
+    InternArg args[INTERN_THREADS];
+    thrd_t threads[INTERN_THREADS];
+    for (int i = 0; i < INTERN_THREADS; i++) {
+      args[i].table = table;
+      args[i].ids[0] = i;
+      thrd_create(threads + i, _intern_in_thread, args + i);
+    }
+    for (int i = 0; i < INTERN_THREADS; i++) {
+      thrd_join(threads[i], NULL);
+    }
+
+    assert_eq(INTERN_KEYS, nb_sym_table_size(table));
+    for (int key = 0; key < INTERN_KEYS; key++) {
+      for (int i = 1; i < INTERN_THREADS; i++) {
+        if (args[i].ids[key] != args[0].ids[key]) {
+          assert_true(false, "should get the same id for key%d", key);
+        }
+      }
+      size_t size;
+      char* s;
+      char buf[32];
+      int expected_size = snprintf(buf, sizeof(buf), "key%d", key);
+      assert_true(nb_sym_table_reverse_get(table, &size, &s, args[0].ids[key]), "should reverse get key%d", key);
+      assert_eq(expected_size, size);
+      assert_mem_eq(buf, s, size);
+    }
+    nb_sym_table_delete(table);
+  }
 }
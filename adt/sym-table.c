@@ -1,95 +1,400 @@
 #include "sym-table.h"
-#include "utils/mut-array.h"
-#include "utils/mut-map.h"
+#include "utils/arena.h"
+#include "utils/hash.h"
+#include <stdatomic.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 
+// concurrent string <-> id table
+//
+// - strings are appended to per-stripe arenas and never move, so an id maps to a stable pointer.
+// - id -> entry is a segmented array: segment s holds (SEG_BASE << s) entries,
+//   segments are never reallocated, so reverse lookup is 2 atomic loads (wait-free).
+// - string -> id is an open addressing index of atomic cells, probed linearly without locks.
+//   a cell packs (tag: 32 high bits of hash, id + 1), 0 means empty.
+// - inserts lock a stripe chosen by hash, so the same string is never inserted twice,
+//   and claim a cell with CAS since other stripes insert into the same index.
+// - growing the index locks all stripes, copies the cells and publishes the new index.
+//   readers may still probe the old index, so old indexes are kept until the table is deleted.
+// - a table can be created on top of a mapped image (see nb_sym_table_dump()),
+//   the image is a read-only base layer holding ids below base_count, searched before the index.
+//
+// image layout (all 8-byte aligned, native endian):
+//   SymTableImage header
+//   uint64_t offsets[count]            // of entries in blob
+//   uint64_t cells[1 << index_bits]    // same encoding as index cells
+//   char blob[blob_size]               // Entry records, each padded to 8 bytes
+
+#define STRIPES 16
+#define SEG_BASE_BITS 6
+#define SEG_BASE (1ULL << SEG_BASE_BITS)
+#define SEGS (32 - SEG_BASE_BITS)
+#define INDEX_MIN_BITS 6
+
+#define IMAGE_MAGIC "NBSYMTAB"
+#define IMAGE_VERSION 1
+#define IMAGE_HASH_CHECK_KEY "nablang sym table"
+
 typedef struct {
-  size_t size;
-  char* data;
-} Str;
+  uint64_t hash;
+  uint64_t size;
+  char data[];
+} Entry;
+
+typedef _Atomic(Entry*) EntryRef;
+
+#define ENTRY_BYTES(ksize) ((sizeof(Entry) + (ksize) + 7) & ~7ULL)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t index_bits;
+  uint64_t count;
+  uint64_t hash_check; // hash of IMAGE_HASH_CHECK_KEY, the image is stale when the hash function changes
+  uint64_t blob_size;
+} SymTableImage;
+
+struct IndexStruct;
+typedef struct IndexStruct Index;
+struct IndexStruct {
+  Index* prev; // retired index, freed with the table
+  uint64_t mask;
+  _Atomic uint64_t cells[];
+};
 
-static uint64_t str_hash(Str s) {
-  return val_hash_mem(s.data, s.size);
+typedef struct {
+  _Alignas(64) atomic_flag lock;
+  Arena arena;
+} Stripe;
+
+struct NbSymTableStruct {
+  Stripe stripes[STRIPES];
+  _Atomic(Index*) index;
+  _Atomic uint64_t size;
+  _Atomic(EntryRef*) segs[SEGS]; // entries of id >= base_count
+
+  // read-only base layer from an image
+  uint64_t base_count;
+  uint64_t base_mask;
+  const uint64_t* base_offsets;
+  const uint64_t* base_cells;
+  const char* base_blob;
+  uint64_t base_blob_size;
+};
+
+// literal names come from source code and syntax definitions, not from parsed input
+static uint64_t str_hash(size_t size, const char* p) {
+  return fast_hash_mem(p, size);
 }
 
-static bool str_eq(Str s1, Str s2) {
-  return (s1.size == s2.size) && (0 == memcmp(s1.data, s2.data, s1.size));
+#define CELL(tag, id) (((uint64_t)(tag) << 32) | ((id) + 1))
+#define CELL_TAG(cell) ((uint32_t)((cell) >> 32))
+#define CELL_ID(cell) (((cell) & 0xFFFFFFFFULL) - 1)
+
+static Index* INDEX_NEW(uint64_t bits) {
+  Index* idx = calloc(1, sizeof(Index) + sizeof(_Atomic uint64_t) * (1ULL << bits));
+  assert(idx);
+  idx->mask = (1ULL << bits) - 1;
+  return idx;
 }
 
-MUT_MAP_DECL(MM, Str, uint64_t, str_hash, str_eq);
+static void SEG_POS(uint64_t id, uint64_t* seg, uint64_t* off) {
+  uint64_t n = id + SEG_BASE;
+  *seg = 63 - __builtin_clzll(n) - SEG_BASE_BITS;
+  *off = n - (SEG_BASE << *seg);
+}
 
-MUT_ARRAY_DECL(Strs, Str);
+static Entry* ENTRY_AT(NbSymTable* t, uint64_t id) {
+  if (id < t->base_count) {
+    // the image is not validated on load (to keep it O(1)), so check bounds on access
+    uint64_t offset = t->base_offsets[id];
+    if (offset % 8 || offset > t->base_blob_size - sizeof(Entry)) {
+      return NULL;
+    }
+    Entry* e = (Entry*)(t->base_blob + offset);
+    return e->size <= t->base_blob_size - offset - sizeof(Entry) ? e : NULL;
+  }
+  id -= t->base_count;
+  if (id >= (SEG_BASE << SEGS) - SEG_BASE) {
+    return NULL;
+  }
+  uint64_t seg, off;
+  SEG_POS(id, &seg, &off);
+  EntryRef* refs = atomic_load_explicit(&t->segs[seg], memory_order_acquire);
+  if (!refs) {
+    return NULL;
+  }
+  return atomic_load_explicit(&refs[off], memory_order_acquire);
+}
 
-// todo pool alloc MM slot to improve performance
+static void ENTRY_SET(NbSymTable* t, uint64_t id, Entry* e) {
+  uint64_t seg, off;
+  SEG_POS(id - t->base_count, &seg, &off);
+  EntryRef* refs = atomic_load_explicit(&t->segs[seg], memory_order_acquire);
+  if (!refs) {
+    // inserters of other stripes may race for the same segment
+    EntryRef* new_refs = calloc(SEG_BASE << seg, sizeof(EntryRef));
+    assert(new_refs);
+    if (atomic_compare_exchange_strong_explicit(&t->segs[seg], &refs, new_refs, memory_order_acq_rel, memory_order_acquire)) {
+      refs = new_refs;
+    } else {
+      free(new_refs);
+    }
+  }
+  atomic_store_explicit(&refs[off], e, memory_order_release);
+}
 
-// TODO raise error when too big
-#define INC(_int_v_) ((_int_v_) + 1)
+static bool INDEX_FIND(NbSymTable* t, Index* idx, uint64_t h, size_t ksize, const char* k, uint64_t* vid) {
+  uint32_t tag = (uint32_t)(h >> 32);
+  for (uint64_t i = h & idx->mask;; i = (i + 1) & idx->mask) {
+    uint64_t cell = atomic_load_explicit(&idx->cells[i], memory_order_acquire);
+    if (!cell) {
+      return false;
+    }
+    if (CELL_TAG(cell) == tag) {
+      Entry* e = ENTRY_AT(t, CELL_ID(cell));
+      if (e->size == ksize && 0 == memcmp(e->data, k, ksize)) {
+        *vid = CELL_ID(cell);
+        return true;
+      }
+    }
+  }
+}
 
-struct NbSymTableStruct {
-  // map of Str* -> int, in which keys are standalone on heap
-  struct MM mm;
+// the base layer is immutable, no atomics needed
+static bool BASE_FIND(NbSymTable* t, uint64_t h, size_t ksize, const char* k, uint64_t* vid) {
+  if (!t->base_cells) {
+    return false;
+  }
+  uint32_t tag = (uint32_t)(h >> 32);
+  // a damaged image may have no empty cell, so probe at most all cells
+  for (uint64_t i = h & t->base_mask, n = 0; n <= t->base_mask; i = (i + 1) & t->base_mask, n++) {
+    uint64_t cell = t->base_cells[i];
+    if (!cell) {
+      return false;
+    }
+    if (CELL_TAG(cell) == tag && CELL_ID(cell) < t->base_count) {
+      Entry* e = ENTRY_AT(t, CELL_ID(cell));
+      if (e && e->size == ksize && 0 == memcmp(e->data, k, ksize)) {
+        *vid = CELL_ID(cell);
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
-  // map of int -> Str*
-  // NOTE that we can't use that values for mm's key, because when strs are resized, the address may change
-  struct Strs strs;
-};
+static bool FIND(NbSymTable* t, uint64_t h, size_t ksize, const char* k, uint64_t* vid) {
+  return BASE_FIND(t, h, ksize, k, vid) ||
+    INDEX_FIND(t, atomic_load_explicit(&t->index, memory_order_acquire), h, ksize, k, vid);
+}
 
-// for insertion
-static Str STR_NEW(size_t size, const char* p) {
-  Str s = {
-    .size = size,
-    .data = malloc(size)
-  };
-  memcpy(s.data, p, size);
-  return s;
+// claim an empty cell, other stripes may be claiming too
+static void INDEX_PUT(Index* idx, uint64_t h, uint64_t cell) {
+  for (uint64_t i = h & idx->mask;; i = (i + 1) & idx->mask) {
+    uint64_t empty = 0;
+    if (atomic_compare_exchange_strong_explicit(&idx->cells[i], &empty, cell, memory_order_release, memory_order_relaxed)) {
+      return;
+    }
+  }
 }
 
-static void STR_DELETE(Str s) {
-  free(s.data);
+// yield after a while, the holder may be preempted when there are more threads than cores
+static void LOCK(Stripe* s) {
+  for (int spins = 0; atomic_flag_test_and_set_explicit(&s->lock, memory_order_acquire); spins++) {
+    if (spins >= 64) {
+      sched_yield();
+    }
+  }
 }
 
-// for searching
-inline static Str STR_OF(size_t size, const char* p) {
-  Str s = {
-    .size = size,
-    .data = (char*)p
-  };
-  return s;
+static void UNLOCK(Stripe* s) {
+  atomic_flag_clear_explicit(&s->lock, memory_order_release);
+}
+
+static void _grow(NbSymTable* t, Index* idx) {
+  for (int i = 0; i < STRIPES; i++) {
+    LOCK(t->stripes + i);
+  }
+
+  if (atomic_load_explicit(&t->index, memory_order_relaxed) == idx) {
+    uint64_t bits = __builtin_ctzll(idx->mask + 1) + 1;
+    Index* new_idx = INDEX_NEW(bits);
+    for (uint64_t i = 0; i <= idx->mask; i++) {
+      uint64_t cell = atomic_load_explicit(&idx->cells[i], memory_order_relaxed);
+      if (cell) {
+        INDEX_PUT(new_idx, ENTRY_AT(t, CELL_ID(cell))->hash, cell);
+      }
+    }
+    new_idx->prev = idx;
+    atomic_store_explicit(&t->index, new_idx, memory_order_release);
+  }
+
+  for (int i = STRIPES - 1; i >= 0; i--) {
+    UNLOCK(t->stripes + i);
+  }
+}
+
+static void PLAIN_PUT(uint64_t* cells, uint64_t mask, uint64_t h, uint64_t cell) {
+  uint64_t i = h & mask;
+  while (cells[i]) {
+    i = (i + 1) & mask;
+  }
+  cells[i] = cell;
 }
 
 NbSymTable* nb_sym_table_new() {
-  NbSymTable* t = malloc(sizeof(NbSymTable));
-  MM.init(&t->mm);
-  Strs.init(&t->strs, 8);
+  // stripes are cache line aligned
+  NbSymTable* t = aligned_alloc(_Alignof(NbSymTable), sizeof(NbSymTable));
+  assert(t);
+  memset(t, 0, sizeof(NbSymTable));
+  for (int i = 0; i < STRIPES; i++) {
+    atomic_flag_clear(&t->stripes[i].lock);
+    arena_init(&t->stripes[i].arena);
+  }
+  atomic_init(&t->index, INDEX_NEW(INDEX_MIN_BITS));
+  atomic_init(&t->size, 0);
   return t;
 }
 
+NbSymTable* nb_sym_table_new_mapped(const void* image, size_t image_size) {
+  const SymTableImage* header = image;
+  if (image_size < sizeof(SymTableImage) ||
+      memcmp(header->magic, IMAGE_MAGIC, 8) ||
+      header->version != IMAGE_VERSION ||
+      header->hash_check != str_hash(strlen(IMAGE_HASH_CHECK_KEY), IMAGE_HASH_CHECK_KEY) ||
+      header->index_bits > 32 ||
+      header->count >= (1ULL << header->index_bits) ||
+      header->blob_size < sizeof(Entry) * header->count ||
+      header->blob_size > image_size) {
+    return NULL;
+  }
+  uint64_t cap = 1ULL << header->index_bits;
+  if (image_size != sizeof(SymTableImage) + (header->count + cap) * sizeof(uint64_t) + header->blob_size) {
+    return NULL;
+  }
+  const uint64_t* offsets = (const uint64_t*)(header + 1);
+  const uint64_t* cells = offsets + header->count;
+  const char* blob = (const char*)(cells + cap);
+
+  NbSymTable* t = nb_sym_table_new();
+  t->base_count = header->count;
+  t->base_mask = cap - 1;
+  t->base_offsets = offsets;
+  t->base_cells = cells;
+  t->base_blob = blob;
+  t->base_blob_size = header->blob_size;
+  atomic_store(&t->size, header->count);
+  return t;
+}
+
+bool nb_sym_table_dump(NbSymTable* t, FILE* f) {
+  uint64_t count = nb_sym_table_size(t);
+  uint64_t bits = INDEX_MIN_BITS;
+  while ((1ULL << bits) < count * 2) {
+    bits++;
+  }
+  uint64_t cap = 1ULL << bits;
+  uint64_t* offsets = malloc(sizeof(uint64_t) * count);
+  uint64_t* cells = calloc(cap, sizeof(uint64_t));
+  uint64_t blob_size = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    Entry* e = ENTRY_AT(t, i);
+    if (!e) { // damaged base image
+      free(offsets);
+      free(cells);
+      return false;
+    }
+    offsets[i] = blob_size;
+    blob_size += ENTRY_BYTES(e->size);
+    PLAIN_PUT(cells, cap - 1, e->hash, CELL(e->hash >> 32, i));
+  }
+
+  SymTableImage header = {
+    .magic = IMAGE_MAGIC,
+    .version = IMAGE_VERSION,
+    .index_bits = (uint32_t)bits,
+    .count = count,
+    .hash_check = str_hash(strlen(IMAGE_HASH_CHECK_KEY), IMAGE_HASH_CHECK_KEY),
+    .blob_size = blob_size
+  };
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  ok = ok && fwrite(offsets, sizeof(uint64_t), count, f) == count;
+  ok = ok && fwrite(cells, sizeof(uint64_t), cap, f) == cap;
+  static const char padding[8] = {0};
+  for (uint64_t i = 0; ok && i < count; i++) {
+    Entry* e = ENTRY_AT(t, i);
+    size_t bytes = sizeof(Entry) + e->size;
+    ok = fwrite(e, bytes, 1, f) == 1 && fwrite(padding, ENTRY_BYTES(e->size) - bytes, 1, f) == (ENTRY_BYTES(e->size) > bytes);
+  }
+  free(offsets);
+  free(cells);
+  return ok;
+}
+
 void nb_sym_table_delete(NbSymTable* t) {
-  MM.cleanup(&t->mm);
-  for (size_t i = 0; i < Strs.size(&t->strs); i++) {
-    STR_DELETE(*Strs.at(&t->strs, i));
+  for (int i = 0; i < STRIPES; i++) {
+    arena_cleanup(&t->stripes[i].arena);
+  }
+  for (int i = 0; i < SEGS; i++) {
+    free(atomic_load(&t->segs[i]));
+  }
+  Index* idx = atomic_load(&t->index);
+  while (idx) {
+    Index* prev = idx->prev;
+    free(idx);
+    idx = prev;
   }
-  Strs.cleanup(&t->strs);
   free(t);
 }
 
 void nb_sym_table_get_set(NbSymTable* t, size_t ksize, const char* k, uint64_t* vid) {
-  if (nb_sym_table_get(t, ksize, k, vid)) {
+  uint64_t h = str_hash(ksize, k);
+  uint64_t id;
+  if (FIND(t, h, ksize, k, &id)) {
+    if (vid) {
+      *vid = id;
+    }
     return;
   }
 
+  Stripe* s = t->stripes + (h >> 60) % STRIPES;
+  LOCK(s);
+  for (;;) {
+    Index* idx = atomic_load_explicit(&t->index, memory_order_acquire);
+    if (INDEX_FIND(t, idx, h, ksize, k, &id)) {
+      break;
+    }
+
+    // load factor of 0.5, each stripe may add one more before the index grows, so it never fills up
+    if ((atomic_load_explicit(&t->size, memory_order_relaxed) - t->base_count + STRIPES) * 2 > idx->mask + 1) {
+      UNLOCK(s);
+      _grow(t, idx);
+      LOCK(s);
+      continue;
+    }
+
+    id = atomic_fetch_add_explicit(&t->size, 1, memory_order_relaxed);
+    assert(id < 0xFFFFFFFFULL);
+    Entry* e = arena_alloc(&s->arena, sizeof(Entry) + ksize);
+    e->hash = h;
+    e->size = ksize;
+    memcpy(e->data, k, ksize);
+    ENTRY_SET(t, id, e);
+    INDEX_PUT(idx, h, CELL(h >> 32, id));
+    break;
+  }
+  UNLOCK(s);
+
   if (vid) {
-    *vid = Strs.size(&t->strs);
+    *vid = id;
   }
-  Str s = STR_NEW(ksize, k);
-  MM.insert(&t->mm, s, Strs.size(&t->strs));
-  Strs.push(&t->strs, s);
 }
 
 bool nb_sym_table_get(NbSymTable* t, size_t ksize, const char* k, uint64_t* vid) {
   uint64_t v;
-  bool res = MM.find(&t->mm, STR_OF(ksize, k), &v);
+  bool res = FIND(t, str_hash(ksize, k), ksize, k, &v);
   if (vid && res) {
     *vid = v;
   }
@@ -97,10 +402,10 @@ bool nb_sym_table_get(NbSymTable* t, size_t ksize, const char* k, uint64_t* vid)
 }
 
 bool nb_sym_table_reverse_get(NbSymTable* t, size_t* ksize, char** k, uint64_t i) {
-  if (i < Strs.size(&t->strs)) {
-    Str* str = Strs.at(&t->strs, i);
-    *k = str->data;
-    *ksize = str->size;
+  Entry* e = ENTRY_AT(t, i);
+  if (e) {
+    *k = e->data;
+    *ksize = e->size;
     return true;
   } else {
     return false;
@@ -108,5 +413,5 @@ bool nb_sym_table_reverse_get(NbSymTable* t, size_t* ksize, char** k, uint64_t i
 }
 
 size_t nb_sym_table_size(NbSymTable* st) {
-  return Strs.size(&st->strs);
+  return atomic_load_explicit(&st->size, memory_order_relaxed);
 }
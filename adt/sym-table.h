@@ -2,14 +2,28 @@
 
 // mutable bi-directional table of string <-> id, for internal use only
 // id is incremental and start from 0
+// thread safe: lookups are lock-free, reverse lookups are wait-free, inserts lock a stripe of the table
+// strings are stored in arenas, pointers from reverse get are valid until the table is deleted
 
 #include "val.h"
+#include <stdio.h>
 
 struct NbSymTableStruct;
 typedef struct NbSymTableStruct NbSymTable;
 
 NbSymTable* nb_sym_table_new();
 
+// create a table on top of an image written by nb_sym_table_dump(), strings are not copied,
+// so image must be kept (mapped) until the table is deleted.
+// returns NULL if the header or size doesn't match (e.g. another version),
+// the rest is not scanned on load (so it is O(1)), but bounds checked on access.
+// ids in image are kept, new strings get ids after them.
+NbSymTable* nb_sym_table_new_mapped(const void* image, size_t image_size);
+
+// write all strings and ids as an image, image size is a multiple of 8.
+// not safe with concurrent inserts.
+bool nb_sym_table_dump(NbSymTable* st, FILE* f);
+
 void nb_sym_table_delete(NbSymTable* st);
 
 // if k not in table, insert and return a new table
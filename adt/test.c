@@ -7,6 +7,7 @@
 void gens_suite();
 void val_suite();
 void box_suite();
+void double_suite();
 void map_cola_suite();
 void map_node_suite();
 void map_suite();
@@ -92,6 +93,49 @@ void mut_array_suite() {
     assert_eq(2, Points.at(&a, 1)[0].y);
     assert_eq(1, Points.at(&a, 2)[0].y);
   }
+
+  ccut_test("caller buffer and bulk ops") {
+    MyPoint buf[4];
+    MyPoint ps[10];
+    for (int i = 0; i < 10; i++) {
+      ps[i] = (MyPoint){i, -i};
+    }
+
+    struct Points a;
+    Points.init_buf(&a, buf, 4);
+    Points.extend(&a, ps, 3);
+    Points.push(&a, ps[3]);
+    assert_true(a.data == buf, "should stay in the buffer");
+    assert_eq(4, Points.size(&a));
+
+    // moves to heap
+    Points.extend(&a, ps + 4, 6);
+    assert_true(a.data != buf, "should move out of the buffer");
+    assert_eq(10, Points.size(&a));
+    int mismatch = -1;
+    for (int i = 0; i < 10; i++) {
+      if (Points.at(&a, i)->x != i || Points.at(&a, i)->y != -i) {
+        mismatch = i;
+      }
+    }
+    assert_eq(-1, mismatch);
+
+    Points.truncate(&a, 2);
+    assert_eq(2, Points.size(&a));
+    assert_eq(1, Points.top(&a)->x);
+    Points.reserve(&a, 100);
+    assert_eq(100, a.cap);
+    assert_eq(1, Points.top(&a)->x);
+    Points.cleanup(&a);
+
+    // reserve also moves out of the buffer
+    Points.init_buf(&a, buf, 4);
+    Points.push(&a, ps[7]);
+    Points.reserve(&a, 5);
+    assert_true(a.data != buf, "should move out of the buffer");
+    assert_eq(7, Points.at(&a, 0)->x);
+    Points.cleanup(&a);
+  }
 }
 
 #pragma mark ### test utils/mut-map.h
@@ -103,6 +147,7 @@ static uint64_t mm_hash(uint64_t k) {
   return (k >> 2);
 }
 MUT_MAP_DECL(MM, uint64_t, uint64_t, mm_hash, mm_eq);
+MUT_MAP_DECL_INCREMENTAL(IMM, uint64_t, uint64_t, mm_hash, mm_eq);
 
 void mut_map_suite() {
   ccut_test("insert different hash") {
@@ -194,6 +239,141 @@ void mut_map_suite() {
     }
     MM.cleanup(&mm);
   }
+
+  ccut_test("incremental rehash") {
+    struct IMM mm;
+    IMM.init(&mm);
+    uint64_t v;
+    int i = 0;
+    for (; !mm.old_slots; i++) {
+      IMM.insert(&mm, i, i);
+    }
+    // the map is resizing, keys are in both old and new slots
+    IMM.insert(&mm, 0, 100);
+    IMM.remove(&mm, 1);
+    assert_true(mm.old_slots != NULL, "should still be resizing");
+    assert_eq(i - 1, IMM.size(&mm));
+
+    size_t iterated = 0;
+    IMMIter it;
+    for (IMM.iter_init(&it, &mm); !IMM.iter_is_end(&it); IMM.iter_next(&it)) {
+      iterated++;
+    }
+    assert_eq(i - 1, iterated);
+
+    for (int j = 0; j < i; j++) {
+      assert_eq(j != 1, IMM.find(&mm, j, &v));
+    }
+    assert_true(IMM.find(&mm, 0, &v), "should find key0");
+    assert_eq(100, v);
+
+    // inserting more completes the resize
+    for (; i < 1000; i++) {
+      IMM.insert(&mm, i, i);
+    }
+    assert_eq(999, IMM.size(&mm));
+    for (int j = 2; j < 1000; j++) {
+      if (!IMM.find(&mm, j, &v) || v != (uint64_t)j) {
+        assert_true(false, "should find j=%d", j);
+      }
+    }
+    IMM.cleanup(&mm);
+  }
+}
+
+#pragma mark ### test utils/swiss-map.h
+
+#include "utils/swiss-map.h"
+// bad hash: many keys share home positions and h2
+SWISS_MAP_DECL(SM, uint64_t, uint64_t, mm_hash, mm_eq);
+
+void swiss_map_suite() {
+  ccut_test("swiss map insert / find / remove") {
+    struct SM sm;
+    SM.init(&sm);
+    SM.insert(&sm, 1 << 2, 1);
+    SM.insert(&sm, 2 << 2, 2);
+    SM.insert(&sm, 2 << 2, 3);
+    assert_eq(2, SM.size(&sm));
+
+    uint64_t v;
+    assert_true(SM.find(&sm, 1 << 2, &v), "should find key1");
+    assert_eq(1, v);
+    assert_true(SM.find(&sm, 2 << 2, &v), "should find key2");
+    assert_eq(3, v);
+
+    SM.remove(&sm, 1 << 2);
+    SM.remove(&sm, 1 << 2);
+    assert_eq(1, SM.size(&sm));
+    assert_false(SM.find(&sm, 1 << 2, &v), "should not find removed key1");
+    SM.cleanup(&sm);
+  }
+
+  ccut_test("swiss map collisions and removal without tombstones") {
+    struct SM sm;
+    SM.init(&sm);
+    // keys 0..3 share home 0, and wrap around the end with keys of the last home
+    for (uint64_t k = 0; k < 4; k++) {
+      SM.insert(&sm, k, k);
+      SM.insert(&sm, (15 << 2) + k, k);
+    }
+    SM.remove(&sm, 15 << 2);
+    SM.remove(&sm, 1);
+    uint64_t v;
+    for (uint64_t k = 0; k < 4; k++) {
+      assert_eq(k != 1, SM.find(&sm, k, &v));
+      assert_eq(k != 0, SM.find(&sm, (15 << 2) + k, &v));
+    }
+    // emptied slots are reused, the map doesn't grow
+    for (int i = 0; i < 1000; i++) {
+      SM.insert(&sm, 1, i);
+      SM.remove(&sm, 1);
+    }
+    assert_eq(6, SM.size(&sm));
+    assert_eq(SWISS_MAP_MIN_BITS, sm.bits);
+    SM.cleanup(&sm);
+  }
+
+  ccut_test("swiss map against a reference") {
+    struct SM sm;
+    SM.init(&sm);
+    enum { N = 512 };
+    uint64_t ref[N];
+    bool present[N] = {false};
+    uint64_t seed = 7;
+    for (int op = 0; op < 20000; op++) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      int k = (seed >> 33) % N;
+      if ((seed >> 20) & 1) {
+        SM.insert(&sm, k, op);
+        ref[k] = op;
+        present[k] = true;
+      } else {
+        SM.remove(&sm, k);
+        present[k] = false;
+      }
+    }
+    size_t size = 0;
+    for (int k = 0; k < N; k++) {
+      uint64_t v;
+      bool found = SM.find(&sm, k, &v);
+      assert_eq(present[k], found);
+      if (found) {
+        assert_eq(ref[k], v);
+        size++;
+      }
+    }
+    assert_eq(size, SM.size(&sm));
+
+    size_t iterated = 0;
+    SMIter it;
+    for (SM.iter_init(&it, &sm); !SM.iter_is_end(&it); SM.iter_next(&it)) {
+      assert_true(present[it.slot->k], "should iterate present key %lu", it.slot->k);
+      iterated++;
+    }
+    assert_eq(size, iterated);
+    SM.cleanup(&sm);
+  }
 }
 
 #pragma mark ### test utils/pool.h
@@ -213,6 +393,180 @@ void pool_suite() {
   }
 }
 
+#pragma mark ### test utils/slab.h
+
+#include "utils/slab.h"
+void slab_suite() {
+  ccut_test("slab size classes") {
+    Slab slab;
+    slab_init(&slab);
+    void* p1 = slab_alloc(&slab, 10);
+    void* p2 = slab_alloc(&slab, 270);
+    assert_true(slab_contains(p1), "should be allocated in slab");
+    assert_true(slab_contains(p2), "should be allocated in slab");
+    assert_eq(16, slab_slot_bytes(p1));
+    assert_eq(288, slab_slot_bytes(p2));
+    assert_eq(NULL, slab_alloc(&slab, SLAB_MAX_BYTES + 1));
+    slab_free(&slab, p1);
+    slab_free(&slab, p2);
+    slab_cleanup(&slab);
+  }
+
+  ccut_test("slab reuses freed slots") {
+    Slab slab;
+    slab_init(&slab);
+    void* p1 = slab_alloc(&slab, 24);
+    slab_free(&slab, p1);
+    void* p2 = slab_alloc(&slab, 24);
+    assert_eq(p1, p2);
+    slab_free(&slab, p2);
+    slab_cleanup(&slab);
+  }
+
+  ccut_test("slab recycles empty pages") {
+    Slab slab;
+    slab_init(&slab);
+    int n = SLAB_PAGE_BYTES / 32 * 3;
+    void** ps = malloc(sizeof(void*) * n);
+    for (int i = 0; i < n; i++) {
+      ps[i] = slab_alloc(&slab, 32);
+      memset(ps[i], 0xff, 32);
+    }
+    for (int i = 0; i < n; i++) {
+      slab_free(&slab, ps[i]);
+    }
+    // all slots are in magazine or page free list
+    assert_true(slab.empty_size > 0, "should have recycled pages");
+
+    // recycled pages can serve other size classes
+    void* p = slab_alloc(&slab, 512);
+    assert_true(slab_contains(p), "should be allocated in slab");
+    slab_free(&slab, p);
+    free(ps);
+    slab_cleanup(&slab);
+  }
+
+  ccut_test("slab remote free") {
+    Slab slab1, slab2;
+    slab_init(&slab1);
+    slab_init(&slab2);
+    void* p = slab_alloc(&slab1, 48);
+    slab_free(&slab2, p);
+    assert_eq(p, atomic_load(&slab1.remote));
+    slab_cleanup(&slab2);
+    slab_cleanup(&slab1);
+  }
+
+  ccut_test("slab slots are 16-byte aligned") {
+    Slab slab;
+    slab_init(&slab);
+    for (size_t size = 1; size <= SLAB_MAX_BYTES; size++) {
+      void* p = slab_alloc(&slab, size);
+      assert_eq(0, (uintptr_t)p % 16);
+      assert_true(slab_slot_bytes(p) >= size, "slot of %zu bytes too small", size);
+      slab_free(&slab, p);
+    }
+    slab_cleanup(&slab);
+  }
+
+  ccut_test("slab cleanup hands over live pages") {
+    Slab slab1, slab2;
+    slab_init(&slab1);
+    slab_init(&slab2);
+    void* p = slab_alloc(&slab1, 48);
+    void* r = slab_alloc(&slab1, 48);
+    slab_cleanup(&slab1);
+    memset(p, 0xff, 48);
+
+    // freed to the orphan page
+    slab_free(&slab2, r);
+    assert_eq(r, atomic_load(&slab_orphans.remote));
+
+    // the orphan page is adopted
+    void* q = slab_alloc(&slab2, 48);
+    assert_true(SLAB_PAGE_OF(p) == SLAB_PAGE_OF(q), "should adopt the orphan page");
+    assert_eq(NULL, atomic_load(&slab_orphans.remote));
+    slab_free(&slab2, p);
+    slab_free(&slab2, q);
+    slab_cleanup(&slab2);
+  }
+}
+
+#pragma mark ### test utils/rc-table.h
+
+#include "utils/rc-table.h"
+void rc_table_suite() {
+  ccut_test("rc table set / add / get") {
+    RcTable t;
+    rc_table_init(&t);
+    assert_eq(-1, rc_table_get(&t, 0x1000));
+    assert_eq(-1, rc_table_add(&t, 0x1000, 1));
+    rc_table_set(&t, 0x1000, 4096);
+    assert_eq(4097, rc_table_add(&t, 0x1000, 1));
+    assert_eq(4096, rc_table_add(&t, 0x1000, -1));
+    assert_eq(4096, rc_table_get(&t, 0x1000));
+    rc_table_cleanup(&t);
+  }
+
+  ccut_test("rc table grow and remove") {
+    RcTable t;
+    rc_table_init(&t);
+    for (uintptr_t i = 1; i <= 3000; i++) {
+      rc_table_set(&t, i * 16, i);
+    }
+    for (uintptr_t i = 1; i <= 3000; i += 2) {
+      assert_true(rc_table_remove(&t, i * 16), "should remove %lu", i);
+    }
+    assert_true(!rc_table_remove(&t, 16), "should be removed");
+    for (uintptr_t i = 1; i <= 3000; i++) {
+      int64_t expected = (i % 2) ? -1 : (int64_t)i;
+      assert_true(expected == rc_table_get(&t, i * 16), "expected %ld for %lu", expected, i);
+    }
+    rc_table_cleanup(&t);
+  }
+}
+
+#pragma mark ### test utils/hash.h
+
+#include "utils/hash.h"
+void hash_suite() {
+  ccut_test("fast hash mem") {
+    char buf[64];
+    for (int i = 0; i < 64; i++) {
+      buf[i] = 'a' + i % 26;
+    }
+    // every prefix hashes differently, and is stable
+    uint64_t hashes[65];
+    for (int size = 0; size <= 64; size++) {
+      hashes[size] = fast_hash_mem(buf, size);
+      assert_eq(hashes[size], fast_hash_mem(buf, size));
+      for (int j = 0; j < size; j++) {
+        assert_true(hashes[j] != hashes[size], "prefix %d and %d collide", j, size);
+      }
+    }
+
+    // each byte changes the hash
+    for (int size = 1; size <= 40; size++) {
+      for (int i = 0; i < size; i++) {
+        buf[i] ^= 1;
+        assert_true(fast_hash_mem(buf, size) != hashes[size], "byte %d of %d is ignored", i, size);
+        buf[i] ^= 1;
+      }
+    }
+  }
+
+  ccut_test("fast hash u64 spreads low bits") {
+    // sequential ids and aligned pointers fill masked buckets evenly
+    int buckets[256] = {0};
+    for (uint64_t i = 0; i < 256 * 64; i++) {
+      buckets[fast_hash_u64(i * 8) & 255]++;
+    }
+    for (int i = 0; i < 256; i++) {
+      assert_true(buckets[i] > 32 && buckets[i] < 96, "bucket %d has %d", i, buckets[i]);
+    }
+  }
+}
+
 #pragma mark ### test utils/utf-8.h
 
 void utf_8_suite() {
@@ -286,8 +640,132 @@ void arena_suite() {
     void* p1 = arena_slot_alloc(a, 2);
     void* p2 = arena_slot_alloc(a, 1);
     assert_eq(2 * sizeof(void*), (uintptr_t)p2 - (uintptr_t)p1);
+    void* p3 = arena_alloc(a, 3);
+    void* p4 = arena_alloc(a, 8);
+    assert_eq(8, (uintptr_t)p4 - (uintptr_t)p3);
     arena_delete(a);
   }
+
+  ccut_test("arena aligned alloc") {
+    Arena* a = arena_new();
+    arena_alloc(a, 8);
+    for (int align = 8; align <= 4096; align *= 2) {
+      char* p = arena_alloc_aligned(a, 40, align);
+      assert_eq(0, (uintptr_t)p % align);
+      memset(p, 1, 40);
+    }
+    arena_delete(a);
+  }
+
+  ccut_test("arena large objects and growing chunks") {
+    Arena* a = arena_new();
+    char* big = arena_alloc(a, 16 * 1024);
+    memset(big, 1, 16 * 1024);
+    assert_true(a->large != NULL, "should be in large list");
+    char* aligned_big = arena_alloc_aligned(a, 5000, 256);
+    assert_eq(0, (uintptr_t)aligned_big % 256);
+    memset(aligned_big, 1, 5000);
+
+    for (int i = 0; i < 1000; i++) {
+      char* p = arena_alloc(a, 1000);
+      memset(p, 2, 1000);
+    }
+    assert_eq(ARENA_CHUNK_MAX_BYTES, a->head->cap);
+    arena_delete(a);
+  }
+
+  ccut_test("arena reserved region") {
+    Arena a;
+    arena_init_region(&a, 8 * 1024 * 1024, true);
+    assert_true(a.region != NULL, "should map region");
+    char* begin = (char*)a.region;
+    char* end = begin + a.region_reserved_bytes;
+    assert_eq(ARENA_REGION_COMMIT_BYTES, a.region_committed_bytes);
+
+    // small and large objects are contiguous in the region, committed on demand
+    for (int i = 0; i < 3000; i++) {
+      char* p = arena_alloc(&a, i % 2 ? 1000 : 2000);
+      assert_true(begin < p && p < end, "should be in region");
+      memset(p, 1, i % 2 ? 1000 : 2000);
+    }
+    assert_true(a.region_committed_bytes > ARENA_REGION_COMMIT_BYTES, "should commit more");
+    assert_eq(NULL, a.large);
+
+    // a large object not fitting the rest of region goes to the large list
+    char* big = arena_alloc(&a, 8 * 1024 * 1024);
+    memset(big, 1, 8 * 1024 * 1024);
+    assert_true(big < begin || big >= end, "should not be in region");
+    assert_true(a.large != NULL, "should be in large list");
+
+    // exhaust the region, then it falls back to chunks
+    char* small;
+    do {
+      small = arena_alloc(&a, 1000);
+    } while (begin < small && small < end);
+    assert_true(a.head != a.region, "should use chunks");
+    assert_eq(a.region_reserved_bytes, a.region_committed_bytes);
+    arena_cleanup(&a);
+    assert_eq(NULL, a.region);
+  }
+
+  ccut_test("arena free lists") {
+    Arena* a = arena_new();
+    void* p = arena_alloc(a, 40);
+    void* q = arena_alloc(a, 3000);
+    arena_free(a, p, 40);
+    arena_free(a, q, 3000);
+    assert_eq(3040, a->reclaimed_bytes);
+    assert_eq(3040, a->free_bytes);
+
+    assert_true(arena_alloc(a, 48) != p, "should not reuse different size");
+    assert_eq(p, arena_alloc(a, 36)); // same size after rounding
+    assert_true(arena_alloc(a, 4000) != q, "bucket of q may have smaller objects");
+    assert_eq(q, arena_alloc(a, 2048));
+    assert_eq(0, a->free_bytes);
+
+    // aligned alloc doesn't use free lists
+    p = arena_alloc(a, 64);
+    arena_free(a, p, 64);
+    char* r = arena_alloc_aligned(a, 64, 64);
+    assert_eq(0, (uintptr_t)r % 64);
+    assert_eq(p, arena_alloc(a, 64));
+
+    int x;
+    assert_true(arena_contains(a, p, 0), "should contain chunk object");
+    assert_true(arena_contains(a, q, 0), "should contain large object");
+    assert_false(arena_contains(a, &x, 0), "should not contain stack memory");
+    arena_delete(a);
+  }
+
+  ccut_test("arena chunk cache") {
+    ArenaChunkCache cache;
+    arena_chunk_cache_init(&cache, ARENA_CHUNK_BYTES * 3);
+    Arena a;
+    arena_init_cached(&a, &cache);
+    for (int i = 0; i < 5; i++) {
+      arena_alloc(&a, 1000); // 2 per chunk, chunks of 2K 4K ...
+    }
+    assert_eq(0, cache.hits);
+    assert_eq(2, cache.misses);
+    arena_cleanup(&a);
+    assert_eq(ARENA_CHUNK_BYTES * 3, cache.retained_bytes);
+
+    arena_init_cached(&a, &cache);
+    for (int i = 0; i < 5; i++) {
+      arena_alloc(&a, 1000);
+    }
+    assert_eq(2, cache.hits);
+    assert_eq(0, cache.retained_bytes);
+
+    // request not fitting any cached class bypasses the cache on free
+    arena_alloc_aligned(&a, 1000, 1024);
+    arena_cleanup(&a);
+    assert_true(cache.retained_bytes <= ARENA_CHUNK_BYTES * 3, "should not exceed limit");
+
+    arena_chunk_cache_trim(&cache, 0);
+    assert_eq(0, cache.retained_bytes);
+    arena_chunk_cache_cleanup(&cache);
+  }
 }
 
 #pragma mark ### test utils/dual_stack.h
@@ -369,9 +847,14 @@ int main (int argc, char const *argv[]) {
   ccut_run_suite(base_suite);
   ccut_run_suite(gens_suite);
   ccut_run_suite(box_suite);
+  ccut_run_suite(double_suite);
   ccut_run_suite(mut_array_suite);
   ccut_run_suite(mut_map_suite);
+  ccut_run_suite(swiss_map_suite);
   ccut_run_suite(pool_suite);
+  ccut_run_suite(slab_suite);
+  ccut_run_suite(rc_table_suite);
+  ccut_run_suite(hash_suite);
   ccut_run_suite(utf_8_suite);
   ccut_run_suite(arena_suite);
   ccut_run_suite(dual_stack_suite);
@@ -10,7 +10,7 @@ typedef struct {
 
 #define QWORDS_TOKEN ((sizeof(Token) + 7) / 8)
 
-static bool _token_eq(Val l, Val r) {
+bool nb_token_eq(Val l, Val r) {
   if (VAL_KLASS(r) != KLASS_TOKEN) {
     return false;
   }
@@ -21,7 +21,7 @@ static bool _token_eq(Val l, Val r) {
          str_compare(tl->loc.size, tl->loc.s, tr->loc.size, tr->loc.s) == 0;
 }
 
-static uint64_t _token_hash(Val vt) {
+uint64_t nb_token_hash(Val vt) {
   Token* t = (Token*)vt;
   uint64_t h = val_hash(t->name) ^ KLASS_TOKEN_SALT;
   if (t->loc.size) {
@@ -36,11 +36,22 @@ static void _token_destruct(void* ptr) {
   RELEASE(t->loc.v);
 }
 
+static size_t _token_size(void* p) {
+  return sizeof(Token);
+}
+
+static void _token_trace(void* p, ValVisitFunc visit, void* ctx) {
+  Token* t = p;
+  visit(&t->loc.v, ctx);
+}
+
 void nb_token_init_module() {
   klass_def_internal(KLASS_TOKEN, val_strlit_new_c("Token"));
   klass_set_destruct_func(KLASS_TOKEN, _token_destruct);
-  klass_set_eq_func(KLASS_TOKEN, _token_eq);
-  klass_set_hash_func(KLASS_TOKEN, _token_hash);
+  klass_set_eq_func(KLASS_TOKEN, nb_token_eq);
+  klass_set_hash_func(KLASS_TOKEN, nb_token_hash);
+  klass_set_size_func(KLASS_TOKEN, _token_size);
+  klass_set_trace_func(KLASS_TOKEN, _token_trace);
 }
 
 Val nb_token_new(Val name, NbTokenLoc loc) {
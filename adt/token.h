@@ -17,3 +17,8 @@ Val nb_token_new_c(Val name, const char* content, Val v);
 NbTokenLoc* nb_token_loc(Val tok);
 
 Val nb_token_to_s(Val tok);
+
+// also called directly by the val_hash / val_eq fast path
+uint64_t nb_token_hash(Val tok);
+
+bool nb_token_eq(Val l, Val r);
@@ -0,0 +1,144 @@
+#include "utils/mut-array.h"
+#include "utils/mut-map.h"
+#include "utils/swiss-map.h"
+#include "utils/hash.h"
+#include "utils/bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// chained (utils/mut-map.h) vs open addressing (utils/swiss-map.h) with the same keys and hash
+
+#define MAP_SIZE 100000
+#define MAP_FIND_ROUNDS 10
+
+static uint64_t _key_hash(uint64_t k) {
+  return fast_hash_u64(k);
+}
+
+static bool _key_eq(uint64_t k1, uint64_t k2) {
+  return k1 == k2;
+}
+
+MUT_MAP_DECL(ChainedMap, uint64_t, uint64_t, _key_hash, _key_eq);
+MUT_MAP_DECL_INCREMENTAL(IncrementalMap, uint64_t, uint64_t, _key_hash, _key_eq);
+SWISS_MAP_DECL(SwissMap, uint64_t, uint64_t, _key_hash, _key_eq);
+
+// keys are spread like pointers
+#define KEY(i) ((uint64_t)(i) * 48 + 0x7f0000000000ULL)
+
+static volatile uint64_t sink;
+
+#define MAP_BENCH(Map, label) do {\
+  struct Map m;\
+  Map.init(&m);\
+  bench_run(label " insert", MAP_SIZE) {\
+    for (int i = 0; i < MAP_SIZE; i++) {\
+      Map.insert(&m, KEY(i), i);\
+    }\
+  }\
+  bench_run(label " find (hit)", MAP_SIZE * MAP_FIND_ROUNDS) {\
+    uint64_t sum = 0, v;\
+    for (int r = 0; r < MAP_FIND_ROUNDS; r++) {\
+      for (int i = 0; i < MAP_SIZE; i++) {\
+        if (Map.find(&m, KEY(i), &v)) {\
+          sum += v;\
+        }\
+      }\
+    }\
+    sink = sum;\
+  }\
+  bench_run(label " find (miss)", MAP_SIZE * MAP_FIND_ROUNDS) {\
+    uint64_t sum = 0, v;\
+    for (int r = 0; r < MAP_FIND_ROUNDS; r++) {\
+      for (int i = 0; i < MAP_SIZE; i++) {\
+        sum += Map.find(&m, KEY(i) + 1, &v);\
+      }\
+    }\
+    sink = sum;\
+  }\
+  bench_run(label " iterate", MAP_SIZE) {\
+    uint64_t sum = 0;\
+    Map##Iter it;\
+    for (Map.iter_init(&it, &m); !Map.iter_is_end(&it); Map.iter_next(&it)) {\
+      sum += it.slot->v;\
+    }\
+    sink = sum;\
+  }\
+  bench_run(label " remove", MAP_SIZE) {\
+    for (int i = 0; i < MAP_SIZE; i++) {\
+      Map.remove(&m, KEY(i));\
+    }\
+  }\
+  Map.cleanup(&m);\
+} while (0)
+
+// the worst single insert is the one that resizes
+#define PAUSE_SIZE 2000000
+
+// glibc trims the heap freed by the previous cleanup on a later free,
+// that would be counted as the pause of the first resize otherwise
+#ifdef __GLIBC__
+#include <malloc.h>
+#define MAP_PAUSE_TRIM() malloc_trim(0)
+#else
+#define MAP_PAUSE_TRIM()
+#endif
+
+#define MAP_PAUSE_BENCH(Map, label) do {\
+  MAP_PAUSE_TRIM();\
+  struct Map m;\
+  Map.init(&m);\
+  uint64_t max_pause = 0;\
+  bench_run(label " insert 2M", PAUSE_SIZE) {\
+    for (int i = 0; i < PAUSE_SIZE; i++) {\
+      uint64_t t = bench_now_ns();\
+      Map.insert(&m, KEY(i), i);\
+      t = bench_now_ns() - t;\
+      if (t > max_pause) {\
+        max_pause = t;\
+      }\
+    }\
+  }\
+  printf("    max pause %.1f us\n", max_pause / 1000.0);\
+  Map.cleanup(&m);\
+} while (0)
+
+// a short-lived array per call, like the stacks of a VM entry (utils/mut-array.h)
+
+#define ARRAY_CALLS 10000000
+#define ARRAY_PUSHES 12
+
+MUT_ARRAY_DECL(BenchVals, uint64_t);
+
+static void _array_per_call(bool use_buf) {
+  bench_run(use_buf ? "MutArray per call (init_buf)" : "MutArray per call (init)", ARRAY_CALLS) {
+    for (int i = 0; i < ARRAY_CALLS; i++) {
+      uint64_t buf[16];
+      struct BenchVals a;
+      if (use_buf) {
+        BenchVals.init_buf(&a, buf, 16);
+      } else {
+        BenchVals.init(&a, 16);
+      }
+      for (int j = 0; j < ARRAY_PUSHES; j++) {
+        BenchVals.push(&a, i + j);
+      }
+      sink += *BenchVals.top(&a);
+      BenchVals.cleanup(&a);
+    }
+  }
+}
+
+void utils_bench() {
+  MAP_BENCH(ChainedMap, "MUT_MAP");
+  MAP_BENCH(IncrementalMap, "MUT_MAP_INCREMENTAL");
+  MAP_BENCH(SwissMap, "SWISS_MAP");
+
+  MAP_PAUSE_BENCH(ChainedMap, "MUT_MAP");
+  MAP_PAUSE_BENCH(IncrementalMap, "MUT_MAP_INCREMENTAL");
+  MAP_PAUSE_BENCH(SwissMap, "SWISS_MAP");
+
+  _array_per_call(false);
+  _array_per_call(true);
+}
@@ -3,76 +3,505 @@
 // memory arena for batch free objects
 // very similar to a pool, but without free list, so it can be var-lengthed.
 
+// - chunk capacity starts at ARENA_CHUNK_BYTES and doubles up to ARENA_CHUNK_MAX_BYTES,
+//   a chunk is never smaller than the request that triggered it
+// - objects larger than ARENA_LARGE_BYTES are malloc'ed individually and linked in a side list,
+//   so they don't waste the tail of a chunk
+
+// Usage example:
+//   Arena* a = arena_new();
+//   void* p = arena_alloc(a, 24);                 // 8-byte aligned
+//   void* q = arena_alloc_aligned(a, 100, 64);    // 64-byte aligned
+//   void* r = arena_alloc(a, 16 * 1024);          // large object
+//   arena_delete(a);                              // frees all of them
+//
+// With a chunk cache, chunks are recycled instead of going back to malloc:
+//   ArenaChunkCache cache;
+//   arena_chunk_cache_init(&cache, 4 * 1024 * 1024);
+//   Arena a;
+//   arena_init_cached(&a, &cache);
+//   ...
+//   arena_cleanup(&a); // chunks are retained by cache up to the limit
+//   arena_chunk_cache_cleanup(&cache);
+//
+// With a reserved region, one big virtual range is mmap'ed and committed lazily as the arena grows,
+// objects (including large ones) are allocated contiguously from it until it runs out, then chunks are used:
+//   Arena a;
+//   arena_init_region(&a, 256 * 1024 * 1024, true); // reserve 256MB, advise huge pages
+//   ...
+//   arena_cleanup(&a); // a single munmap for the region
+//
+// Objects released before the arena is cleaned up can be given back for reuse by later allocations:
+//   void* p = arena_alloc(a, 40);
+//   arena_free(a, p, 40);
+//   void* q = arena_alloc(a, 40); // q == p
+//   arena_contains(a, q, 0);      // true
+
+// Customization:
+// - ARENA_CHUNK_BYTES      capacity of the first chunk
+// - ARENA_CHUNK_MAX_BYTES  max capacity of a chunk serving small objects
+// - ARENA_LARGE_BYTES      objects above this size go to the large list
+// - ARENA_REGION_COMMIT_BYTES  granularity of committing a reserved region, also the alignment of it
+// - freed objects up to ARENA_LARGE_BYTES are kept in exact size free lists (8-byte steps),
+//   larger ones in power-of-2 buckets, where a bucket only serves requests not larger than its lower bound
+// NOTE a chunk cache is not thread safe, use one per thread
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef ARENA_CHUNK_BYTES
+#define ARENA_CHUNK_BYTES 2048
+#endif
+
+#ifndef ARENA_CHUNK_MAX_BYTES
+#define ARENA_CHUNK_MAX_BYTES (64 * 1024)
+#endif
+
+#ifndef ARENA_LARGE_BYTES
+#define ARENA_LARGE_BYTES 1024
+#endif
 
-#define ARENA_CHUNK_SIZE 253
+#ifndef ARENA_REGION_COMMIT_BYTES
+#define ARENA_REGION_COMMIT_BYTES (2 * 1024 * 1024)
+#endif
 
 struct ArenaChunkStruct;
 typedef struct ArenaChunkStruct ArenaChunk;
 struct ArenaChunkStruct {
   ArenaChunk* next;
-  uint64_t i;
-  uint64_t data[ARENA_CHUNK_SIZE];
+  uint64_t i;   // used bytes
+  uint64_t cap; // capacity in bytes
+  uint64_t data[];
 };
 
+struct ArenaLargeStruct;
+typedef struct ArenaLargeStruct ArenaLarge;
+struct ArenaLargeStruct {
+  ArenaLarge* next;
+  void* base; // pointer returned by malloc
+  uint64_t bytes;
+};
+
+#define ARENA_LARGE_DATA(l) ((char*)((l) + 1))
+
+// chunks of capacity ARENA_CHUNK_BYTES << i are kept in free[i]
+#define ARENA_CACHE_CLASSES 16
+
 typedef struct {
-  ArenaChunk* chunk;
-  uint64_t i;
-} ArenaStack;
+  ArenaChunk* free[ARENA_CACHE_CLASSES];
+  uint64_t retained_bytes;
+  uint64_t limit_bytes; // chunks exceeding the limit are freed
+  uint64_t hits;
+  uint64_t misses;
+} ArenaChunkCache;
+
+#define ARENA_FREE_SMALL_LISTS (ARENA_LARGE_BYTES / 8)
+#define ARENA_FREE_LARGE_LISTS 64
+
+struct ArenaFreeNodeStruct;
+typedef struct ArenaFreeNodeStruct ArenaFreeNode;
+struct ArenaFreeNodeStruct {
+  ArenaFreeNode* next;
+  uint64_t bytes; // only used in large buckets
+};
+
+typedef struct {
+  ArenaFreeNode* small[ARENA_FREE_SMALL_LISTS]; // small[i] holds objects of (i + 1) * 8 bytes
+  ArenaFreeNode* large[ARENA_FREE_LARGE_LISTS]; // large[i] holds objects of [2^i, 2^(i+1)) bytes
+} ArenaFreeLists;
 
 typedef struct {
   ArenaChunk* head;
-  ArenaChunk init_chunk; // inline first chunk
+  ArenaChunk* init_chunk; // allocated together with arena, not freed in cleanup
+  ArenaLarge* large;
+  uint64_t next_cap;
+  ArenaChunkCache* cache; // can be NULL
+
+  // reserved region, the chunk header is at the beginning and chunk->cap grows as more is committed
+  ArenaChunk* region;      // NULL if no region
+  void* region_base;       // pointer returned by mmap
+  uint64_t region_map_bytes;
+  uint64_t region_reserved_bytes; // from region
+  uint64_t region_committed_bytes;
+
+  ArenaFreeLists* free_lists; // allocated on first arena_free
+  uint64_t free_bytes;        // bytes currently in free lists
+  uint64_t reclaimed_bytes;   // total bytes given back by arena_free
 } Arena;
 
+#pragma mark ### chunk cache
+
+static void arena_chunk_cache_init(ArenaChunkCache* cache, uint64_t limit_bytes) {
+  memset(cache, 0, sizeof(ArenaChunkCache));
+  cache->limit_bytes = limit_bytes;
+}
+
+// -1 if the capacity is not cacheable
+static int _arena_cache_class(uint64_t cap) {
+  if (cap < ARENA_CHUNK_BYTES || cap % ARENA_CHUNK_BYTES) {
+    return -1;
+  }
+  uint64_t n = cap / ARENA_CHUNK_BYTES;
+  if (n & (n - 1)) {
+    return -1;
+  }
+  int klass = __builtin_ctzll(n);
+  return klass < ARENA_CACHE_CLASSES ? klass : -1;
+}
+
+// free retained chunks until retained_bytes <= keep_bytes, larger chunks go first
+static void arena_chunk_cache_trim(ArenaChunkCache* cache, uint64_t keep_bytes) {
+  for (int i = ARENA_CACHE_CLASSES - 1; i >= 0 && cache->retained_bytes > keep_bytes; i--) {
+    while (cache->free[i] && cache->retained_bytes > keep_bytes) {
+      ArenaChunk* chunk = cache->free[i];
+      cache->free[i] = chunk->next;
+      cache->retained_bytes -= chunk->cap;
+      free(chunk);
+    }
+  }
+}
+
+static void arena_chunk_cache_cleanup(ArenaChunkCache* cache) {
+  arena_chunk_cache_trim(cache, 0);
+}
+
+static ArenaChunk* _arena_chunk_malloc(ArenaChunkCache* cache, uint64_t cap) {
+  if (cache) {
+    int klass = _arena_cache_class(cap);
+    if (klass >= 0 && cache->free[klass]) {
+      ArenaChunk* chunk = cache->free[klass];
+      cache->free[klass] = chunk->next;
+      cache->retained_bytes -= cap;
+      cache->hits++;
+      return chunk;
+    }
+    cache->misses++;
+  }
+  return malloc(sizeof(ArenaChunk) + cap);
+}
+
+static void _arena_chunk_free(ArenaChunkCache* cache, ArenaChunk* chunk) {
+  if (cache) {
+    int klass = _arena_cache_class(chunk->cap);
+    if (klass >= 0 && cache->retained_bytes + chunk->cap <= cache->limit_bytes) {
+      chunk->next = cache->free[klass];
+      cache->free[klass] = chunk;
+      cache->retained_bytes += chunk->cap;
+      return;
+    }
+  }
+  free(chunk);
+}
+
+#pragma mark ### arena
+
 static void arena_init(Arena* arena) {
-  ArenaChunk* chunk = &arena->init_chunk;
-  arena->head = chunk;
-  chunk->i = 0;
-  chunk->next = NULL;
+  arena->head = NULL;
+  arena->init_chunk = NULL;
+  arena->large = NULL;
+  arena->next_cap = ARENA_CHUNK_BYTES;
+  arena->cache = NULL;
+  arena->region = NULL;
+  arena->region_base = NULL;
+  arena->region_map_bytes = 0;
+  arena->region_reserved_bytes = 0;
+  arena->region_committed_bytes = 0;
+  arena->free_lists = NULL;
+  arena->free_bytes = 0;
+  arena->reclaimed_bytes = 0;
+}
+
+static void arena_init_cached(Arena* arena, ArenaChunkCache* cache) {
+  arena_init(arena);
+  arena->cache = cache;
+}
+
+// commit the region so that its chunk capacity >= cap, returns false if reservation is not enough
+static bool _arena_region_commit(Arena* arena, uint64_t cap) {
+  uint64_t need = sizeof(ArenaChunk) + cap;
+  if (need > arena->region_reserved_bytes) {
+    return false;
+  }
+  if (need <= arena->region_committed_bytes) {
+    return true;
+  }
+  need = (need + ARENA_REGION_COMMIT_BYTES - 1) & ~(uint64_t)(ARENA_REGION_COMMIT_BYTES - 1);
+  if (need > arena->region_reserved_bytes) {
+    need = arena->region_reserved_bytes;
+  }
+  if (mprotect(arena->region, need, PROT_READ | PROT_WRITE)) {
+    return false;
+  }
+  arena->region_committed_bytes = need;
+  arena->region->cap = need - sizeof(ArenaChunk);
+  return true;
+}
+
+// reserve reserve_bytes of address space, committed in ARENA_REGION_COMMIT_BYTES steps.
+// huge_pages advises transparent huge pages where supported.
+// if mapping fails, the arena works with normal chunks.
+static void arena_init_region(Arena* arena, uint64_t reserve_bytes, bool huge_pages) {
+  arena_init(arena);
+  reserve_bytes = (reserve_bytes + ARENA_REGION_COMMIT_BYTES - 1) & ~(uint64_t)(ARENA_REGION_COMMIT_BYTES - 1);
+  if (!reserve_bytes) {
+    return;
+  }
+
+  // over-reserve to align the region start, so huge pages can back it
+  uint64_t map_bytes = reserve_bytes + ARENA_REGION_COMMIT_BYTES;
+  void* base = mmap(NULL, map_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    return;
+  }
+  uintptr_t start = ((uintptr_t)base + ARENA_REGION_COMMIT_BYTES - 1) & ~(uintptr_t)(ARENA_REGION_COMMIT_BYTES - 1);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) {
+    madvise((void*)start, reserve_bytes, MADV_HUGEPAGE);
+  }
+#endif
+
+  arena->region = (ArenaChunk*)start;
+  arena->region_base = base;
+  arena->region_map_bytes = map_bytes;
+  arena->region_reserved_bytes = reserve_bytes;
+  arena->region_committed_bytes = 0;
+  if (!_arena_region_commit(arena, 0)) {
+    munmap(base, map_bytes);
+    arena->region = NULL;
+    arena->region_base = NULL;
+    return;
+  }
+  arena->region->next = NULL;
+  arena->region->i = 0;
+  arena->head = arena->region;
 }
 
 static Arena* arena_new() {
-  Arena* arena = malloc(sizeof(Arena));
+  Arena* arena = malloc(sizeof(Arena) + sizeof(ArenaChunk) + ARENA_CHUNK_BYTES);
   arena_init(arena);
+
+  ArenaChunk* chunk = (ArenaChunk*)(arena + 1);
+  chunk->next = NULL;
+  chunk->i = 0;
+  chunk->cap = ARENA_CHUNK_BYTES;
+  arena->head = chunk;
+  arena->init_chunk = chunk;
+  arena->next_cap = ARENA_CHUNK_BYTES * 2;
   return arena;
 }
 
-#include <stdbool.h>
-bool val_is_tracing();
-static void* arena_slot_alloc(Arena* arena, uint8_t qword_count) {
-  // TODO
-  // - refactor to use byte size
-  // - when size is very large, use single chunk
-  assert(qword_count <= ARENA_CHUNK_SIZE);
+static void* _arena_large_alloc(Arena* arena, size_t size, size_t align) {
+  if (align < sizeof(ArenaLarge)) {
+    align = sizeof(ArenaLarge);
+  }
+  char* base = malloc(sizeof(ArenaLarge) + align + size);
+  char* data = (char*)(((uintptr_t)base + sizeof(ArenaLarge) + align - 1) & ~(uintptr_t)(align - 1));
+  ArenaLarge* large = (ArenaLarge*)data - 1;
+  large->base = base;
+  large->bytes = size;
+  large->next = arena->large;
+  arena->large = large;
+  return data;
+}
+
+static ArenaChunk* _arena_chunk_push(Arena* arena, size_t min_cap) {
+  uint64_t cap = arena->next_cap;
+  if (cap < min_cap) {
+    cap = (min_cap + 7) & ~7ULL;
+  }
+  if (arena->next_cap < ARENA_CHUNK_MAX_BYTES) {
+    arena->next_cap *= 2;
+  }
+
+  ArenaChunk* chunk = _arena_chunk_malloc(arena->cache, cap);
+  chunk->i = 0;
+  chunk->cap = cap;
+  chunk->next = arena->head;
+  arena->head = chunk;
+  return chunk;
+}
+
+static int _arena_log2(uint64_t n) {
+  return 63 - __builtin_clzll(n);
+}
+
+static void* _arena_free_list_pop(Arena* arena, size_t size) {
+  ArenaFreeLists* lists = arena->free_lists;
+  ArenaFreeNode* node;
+  if (size <= ARENA_LARGE_BYTES) {
+    ArenaFreeNode** head = lists->small + (size / 8 - 1);
+    node = *head;
+    if (node) {
+      *head = node->next;
+      arena->free_bytes -= size;
+    }
+    return node;
+  }
+
+  // start from the bucket whose lower bound >= size
+  int i = _arena_log2(size);
+  if (size & (size - 1)) {
+    i++;
+  }
+  for (; i < ARENA_FREE_LARGE_LISTS; i++) {
+    node = lists->large[i];
+    if (node) {
+      lists->large[i] = node->next;
+      arena->free_bytes -= node->bytes;
+      return node;
+    }
+  }
+  return NULL;
+}
+
+// give back an object for reuse, size must be the size passed to alloc.
+// alignment is not kept: a reused object is 8-byte aligned.
+static void arena_free(Arena* arena, void* p, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if (!size) {
+    size = 8; // small lists only use the next field
+  }
+  if (!arena->free_lists) {
+    arena->free_lists = calloc(1, sizeof(ArenaFreeLists));
+  }
+  ArenaFreeNode* node = p;
+  ArenaFreeNode** head;
+  if (size <= ARENA_LARGE_BYTES) {
+    head = arena->free_lists->small + (size / 8 - 1);
+  } else {
+    node->bytes = size;
+    head = arena->free_lists->large + _arena_log2(size);
+  }
+  node->next = *head;
+  *head = node;
+  arena->free_bytes += size;
+  arena->reclaimed_bytes += size;
+}
+
+// whether p was allocated from arena: in the region, in one of the newest scan_limit chunks,
+// or one of the newest scan_limit large objects (0 for no limit).
+// a limited scan may miss older objects, so it can only be used where a miss is safe.
+static bool arena_contains(Arena* arena, const void* p, int scan_limit) {
+  uintptr_t q = (uintptr_t)p;
+  if (arena->region) {
+    uintptr_t begin = (uintptr_t)arena->region->data;
+    if (begin <= q && q < begin + arena->region->cap) {
+      return true;
+    }
+  }
+  int n = 0;
+  for (ArenaChunk* chunk = arena->head; chunk && (!scan_limit || n < scan_limit); chunk = chunk->next, n++) {
+    uintptr_t begin = (uintptr_t)chunk->data;
+    if (begin <= q && q < begin + chunk->i) {
+      return true;
+    }
+  }
+  n = 0;
+  for (ArenaLarge* large = arena->large; large && (!scan_limit || n < scan_limit); large = large->next, n++) {
+    if (ARENA_LARGE_DATA(large) == (char*)p) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// align must be power of 2, size is rounded up to multiple of 8
+static void* arena_alloc_aligned(Arena* arena, size_t size, size_t align) {
+  assert(align && (align & (align - 1)) == 0);
+  if (align < 8) {
+    align = 8;
+  }
+  size = (size + 7) & ~(size_t)7;
+  if (!size) {
+    size = 8;
+  }
 
-  if (val_is_tracing()) {
-    //content
+  if (arena->free_bytes && align == 8) {
+    void* p = _arena_free_list_pop(arena, size);
+    if (p) {
+      return p;
+    }
   }
 
-  if (arena->head->i + qword_count > ARENA_CHUNK_SIZE) {
-    ArenaChunk* chunk = malloc(sizeof(ArenaChunk));
-    chunk->i = 0;
-    chunk->next = arena->head;
-    arena->head = chunk;
+  // large objects also go to the region while it is in use
+  if (size > ARENA_LARGE_BYTES && (!arena->region || arena->head != arena->region)) {
+    return _arena_large_alloc(arena, size, align);
   }
 
   ArenaChunk* chunk = arena->head;
-  void* res = chunk->data + chunk->i;
-  chunk->i += qword_count;
-  return res;
+  if (chunk) {
+    uintptr_t begin = (uintptr_t)chunk->data;
+    uintptr_t p = (begin + chunk->i + align - 1) & ~(uintptr_t)(align - 1);
+    if (p + size <= begin + chunk->cap ||
+        (chunk == arena->region && _arena_region_commit(arena, p + size - begin))) {
+      chunk->i = p + size - begin;
+      return (void*)p;
+    }
+    if (size > ARENA_LARGE_BYTES) {
+      // the region is exhausted
+      return _arena_large_alloc(arena, size, align);
+    }
+  }
+
+  // chunk data is 8-byte aligned, reserve padding for larger alignment
+  chunk = _arena_chunk_push(arena, size + align - 8);
+  uintptr_t begin = (uintptr_t)chunk->data;
+  uintptr_t p = (begin + align - 1) & ~(uintptr_t)(align - 1);
+  chunk->i = p + size - begin;
+  return (void*)p;
+}
+
+static void* arena_alloc(Arena* arena, size_t size) {
+  return arena_alloc_aligned(arena, size, 8);
+}
+
+static void* arena_slot_alloc(Arena* arena, size_t qword_count) {
+  return arena_alloc_aligned(arena, qword_count * 8, 8);
+}
+
+// bytes handed out, including alignment padding
+static uint64_t arena_used_bytes(Arena* arena) {
+  uint64_t bytes = 0;
+  for (ArenaChunk* chunk = arena->head; chunk; chunk = chunk->next) {
+    bytes += chunk->i;
+  }
+  for (ArenaLarge* large = arena->large; large; large = large->next) {
+    bytes += large->bytes;
+  }
+  return bytes;
 }
 
 static void arena_cleanup(Arena* arena) {
   ArenaChunk* chunk = arena->head;
-  // NOTE do not free the last chunk since it is together allocated with arena
-  while (chunk->next) {
+  while (chunk) {
     ArenaChunk* next = chunk->next;
-    free(chunk);
+    // NOTE do not free the chunk allocated together with arena, or the region
+    if (chunk != arena->init_chunk && chunk != arena->region) {
+      _arena_chunk_free(arena->cache, chunk);
+    }
     chunk = next;
   }
+  ArenaLarge* large = arena->large;
+  while (large) {
+    ArenaLarge* next = large->next;
+    free(large->base);
+    large = next;
+  }
+  if (arena->region) {
+    munmap(arena->region_base, arena->region_map_bytes);
+    arena->region = NULL;
+    arena->region_base = NULL;
+  }
+  free(arena->free_lists);
+  arena->free_lists = NULL;
+  arena->free_bytes = 0;
+  arena->head = NULL;
+  arena->large = NULL;
+  arena->next_cap = ARENA_CHUNK_BYTES;
 }
 
 static void arena_delete(Arena* arena) {
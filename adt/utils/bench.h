@@ -0,0 +1,32 @@
+#pragma once
+
+// minimal helpers for micro benchmarks
+
+// Usage example:
+//   bench_run("array append", n) {
+//     for (int i = 0; i < n; i++) { ... }
+//   }
+// the block is executed once, then elapsed time per op is reported
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_report(const char* name, uint64_t ops, uint64_t ns) {
+  printf("  %-48s %10.2f ns/op %14.0f ops/s\n", name, (double)ns / ops, ops * 1e9 / (ns ? ns : 1));
+}
+
+#define bench_run(_name_, _ops_) \
+  for (uint64_t _bench_t0_ = bench_now_ns(), _bench_once_ = 1; _bench_once_;\
+       _bench_once_ = 0, bench_report((_name_), (_ops_), bench_now_ns() - _bench_t0_))
+
+#define bench_suite(_suite_) do {\
+  printf("\e[38;5;6m%s\e[38;5;7m\n", #_suite_);\
+  _suite_();\
+} while (0)
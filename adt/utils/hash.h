@@ -0,0 +1,82 @@
+#pragma once
+
+// fast non-cryptographic hashes for internal tables (method ids, pointers, literal names ...)
+
+// - the core is a 64x64->128 bit multiply folded into 64 bits (as in wyhash),
+//   both the high and the low bits of the result are well mixed, so tables can mask the low bits
+// - keys up to 16 bytes take one multiply plus the final mix, without loops
+// - NOT resistant to hash flooding, keys controlled by users should still go through val_hash_mem() (SipHash)
+
+// Usage example:
+//   MUT_MAP_DECL(IdMap, uint32_t, int, fast_hash_u64, id_eq);
+//   uint64_t h = fast_hash_mem(s, size);
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#pragma mark ### helpers (for internal use only)
+
+#define FAST_HASH_P0 0xa0761d6478bd642fULL
+#define FAST_HASH_P1 0xe7037ed1a0b428dbULL
+#define FAST_HASH_P2 0x8ebc6af09c88c6e3ULL
+
+static inline uint64_t _fast_hash_mum(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t _fast_hash_r8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t _fast_hash_r4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// 1 to 3 bytes
+static inline uint64_t _fast_hash_r3(const uint8_t* p, size_t size) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) | p[size - 1];
+}
+
+#pragma mark ### interface
+
+static inline uint64_t fast_hash_u64(uint64_t k) {
+  return _fast_hash_mum(k ^ FAST_HASH_P0, FAST_HASH_P1);
+}
+
+static inline uint64_t fast_hash_mem(const void* memory, size_t size) {
+  const uint8_t* p = memory;
+  uint64_t seed = FAST_HASH_P2;
+  uint64_t a, b;
+  if (size <= 16) {
+    if (size >= 4) {
+      // 2 overlapping reads on each side cover 4..16 bytes
+      size_t mid = (size >> 3) << 2;
+      a = (_fast_hash_r4(p) << 32) | _fast_hash_r4(p + mid);
+      b = (_fast_hash_r4(p + size - 4) << 32) | _fast_hash_r4(p + size - 4 - mid);
+    } else if (size > 0) {
+      a = _fast_hash_r3(p, size);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = size;
+    while (i > 16) {
+      seed = _fast_hash_mum(_fast_hash_r8(p) ^ FAST_HASH_P1, _fast_hash_r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    // the last 16 bytes, may overlap the previous block
+    a = _fast_hash_r8(p + i - 16);
+    b = _fast_hash_r8(p + i - 8);
+  }
+
+  __uint128_t r = (__uint128_t)(a ^ FAST_HASH_P1) * (b ^ seed);
+  return _fast_hash_mum((uint64_t)r ^ FAST_HASH_P0 ^ size, (uint64_t)(r >> 64) ^ FAST_HASH_P1);
+}
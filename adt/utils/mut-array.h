@@ -12,6 +12,13 @@
 //   Arr.reverse(&da);
 //   Arr.at(&da, 0);
 //   Arr.cleanup(&da);
+//
+// Starting on a buffer of the caller (for example on the stack), the heap is only used when it grows out of the buffer:
+//   int buf[16];
+//   Arr.init_buf(&da, buf, 16);
+//   Arr.extend(&da, elems, n);
+//   Arr.truncate(&da, 0);
+//   Arr.cleanup(&da); // doesn't free buf
 
 // See bottom of this file for API
 
@@ -21,35 +28,79 @@
 
 #define MUT_ARRAY_DECL(MutArrayType, ElemType)\
   /* note typedef will cause symbol conflict */\
-  struct MutArrayType {size_t size; size_t cap; ElemType* data;};\
+  /* buf is the caller's buffer given to init_buf, data is not freed while it points to buf */\
+  struct MutArrayType {size_t size; size_t cap; ElemType* data; ElemType* buf;};\
   \
   static void MutArrayType##_MUT_ARRAY_init(struct MutArrayType* da, size_t init_cap) {\
     da->size = 0;\
     da->cap = (init_cap ? init_cap : 8);\
     da->data = malloc(sizeof(ElemType) * da->cap);\
+    da->buf = NULL;\
+  }\
+  static void MutArrayType##_MUT_ARRAY_init_buf(struct MutArrayType* da, ElemType* buf, size_t buf_cap) {\
+    assert(buf_cap);\
+    da->size = 0;\
+    da->cap = buf_cap;\
+    da->data = buf;\
+    da->buf = buf;\
   }\
   static void MutArrayType##_MUT_ARRAY_init_dup(struct MutArrayType* to, struct MutArrayType* from) {\
     to->size = from->size;\
     to->cap = from->cap;\
     to->data = malloc(sizeof(ElemType) * to->cap);\
+    to->buf = NULL;\
     memcpy(to->data, from->data, sizeof(ElemType) * to->size);\
   }\
   \
   static void MutArrayType##_MUT_ARRAY_cleanup(struct MutArrayType* da) {\
     da->size = 0;\
     da->cap = 0;\
-    free(da->data);\
+    if (da->data != da->buf) {\
+      free(da->data);\
+    }\
     da->data = NULL;\
+    da->buf = NULL;\
+  }\
+  \
+  /* moves data out of the caller's buffer on first growth */\
+  static void MutArrayType##_MUT_ARRAY_grow(struct MutArrayType* da, size_t cap) {\
+    if (da->buf && da->data == da->buf) {\
+      da->data = malloc(sizeof(ElemType) * cap);\
+      memcpy(da->data, da->buf, sizeof(ElemType) * da->size);\
+    } else {\
+      da->data = realloc(da->data, sizeof(ElemType) * cap);\
+    }\
+    da->cap = cap;\
+  }\
+  \
+  static void MutArrayType##_MUT_ARRAY_reserve(struct MutArrayType* da, size_t cap) {\
+    if (cap > da->cap) {\
+      MutArrayType##_MUT_ARRAY_grow(da, cap);\
+    }\
   }\
   \
   static void MutArrayType##_MUT_ARRAY_push(struct MutArrayType* da, ElemType e) {\
     if (da->size == da->cap) {\
-      da->cap *= 2;\
-      da->data = realloc(da->data, sizeof(ElemType) * da->cap);\
+      MutArrayType##_MUT_ARRAY_grow(da, da->cap * 2);\
     }\
     da->data[da->size++] = e;\
   }\
   \
+  static void MutArrayType##_MUT_ARRAY_extend(struct MutArrayType* da, const ElemType* elems, size_t n) {\
+    if (da->size + n > da->cap) {\
+      MutArrayType##_MUT_ARRAY_grow(da, (da->size + n > da->cap * 2) ? da->size + n : da->cap * 2);\
+    }\
+    if (n) {\
+      memcpy(da->data + da->size, elems, sizeof(ElemType) * n);\
+    }\
+    da->size += n;\
+  }\
+  \
+  static void MutArrayType##_MUT_ARRAY_truncate(struct MutArrayType* da, size_t size) {\
+    assert(da->size >= size);\
+    da->size = size;\
+  }\
+  \
   static ElemType MutArrayType##_MUT_ARRAY_pop(struct MutArrayType* da) {\
     assert(da->size);\
     return da->data[--da->size];\
@@ -86,9 +137,13 @@
   \
   static struct {\
     void (*init)(struct MutArrayType*, size_t);\
+    void (*init_buf)(struct MutArrayType*, ElemType* buf, size_t buf_cap);\
     void (*init_dup)(struct MutArrayType* to, struct MutArrayType* from);\
     void (*cleanup)(struct MutArrayType*);\
+    void (*reserve)(struct MutArrayType*, size_t cap);\
     void (*push)(struct MutArrayType*, ElemType);\
+    void (*extend)(struct MutArrayType*, const ElemType* elems, size_t n);\
+    void (*truncate)(struct MutArrayType*, size_t size);\
     ElemType (*pop)(struct MutArrayType*);\
     ElemType* (*top)(struct MutArrayType*);\
     void (*remove)(struct MutArrayType*, size_t);\
@@ -97,9 +152,13 @@
     ElemType* (*at)(struct MutArrayType*, size_t);\
   } const MutArrayType = {\
     .init = MutArrayType##_MUT_ARRAY_init,\
+    .init_buf = MutArrayType##_MUT_ARRAY_init_buf,\
     .init_dup = MutArrayType##_MUT_ARRAY_init_dup,\
     .cleanup = MutArrayType##_MUT_ARRAY_cleanup,\
+    .reserve = MutArrayType##_MUT_ARRAY_reserve,\
     .push = MutArrayType##_MUT_ARRAY_push,\
+    .extend = MutArrayType##_MUT_ARRAY_extend,\
+    .truncate = MutArrayType##_MUT_ARRAY_truncate,\
     .pop = MutArrayType##_MUT_ARRAY_pop,\
     .top = MutArrayType##_MUT_ARRAY_top,\
     .remove = MutArrayType##_MUT_ARRAY_remove,\
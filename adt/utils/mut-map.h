@@ -20,13 +20,22 @@
 //     i.slot->v;
 //   }
 
+// incremental resize (opt-in):
+//   MUT_MAP_DECL_INCREMENTAL(MyMap, KeyType, ValueType, hash_func, eq_func);
+//   has the same interface, but growing the map doesn't re-insert everything at once:
+//   the old slots are kept, and each insert / find / remove moves MUT_MAP_MIGRATE_BUCKETS buckets of them into the new slots.
+//   use it for big maps where a stop-the-world rehash gives visible pauses.
+
 // internal:
 //   each slot inlines the first key and value, so
 //   when inserting to an empty slot, no dynamic allocation for entry is required.
 //   when inserting to a non-empty slot, malloc a new entry and link.
+//   while migrating, a key lives in either new slots or old slots, never both.
+//   old buckets before old_i are already moved (and empty).
 
 // NOTE this simple hash map does not take charge of memory management of k and v
 // NOTE this is a bit tricky since the type and static object are both named MyMap
+// NOTE for incremental maps, find also moves entries, so don't find / insert / remove while iterating
 
 // TODO (not very important): use pool to make slot allocation faster
 // TODO use val_alloc to track memory
@@ -35,6 +44,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #pragma mark ### helpers (for internal use only)
 
@@ -45,7 +56,7 @@
   p->tag = ((p->tag & 1ULL) | (uintptr_t)next)
 
 #define MUT_MAP_SLOT_GET_HIT(p) \
-  p->tag & 1ULL
+  (p->tag & 1ULL)
 
 #define MUT_MAP_SLOT_SET_HIT(p, hit) \
   if (hit) {\
@@ -60,51 +71,53 @@
 #define MUT_MAP_FIND_SLOT(mm, k, hash_func) \
   mm->slots + (hash_func(k) & ((1ULL << mm->bits) - 1))
 
+// old buckets moved by each operation of an incremental map during resize.
+// the new slots have twice the capacity, so the migration completes long before they fill up.
+#define MUT_MAP_MIGRATE_BUCKETS 4
+
 #pragma mark ### interface
 
 #define MUT_MAP_DECL(MutMapType, KeyType, ValueType, hash_func, eq_func) \
+  MUT_MAP_DECL_IMPL(MutMapType, KeyType, ValueType, hash_func, eq_func, false)
+
+#define MUT_MAP_DECL_INCREMENTAL(MutMapType, KeyType, ValueType, hash_func, eq_func) \
+  MUT_MAP_DECL_IMPL(MutMapType, KeyType, ValueType, hash_func, eq_func, true)
+
+#define MUT_MAP_DECL_IMPL(MutMapType, KeyType, ValueType, hash_func, eq_func, incremental) \
   typedef struct { uintptr_t tag; KeyType k; ValueType v; } MutMapType##Slot;\
-  struct MutMapType { size_t size; size_t bits; MutMapType##Slot* slots; };\
+  struct MutMapType {\
+    size_t size; size_t bits; MutMapType##Slot* slots;\
+    /* only used by incremental maps while resizing */\
+    size_t old_bits; size_t old_i; MutMapType##Slot* old_slots;\
+  };\
   typedef struct { size_t i; struct MutMapType* mm; MutMapType##Slot* slot; } MutMapType##Iter;\
   \
-  static void MutMapType##_MUT_MAP_init(struct MutMapType* mm) {\
-    mm->size = 0;\
-    mm->bits = 4;\
-    mm->slots = malloc(sizeof(MutMapType##Slot) * MUT_MAP_CAP(mm));\
-    memset(mm->slots, 0, sizeof(MutMapType##Slot) * MUT_MAP_CAP(mm));\
-  }\
-  \
-  static size_t MutMapType##_MUT_MAP_size(struct MutMapType* mm) {\
-    return mm->size;\
+  static MutMapType##Slot* MutMapType##_MUT_MAP_slots_new(size_t bits) {\
+    /* calloc so huge slots are zero-mapped lazily instead of memset at once */\
+    MutMapType##Slot* slots = calloc(1ULL << bits, sizeof(MutMapType##Slot));\
+    assert(slots);\
+    return slots;\
   }\
   \
-  static bool MutMapType##_MUT_MAP_find(struct MutMapType* mm, KeyType k, ValueType* v) {\
-    for (MutMapType##Slot* slot = MUT_MAP_FIND_SLOT(mm, k, hash_func); slot; slot = MUT_MAP_SLOT_GET_NEXT(slot)) {\
+  static MutMapType##Slot* MutMapType##_MUT_MAP_bucket_find(MutMapType##Slot* slot, KeyType k) {\
+    for (; slot; slot = MUT_MAP_SLOT_GET_NEXT(slot)) {\
       if (!MUT_MAP_SLOT_GET_HIT(slot)) {\
         break;\
       }\
       if (eq_func(k, slot->k)) {\
-        if (v) {\
-          *v = slot->v;\
-        }\
-        return true;\
+        return slot;\
       }\
     }\
-    return false;\
+    return NULL;\
   }\
   \
-  static void MutMapType##_MUT_MAP_rehash(struct MutMapType* mm, size_t bits);\
-  static void MutMapType##_MUT_MAP_insert(struct MutMapType* mm, KeyType k, ValueType v) {\
-    if (MUT_MAP_CAP(mm) * 8 < mm->size * 10) { /*factor of 0.8*/\
-      MutMapType##_MUT_MAP_rehash(mm, mm->bits + 1);\
-    }\
-    \
-    MutMapType##Slot* slot = MUT_MAP_FIND_SLOT(mm, k, hash_func);\
+  /* returns true if k is newly added */\
+  static bool MutMapType##_MUT_MAP_bucket_put(MutMapType##Slot* slot, KeyType k, ValueType v) {\
     if (MUT_MAP_SLOT_GET_HIT(slot)) {\
       for (MutMapType##Slot* col_slot = slot; col_slot; col_slot = MUT_MAP_SLOT_GET_NEXT(col_slot)) {\
         if (eq_func(k, col_slot->k)) {\
           col_slot->v = v;\
-          return;\
+          return false;\
         }\
       }\
       \
@@ -114,19 +127,18 @@
       slot->k = k;\
       slot->v = v;\
       MUT_MAP_SLOT_SET_NEXT(slot, col_slot);\
-      mm->size++;\
     } else {\
       slot->k = k;\
       slot->v = v;\
       MUT_MAP_SLOT_SET_HIT(slot, true);\
-      mm->size++;\
     }\
+    return true;\
   }\
   \
-  static void MutMapType##_MUT_MAP_remove(struct MutMapType* mm, KeyType k) {\
-    MutMapType##Slot* slot = MUT_MAP_FIND_SLOT(mm, k, hash_func);\
+  /* returns true if k is removed */\
+  static bool MutMapType##_MUT_MAP_bucket_remove(MutMapType##Slot* slot, KeyType k) {\
     if (!MUT_MAP_SLOT_GET_HIT(slot)) {\
-      return;\
+      return false;\
     }\
     \
     if (eq_func(k, slot->k)) {\
@@ -137,8 +149,7 @@
       } else {\
         MUT_MAP_SLOT_SET_HIT(slot, false);\
       }\
-      mm->size--;\
-      return;\
+      return true;\
     }\
     \
     MutMapType##Slot* prev_slot = slot;\
@@ -146,17 +157,17 @@
       if (eq_func(k, col_slot->k)) {\
         MUT_MAP_SLOT_SET_NEXT(prev_slot, MUT_MAP_SLOT_GET_NEXT(col_slot));\
         free(col_slot);\
-        mm->size--;\
-        break;\
+        return true;\
       }\
       prev_slot = col_slot;\
     }\
+    return false;\
   }\
   \
-  static void MutMapType##_MUT_MAP_cleanup(struct MutMapType* mm) {\
-    size_t cap = MUT_MAP_CAP(mm);\
+  static void MutMapType##_MUT_MAP_slots_free(MutMapType##Slot* slots, size_t bits) {\
+    size_t cap = 1ULL << bits;\
     for (size_t i = 0; i < cap; i++) {\
-      MutMapType##Slot* slot = mm->slots + i;\
+      MutMapType##Slot* slot = slots + i;\
       if (MUT_MAP_SLOT_GET_HIT(slot)) {\
         MutMapType##Slot* col_slot = MUT_MAP_SLOT_GET_NEXT(slot);\
         while (col_slot) {\
@@ -166,16 +177,125 @@
         }\
       }\
     }\
-    free(mm->slots);\
+    free(slots);\
+  }\
+  \
+  /* move up to n old buckets into the new slots, and drop the old slots when all moved */\
+  static void MutMapType##_MUT_MAP_migrate(struct MutMapType* mm, size_t n) {\
+    size_t old_cap = 1ULL << mm->old_bits;\
+    size_t mask = MUT_MAP_CAP(mm) - 1;\
+    for (; n && mm->old_i < old_cap; n--, mm->old_i++) {\
+      MutMapType##Slot* slot = mm->old_slots + mm->old_i;\
+      if (!MUT_MAP_SLOT_GET_HIT(slot)) {\
+        continue;\
+      }\
+      MutMapType##_MUT_MAP_bucket_put(mm->slots + (hash_func(slot->k) & mask), slot->k, slot->v);\
+      MutMapType##Slot* col_slot = MUT_MAP_SLOT_GET_NEXT(slot);\
+      while (col_slot) {\
+        MutMapType##Slot* next = MUT_MAP_SLOT_GET_NEXT(col_slot);\
+        MutMapType##_MUT_MAP_bucket_put(mm->slots + (hash_func(col_slot->k) & mask), col_slot->k, col_slot->v);\
+        free(col_slot);\
+        col_slot = next;\
+      }\
+      slot->tag = 0;\
+    }\
+    if (mm->old_i == old_cap) {\
+      free(mm->old_slots);\
+      mm->old_slots = NULL;\
+    }\
+  }\
+  \
+  static MutMapType##Slot* MutMapType##_MUT_MAP_old_bucket(struct MutMapType* mm, uint64_t h) {\
+    return mm->old_slots + (h & ((1ULL << mm->old_bits) - 1));\
+  }\
+  \
+  static void MutMapType##_MUT_MAP_init(struct MutMapType* mm) {\
+    mm->size = 0;\
+    mm->bits = 4;\
+    mm->slots = MutMapType##_MUT_MAP_slots_new(mm->bits);\
+    mm->old_bits = 0;\
+    mm->old_i = 0;\
+    mm->old_slots = NULL;\
+  }\
+  \
+  static size_t MutMapType##_MUT_MAP_size(struct MutMapType* mm) {\
+    return mm->size;\
+  }\
+  \
+  static bool MutMapType##_MUT_MAP_find(struct MutMapType* mm, KeyType k, ValueType* v) {\
+    if (incremental && mm->old_slots) {\
+      MutMapType##_MUT_MAP_migrate(mm, MUT_MAP_MIGRATE_BUCKETS);\
+    }\
+    uint64_t h = hash_func(k);\
+    MutMapType##Slot* slot = MutMapType##_MUT_MAP_bucket_find(mm->slots + (h & (MUT_MAP_CAP(mm) - 1)), k);\
+    if (incremental && !slot && mm->old_slots) {\
+      slot = MutMapType##_MUT_MAP_bucket_find(MutMapType##_MUT_MAP_old_bucket(mm, h), k);\
+    }\
+    if (slot && v) {\
+      *v = slot->v;\
+    }\
+    return slot != NULL;\
+  }\
+  \
+  static void MutMapType##_MUT_MAP_rehash(struct MutMapType* mm, size_t bits);\
+  static void MutMapType##_MUT_MAP_insert(struct MutMapType* mm, KeyType k, ValueType v) {\
+    if (incremental && mm->old_slots) {\
+      MutMapType##_MUT_MAP_migrate(mm, MUT_MAP_MIGRATE_BUCKETS);\
+    } else if (MUT_MAP_CAP(mm) * 8 < mm->size * 10) { /*factor of 0.8*/\
+      if (incremental) {\
+        mm->old_bits = mm->bits;\
+        mm->old_i = 0;\
+        mm->old_slots = mm->slots;\
+        mm->bits++;\
+        mm->slots = MutMapType##_MUT_MAP_slots_new(mm->bits);\
+        MutMapType##_MUT_MAP_migrate(mm, MUT_MAP_MIGRATE_BUCKETS);\
+      } else {\
+        MutMapType##_MUT_MAP_rehash(mm, mm->bits + 1);\
+      }\
+    }\
+    \
+    uint64_t h = hash_func(k);\
+    if (incremental && mm->old_slots) {\
+      MutMapType##Slot* slot = MutMapType##_MUT_MAP_bucket_find(MutMapType##_MUT_MAP_old_bucket(mm, h), k);\
+      if (slot) {\
+        slot->v = v;\
+        return;\
+      }\
+    }\
+    if (MutMapType##_MUT_MAP_bucket_put(mm->slots + (h & (MUT_MAP_CAP(mm) - 1)), k, v)) {\
+      mm->size++;\
+    }\
+  }\
+  \
+  static void MutMapType##_MUT_MAP_remove(struct MutMapType* mm, KeyType k) {\
+    if (incremental && mm->old_slots) {\
+      MutMapType##_MUT_MAP_migrate(mm, MUT_MAP_MIGRATE_BUCKETS);\
+    }\
+    uint64_t h = hash_func(k);\
+    bool removed = MutMapType##_MUT_MAP_bucket_remove(mm->slots + (h & (MUT_MAP_CAP(mm) - 1)), k);\
+    if (incremental && !removed && mm->old_slots) {\
+      removed = MutMapType##_MUT_MAP_bucket_remove(MutMapType##_MUT_MAP_old_bucket(mm, h), k);\
+    }\
+    if (removed) {\
+      mm->size--;\
+    }\
+  }\
+  \
+  static void MutMapType##_MUT_MAP_cleanup(struct MutMapType* mm) {\
+    MutMapType##_MUT_MAP_slots_free(mm->slots, mm->bits);\
     mm->slots = NULL;\
+    if (mm->old_slots) {\
+      MutMapType##_MUT_MAP_slots_free(mm->old_slots, mm->old_bits);\
+      mm->old_slots = NULL;\
+    }\
   }\
   \
-  static void MutMapType##_MUT_MAP_iter_init(MutMapType##Iter* it, struct MutMapType* mm) {\
-    it->i = 0;\
-    it->mm = mm;\
-    size_t cap = MUT_MAP_CAP(mm);\
-    for (; it->i < cap; it->i++) {\
-      MutMapType##Slot* slot = mm->slots + it->i;\
+  /* it->i counts new slots first, then old slots */\
+  static void MutMapType##_MUT_MAP_iter_seek(MutMapType##Iter* it) {\
+    size_t cap = MUT_MAP_CAP(it->mm);\
+    size_t end = cap + (it->mm->old_slots ? (1ULL << it->mm->old_bits) : 0);\
+    for (; it->i < end; it->i++) {\
+      MutMapType##Slot* slot = it->i < cap ? it->mm->slots + it->i : it->mm->old_slots + (it->i - cap);\
       if (MUT_MAP_SLOT_GET_HIT(slot)) {\
         it->slot = slot;\
         return;\
@@ -184,6 +304,12 @@
     it->slot = NULL;\
   }\
   \
+  static void MutMapType##_MUT_MAP_iter_init(MutMapType##Iter* it, struct MutMapType* mm) {\
+    it->i = 0;\
+    it->mm = mm;\
+    MutMapType##_MUT_MAP_iter_seek(it);\
+  }\
+  \
   static void MutMapType##_MUT_MAP_iter_next(MutMapType##Iter* it) {\
     MutMapType##Slot* next = MUT_MAP_SLOT_GET_NEXT(it->slot);\
     if (next) {\
@@ -191,32 +317,25 @@
       return;\
     }\
     \
-    size_t cap = MUT_MAP_CAP(it->mm);\
-    for (it->i++; it->i < cap; it->i++) {\
-      MutMapType##Slot* slot = it->mm->slots + it->i;\
-      if (MUT_MAP_SLOT_GET_HIT(slot)) {\
-        it->slot = slot;\
-        return;\
-      }\
-    }\
-    it->slot = NULL;\
+    it->i++;\
+    MutMapType##_MUT_MAP_iter_seek(it);\
   }\
   \
   static bool MutMapType##_MUT_MAP_iter_is_end(MutMapType##Iter* it) {\
     return it->slot == NULL;\
   }\
   \
+  /* stop-the-world rehash, also completes a pending migration */\
   static void MutMapType##_MUT_MAP_rehash(struct MutMapType* mm, size_t bits) {\
     struct MutMapType new_mm = {\
-      .size = 0,\
+      .size = mm->size,\
       .bits = bits,\
-      .slots = malloc(sizeof(MutMapType##Slot) * (1ULL << bits))\
+      .slots = MutMapType##_MUT_MAP_slots_new(bits)\
     };\
-    assert(new_mm.slots);\
-    memset(new_mm.slots, 0, sizeof(MutMapType##Slot) * (1ULL << bits));\
+    size_t mask = (1ULL << bits) - 1;\
     MutMapType##Iter it;\
     for (MutMapType##_MUT_MAP_iter_init(&it, mm); !MutMapType##_MUT_MAP_iter_is_end(&it); MutMapType##_MUT_MAP_iter_next(&it)) {\
-      MutMapType##_MUT_MAP_insert(&new_mm, it.slot->k, it.slot->v);\
+      MutMapType##_MUT_MAP_bucket_put(new_mm.slots + (hash_func(it.slot->k) & mask), it.slot->k, it.slot->v);\
     }\
     MutMapType##_MUT_MAP_cleanup(mm);\
     *mm = new_mm;\
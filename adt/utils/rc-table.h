@@ -0,0 +1,193 @@
+#pragma once
+
+// sharded open-addressing table for { pointer => count }, used for ref counts overflowing the header
+
+// - the pointer is hashed with a cheap multiplicative mix, top bits select the shard
+// - each shard is a linear probing table, removal does backward shift so no tombstone is left
+// - with RC_TABLE_CONCURRENT defined, each shard is guarded by a spin lock,
+//   threads updating keys in different shards don't contend
+
+// Usage example:
+//   RcTable t;
+//   rc_table_init(&t);
+//   rc_table_set(&t, (uintptr_t)p, 4096);
+//   int64_t c = rc_table_add(&t, (uintptr_t)p, 1); // 4097
+//   rc_table_remove(&t, (uintptr_t)p);
+//   rc_table_cleanup(&t);
+
+// Customization:
+// - RC_TABLE_SHARD_BITS  log2 of shard count
+// - RC_TABLE_CONCURRENT  guard shards with spin locks
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef RC_TABLE_CONCURRENT
+#include <stdatomic.h>
+#endif
+
+#ifndef RC_TABLE_SHARD_BITS
+#define RC_TABLE_SHARD_BITS 4
+#endif
+
+#define RC_TABLE_SHARDS (1 << RC_TABLE_SHARD_BITS)
+#define RC_TABLE_INIT_CAP 16
+
+typedef struct {
+  uintptr_t k; // 0 for empty slot
+  int64_t count;
+} RcTableSlot;
+
+typedef struct {
+  uint32_t size;
+  uint32_t mask; // capacity - 1
+  RcTableSlot* slots;
+#ifdef RC_TABLE_CONCURRENT
+  atomic_flag lock;
+#endif
+} RcTableShard;
+
+typedef struct {
+  RcTableShard shards[RC_TABLE_SHARDS];
+} RcTable;
+
+static uint64_t rc_table_hash(uintptr_t k) {
+  // objects are at least 8-byte aligned
+  return (uint64_t)(k >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+static void rc_table_init(RcTable* t) {
+  for (int i = 0; i < RC_TABLE_SHARDS; i++) {
+    RcTableShard* s = t->shards + i;
+    s->size = 0;
+    s->mask = RC_TABLE_INIT_CAP - 1;
+    s->slots = calloc(RC_TABLE_INIT_CAP, sizeof(RcTableSlot));
+#ifdef RC_TABLE_CONCURRENT
+    atomic_flag_clear(&s->lock);
+#endif
+  }
+}
+
+static void rc_table_cleanup(RcTable* t) {
+  for (int i = 0; i < RC_TABLE_SHARDS; i++) {
+    free(t->shards[i].slots);
+  }
+}
+
+static RcTableShard* _rc_table_lock(RcTable* t, uint64_t h) {
+  RcTableShard* s = t->shards + (h >> (64 - RC_TABLE_SHARD_BITS));
+#ifdef RC_TABLE_CONCURRENT
+  while (atomic_flag_test_and_set_explicit(&s->lock, memory_order_acquire)) {
+  }
+#endif
+  return s;
+}
+
+static void _rc_table_unlock(RcTableShard* s) {
+#ifdef RC_TABLE_CONCURRENT
+  atomic_flag_clear_explicit(&s->lock, memory_order_release);
+#endif
+}
+
+// the bits under shard bits are used as slot index
+static uint32_t _rc_table_index(RcTableShard* s, uint64_t h) {
+  return (uint32_t)(h >> (64 - RC_TABLE_SHARD_BITS - 24)) & s->mask;
+}
+
+static RcTableSlot* _rc_table_find(RcTableShard* s, uintptr_t k, uint64_t h) {
+  for (uint32_t i = _rc_table_index(s, h);; i = (i + 1) & s->mask) {
+    RcTableSlot* slot = s->slots + i;
+    if (slot->k == k) {
+      return slot;
+    }
+    if (!slot->k) {
+      return NULL;
+    }
+  }
+}
+
+static void _rc_table_grow(RcTableShard* s) {
+  RcTableSlot* old_slots = s->slots;
+  uint32_t old_cap = s->mask + 1;
+  s->mask = old_cap * 2 - 1;
+  s->slots = calloc(old_cap * 2, sizeof(RcTableSlot));
+  for (uint32_t j = 0; j < old_cap; j++) {
+    if (old_slots[j].k) {
+      uint32_t i = _rc_table_index(s, rc_table_hash(old_slots[j].k));
+      while (s->slots[i].k) {
+        i = (i + 1) & s->mask;
+      }
+      s->slots[i] = old_slots[j];
+    }
+  }
+  free(old_slots);
+}
+
+// returns -1 if not found
+static int64_t rc_table_get(RcTable* t, uintptr_t k) {
+  uint64_t h = rc_table_hash(k);
+  RcTableShard* s = _rc_table_lock(t, h);
+  RcTableSlot* slot = _rc_table_find(s, k, h);
+  int64_t res = slot ? slot->count : -1;
+  _rc_table_unlock(s);
+  return res;
+}
+
+static void rc_table_set(RcTable* t, uintptr_t k, int64_t count) {
+  uint64_t h = rc_table_hash(k);
+  RcTableShard* s = _rc_table_lock(t, h);
+  // load factor <= 1/2
+  if ((s->size + 1) * 2 > s->mask + 1) {
+    _rc_table_grow(s);
+  }
+  uint32_t i = _rc_table_index(s, h);
+  while (s->slots[i].k && s->slots[i].k != k) {
+    i = (i + 1) & s->mask;
+  }
+  if (!s->slots[i].k) {
+    s->slots[i].k = k;
+    s->size++;
+  }
+  s->slots[i].count = count;
+  _rc_table_unlock(s);
+}
+
+// returns the updated count, or -1 if not found
+static int64_t rc_table_add(RcTable* t, uintptr_t k, int64_t delta) {
+  uint64_t h = rc_table_hash(k);
+  RcTableShard* s = _rc_table_lock(t, h);
+  RcTableSlot* slot = _rc_table_find(s, k, h);
+  int64_t res = -1;
+  if (slot) {
+    slot->count += delta;
+    res = slot->count;
+  }
+  _rc_table_unlock(s);
+  return res;
+}
+
+static bool rc_table_remove(RcTable* t, uintptr_t k) {
+  uint64_t h = rc_table_hash(k);
+  RcTableShard* s = _rc_table_lock(t, h);
+  RcTableSlot* slot = _rc_table_find(s, k, h);
+  if (!slot) {
+    _rc_table_unlock(s);
+    return false;
+  }
+
+  // backward shift: move following entries into the hole if it is between their home and them
+  uint32_t hole = (uint32_t)(slot - s->slots);
+  for (uint32_t i = (hole + 1) & s->mask; s->slots[i].k; i = (i + 1) & s->mask) {
+    uint32_t home = _rc_table_index(s, rc_table_hash(s->slots[i].k));
+    if (((i - home) & s->mask) >= ((i - hole) & s->mask)) {
+      s->slots[hole] = s->slots[i];
+      hole = i;
+    }
+  }
+  s->slots[hole].k = 0;
+  s->slots[hole].count = 0;
+  s->size--;
+  _rc_table_unlock(s);
+  return true;
+}
@@ -0,0 +1,472 @@
+#pragma once
+
+// size-class slab allocator for small objects (the pool.h idea extended to a set of size classes)
+
+// - pages are carved from one process-wide virtual region, so slab pointers are told apart by a range compare
+// - a page holds slots of a single size class, the page header keeps the free list and the live count
+// - each size class has a magazine (a small stack of free slots) in front of the pages,
+//   alloc and free on the magazine don't touch any page header
+// - when a page has no live slot, it is recycled and can be reused by any size class,
+//   empty pages exceeding SLAB_RETAIN_PAGES are returned to the OS
+// - slots are 16-byte aligned, same as malloc
+// - a slab is owned by one thread, freeing a slot from another thread pushes it to the owner's remote list,
+//   the owner drains the remote list on next refill
+// - slab_cleanup (e.g. on thread exit) keeps pages still holding live slots: they are handed to a process-wide
+//   orphan list, slots freed to them meanwhile are collected there, and a slab that needs a new page adopts them
+
+// Usage example:
+//   Slab slab;
+//   slab_init(&slab);
+//   void* p = slab_alloc(&slab, 24); // NULL if size > SLAB_MAX_BYTES or the region is exhausted
+//   if (slab_contains(p)) {
+//     slab_free(&slab, p);
+//   }
+//   slab_cleanup(&slab);
+
+// Customization:
+// - SLAB_REGION_BYTES  virtual memory reserved for all slabs, committed page by page
+// - SLAB_RETAIN_PAGES  empty pages kept by each slab for reuse
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "mut-array.h"
+
+#ifndef SLAB_REGION_BYTES
+#define SLAB_REGION_BYTES (1ULL << 34)
+#endif
+
+#ifndef SLAB_RETAIN_PAGES
+#define SLAB_RETAIN_PAGES 4
+#endif
+
+#define SLAB_PAGE_BYTES (1ULL << 16)
+#define SLAB_PAGE_HEADER_BYTES 64
+#define SLAB_MAX_BYTES 512
+#define SLAB_CLASS_COUNT 17
+#define SLAB_MAGAZINE_CAP 64
+
+#define SLAB_PAGE_OF(p) ((SlabPage*)((uintptr_t)(p) & ~(SLAB_PAGE_BYTES - 1)))
+
+struct SlabStruct;
+typedef struct SlabStruct Slab;
+
+typedef enum { SLAB_PAGE_EMPTY, SLAB_PAGE_PARTIAL, SLAB_PAGE_FULL } SlabPageState;
+
+struct SlabPageStruct;
+typedef struct SlabPageStruct SlabPage;
+struct SlabPageStruct {
+  SlabPage* prev;  // links in partial / full list
+  SlabPage* next;  // links in partial / full / empty list
+  _Atomic(Slab*) owner; // changed with lock held, so remote frees never reach a slab that is cleaned up
+  void* free_list;
+  uint32_t klass;  // size class index
+  uint32_t slot_bytes;
+  uint32_t live;   // slots out of the page, including slots in the magazine and remote lists
+  uint32_t bump;   // offset of the first never-used slot
+  SlabPageState state;
+  atomic_flag lock;
+};
+
+_Static_assert(sizeof(SlabPage) <= SLAB_PAGE_HEADER_BYTES, "slab page header too large");
+_Static_assert(SLAB_PAGE_HEADER_BYTES % 16 == 0, "slots should be 16-byte aligned");
+
+typedef struct {
+  uint32_t size;
+  void* slots[SLAB_MAGAZINE_CAP];
+  SlabPage* partial;
+} SlabClass;
+
+struct SlabStruct {
+  SlabClass classes[SLAB_CLASS_COUNT];
+  SlabPage* full;
+  SlabPage* empty;        // recycled pages which are still committed
+  uint32_t empty_size;
+  _Atomic(void*) remote;  // slots freed by other threads
+};
+
+MUT_ARRAY_DECL(SlabPages, SlabPage*);
+
+// all multiples of 16
+static const uint32_t slab_class_bytes[SLAB_CLASS_COUNT] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 288, 320, 384, 448, 512
+};
+
+// index is 16-byte unit count
+static const uint8_t slab_class_of_units[SLAB_MAX_BYTES / 16 + 1] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+  12, 12, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15, 16, 16, 16, 16
+};
+
+#pragma mark ### region (shared by all slabs)
+
+static _Atomic(char*) slab_region_base;
+static _Atomic(uint64_t) slab_region_used;
+
+// pages given back by slab_cleanup or beyond retain limit, memory already returned to OS
+static struct SlabPages slab_released_pages;
+static atomic_flag slab_released_lock = ATOMIC_FLAG_INIT;
+
+static void _slab_lock(atomic_flag* lock) {
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+  }
+}
+
+static void _slab_unlock(atomic_flag* lock) {
+  atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+static char* _slab_region() {
+  char* base = atomic_load_explicit(&slab_region_base, memory_order_acquire);
+  if (base) {
+    return base;
+  }
+
+  // reserve address space only, pages are committed when carved
+  char* reserved = mmap(NULL, SLAB_REGION_BYTES + SLAB_PAGE_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    return NULL;
+  }
+  char* aligned = (char*)(((uintptr_t)reserved + SLAB_PAGE_BYTES - 1) & ~(SLAB_PAGE_BYTES - 1));
+
+  char* expected = NULL;
+  if (atomic_compare_exchange_strong(&slab_region_base, &expected, aligned)) {
+    SlabPages.init(&slab_released_pages, 0);
+    return aligned;
+  } else {
+    munmap(reserved, SLAB_REGION_BYTES + SLAB_PAGE_BYTES);
+    return expected;
+  }
+}
+
+static bool slab_contains(void* p) {
+  uintptr_t base = (uintptr_t)atomic_load_explicit(&slab_region_base, memory_order_relaxed);
+  return base && (uintptr_t)p - base < SLAB_REGION_BYTES;
+}
+
+static SlabPage* _slab_page_carve() {
+  char* base = _slab_region();
+  if (!base) {
+    return NULL;
+  }
+  uint64_t offset = atomic_fetch_add(&slab_region_used, SLAB_PAGE_BYTES);
+  if (offset + SLAB_PAGE_BYTES > SLAB_REGION_BYTES) {
+    return NULL;
+  }
+  char* page = base + offset;
+  if (mprotect(page, SLAB_PAGE_BYTES, PROT_READ | PROT_WRITE)) {
+    return NULL;
+  }
+  return (SlabPage*)page;
+}
+
+static SlabPage* _slab_page_take_released() {
+  SlabPage* page = NULL;
+  _slab_lock(&slab_released_lock);
+  if (SlabPages.size(&slab_released_pages)) {
+    page = SlabPages.pop(&slab_released_pages);
+  }
+  _slab_unlock(&slab_released_lock);
+  return page;
+}
+
+static void _slab_page_release(SlabPage* page) {
+  madvise(page, SLAB_PAGE_BYTES, MADV_DONTNEED);
+  _slab_lock(&slab_released_lock);
+  SlabPages.push(&slab_released_pages, page);
+  _slab_unlock(&slab_released_lock);
+}
+
+#pragma mark ### orphan pages (shared by all slabs)
+
+// pages with live slots left by slab_cleanup, guarded by slab_orphans_lock.
+// its remote list collects slots freed to orphan pages
+static Slab slab_orphans;
+static atomic_flag slab_orphans_lock = ATOMIC_FLAG_INIT;
+static _Atomic(uint32_t) slab_orphan_pages;
+
+static void _slab_page_set_owner(SlabPage* page, Slab* owner) {
+  _slab_lock(&page->lock);
+  atomic_store_explicit(&page->owner, owner, memory_order_relaxed);
+  _slab_unlock(&page->lock);
+}
+
+// push a slot to the remote list of the page owner
+static void _slab_free_remote(SlabPage* page, void* p) {
+  _slab_lock(&page->lock);
+  Slab* owner = atomic_load_explicit(&page->owner, memory_order_relaxed);
+  void* head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+  do {
+    *(void**)p = head;
+  } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, p, memory_order_release, memory_order_relaxed));
+  _slab_unlock(&page->lock);
+}
+
+#pragma mark ### page lists
+
+static void _slab_list_unlink(SlabPage** head, SlabPage* page) {
+  if (page->prev) {
+    page->prev->next = page->next;
+  } else {
+    *head = page->next;
+  }
+  if (page->next) {
+    page->next->prev = page->prev;
+  }
+  page->prev = NULL;
+  page->next = NULL;
+}
+
+static void _slab_list_link(SlabPage** head, SlabPage* page) {
+  page->prev = NULL;
+  page->next = *head;
+  if (*head) {
+    (*head)->prev = page;
+  }
+  *head = page;
+}
+
+static SlabPage* _slab_page_new(Slab* slab, uint32_t klass) {
+  SlabPage* page = slab->empty;
+  if (page) {
+    slab->empty = page->next;
+    slab->empty_size--;
+  } else {
+    page = _slab_page_take_released();
+    if (!page) {
+      page = _slab_page_carve();
+      if (!page) {
+        return NULL;
+      }
+    }
+  }
+
+  atomic_flag_clear(&page->lock);
+  atomic_store_explicit(&page->owner, slab, memory_order_relaxed);
+  page->free_list = NULL;
+  page->klass = klass;
+  page->slot_bytes = slab_class_bytes[klass];
+  page->live = 0;
+  page->bump = SLAB_PAGE_HEADER_BYTES;
+  page->state = SLAB_PAGE_PARTIAL;
+  _slab_list_link(&slab->classes[klass].partial, page);
+  return page;
+}
+
+static void _slab_page_recycle(Slab* slab, SlabPage* page) {
+  _slab_list_unlink(&slab->classes[page->klass].partial, page);
+  page->state = SLAB_PAGE_EMPTY;
+  if (slab == &slab_orphans) {
+    atomic_fetch_sub_explicit(&slab_orphan_pages, 1, memory_order_relaxed);
+    _slab_page_release(page);
+  } else if (slab->empty_size < SLAB_RETAIN_PAGES) {
+    page->next = slab->empty;
+    slab->empty = page;
+    slab->empty_size++;
+  } else {
+    _slab_page_release(page);
+  }
+}
+
+// give a slot back to its page
+static void _slab_slot_release(Slab* slab, void* p) {
+  SlabPage* page = SLAB_PAGE_OF(p);
+  assert(atomic_load_explicit(&page->owner, memory_order_relaxed) == slab);
+  *(void**)p = page->free_list;
+  page->free_list = p;
+  page->live--;
+
+  if (page->state == SLAB_PAGE_FULL) {
+    _slab_list_unlink(&slab->full, page);
+    _slab_list_link(&slab->classes[page->klass].partial, page);
+    page->state = SLAB_PAGE_PARTIAL;
+  }
+  if (page->live == 0) {
+    _slab_page_recycle(slab, page);
+  }
+}
+
+#pragma mark ### alloc / free
+
+static void _slab_drain_remote(Slab* slab) {
+  void* p = atomic_exchange_explicit(&slab->remote, NULL, memory_order_acquire);
+  while (p) {
+    void* next = *(void**)p;
+    _slab_slot_release(slab, p);
+    p = next;
+  }
+}
+
+// prereq: slab_orphans_lock is held
+static void _slab_orphans_drain() {
+  void* p = atomic_exchange_explicit(&slab_orphans.remote, NULL, memory_order_acquire);
+  while (p) {
+    void* next = *(void**)p;
+    SlabPage* page = SLAB_PAGE_OF(p);
+    if (atomic_load_explicit(&page->owner, memory_order_relaxed) == &slab_orphans) {
+      _slab_slot_release(&slab_orphans, p);
+    } else {
+      // the page is adopted after the slot is pushed, the new owner can't be cleaned up while the lock is held
+      _slab_free_remote(page, p);
+    }
+    p = next;
+  }
+}
+
+// take a partial orphan page of the size class, NULL if there is none
+static SlabPage* _slab_page_adopt(Slab* slab, uint32_t klass) {
+  if (!atomic_load_explicit(&slab_orphan_pages, memory_order_relaxed)) {
+    return NULL;
+  }
+
+  _slab_lock(&slab_orphans_lock);
+  _slab_orphans_drain();
+  SlabPage* page = slab_orphans.classes[klass].partial;
+  if (page) {
+    _slab_list_unlink(&slab_orphans.classes[klass].partial, page);
+    _slab_page_set_owner(page, slab);
+    atomic_fetch_sub_explicit(&slab_orphan_pages, 1, memory_order_relaxed);
+  }
+  _slab_unlock(&slab_orphans_lock);
+
+  if (page) {
+    _slab_list_link(&slab->classes[klass].partial, page);
+  }
+  return page;
+}
+
+// fill half of the magazine from pages, returns one slot
+static void* _slab_refill(Slab* slab, uint32_t klass) {
+  if (atomic_load_explicit(&slab->remote, memory_order_relaxed)) {
+    _slab_drain_remote(slab);
+  }
+
+  SlabClass* sc = slab->classes + klass;
+  while (sc->size < SLAB_MAGAZINE_CAP / 2) {
+    SlabPage* page = sc->partial;
+    if (!page) {
+      page = _slab_page_adopt(slab, klass);
+    }
+    if (!page) {
+      page = _slab_page_new(slab, klass);
+      if (!page) {
+        break;
+      }
+    }
+
+    while (sc->size < SLAB_MAGAZINE_CAP / 2) {
+      void* p;
+      if (page->free_list) {
+        p = page->free_list;
+        page->free_list = *(void**)p;
+      } else if (page->bump + page->slot_bytes <= SLAB_PAGE_BYTES) {
+        p = (char*)page + page->bump;
+        page->bump += page->slot_bytes;
+      } else {
+        break;
+      }
+      page->live++;
+      sc->slots[sc->size++] = p;
+    }
+
+    if (!page->free_list && page->bump + page->slot_bytes > SLAB_PAGE_BYTES) {
+      _slab_list_unlink(&sc->partial, page);
+      _slab_list_link(&slab->full, page);
+      page->state = SLAB_PAGE_FULL;
+    }
+  }
+
+  return sc->size ? sc->slots[--sc->size] : NULL;
+}
+
+static void slab_init(Slab* slab) {
+  memset(slab, 0, sizeof(Slab));
+}
+
+// returns NULL if size is too large or no more page can be carved
+static void* slab_alloc(Slab* slab, size_t size) {
+  if (size > SLAB_MAX_BYTES) {
+    return NULL;
+  }
+  uint32_t klass = slab_class_of_units[(size + 15) / 16];
+  SlabClass* sc = slab->classes + klass;
+  if (sc->size) {
+    return sc->slots[--sc->size];
+  }
+  return _slab_refill(slab, klass);
+}
+
+// usable bytes of a slab slot
+static size_t slab_slot_bytes(void* p) {
+  return SLAB_PAGE_OF(p)->slot_bytes;
+}
+
+// prereq: slab_contains(p)
+static void slab_free(Slab* slab, void* p) {
+  SlabPage* page = SLAB_PAGE_OF(p);
+  if (atomic_load_explicit(&page->owner, memory_order_relaxed) != slab) {
+    _slab_free_remote(page, p);
+    return;
+  }
+
+  SlabClass* sc = slab->classes + page->klass;
+  if (sc->size == SLAB_MAGAZINE_CAP) {
+    // flush the older half of the magazine
+    for (uint32_t i = 0; i < SLAB_MAGAZINE_CAP / 2; i++) {
+      _slab_slot_release(slab, sc->slots[i]);
+    }
+    memmove(sc->slots, sc->slots + SLAB_MAGAZINE_CAP / 2, sizeof(void*) * (SLAB_MAGAZINE_CAP / 2));
+    sc->size = SLAB_MAGAZINE_CAP / 2;
+  }
+  sc->slots[sc->size++] = p;
+}
+
+// move a page list of slab to the orphan list
+// prereq: slab_orphans_lock is held
+static void _slab_orphan_list(SlabPage* page, SlabPage** orphan_head) {
+  while (page) {
+    SlabPage* next = page->next;
+    _slab_page_set_owner(page, &slab_orphans);
+    _slab_list_link(orphan_head, page);
+    atomic_fetch_add_explicit(&slab_orphan_pages, 1, memory_order_relaxed);
+    page = next;
+  }
+}
+
+// empty pages are returned, pages still holding live slots are handed to the orphan list
+static void slab_cleanup(Slab* slab) {
+  for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+    SlabClass* sc = slab->classes + i;
+    for (uint32_t j = 0; j < sc->size; j++) {
+      _slab_slot_release(slab, sc->slots[j]);
+    }
+    sc->size = 0;
+  }
+  _slab_drain_remote(slab);
+
+  _slab_lock(&slab_orphans_lock);
+  for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+    _slab_orphan_list(slab->classes[i].partial, &slab_orphans.classes[i].partial);
+  }
+  _slab_orphan_list(slab->full, &slab_orphans.full);
+  // no more slot can be pushed to slab->remote, the rest go to the orphan pages
+  void* p = atomic_exchange_explicit(&slab->remote, NULL, memory_order_acquire);
+  while (p) {
+    void* next = *(void**)p;
+    _slab_slot_release(&slab_orphans, p);
+    p = next;
+  }
+  _slab_unlock(&slab_orphans_lock);
+
+  for (SlabPage* page = slab->empty; page;) {
+    SlabPage* next = page->next;
+    _slab_page_release(page);
+    page = next;
+  }
+  memset(slab, 0, sizeof(Slab));
+}
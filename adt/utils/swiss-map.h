@@ -0,0 +1,241 @@
+#pragma once
+
+// Open addressing alternative of utils/mut-map.h, with the same interface,
+// so a map can be switched by replacing MUT_MAP_DECL with SWISS_MAP_DECL
+
+// usage example:
+//   #include "utils/swiss-map.h"
+//   SWISS_MAP_DECL(MyMap, KeyType, ValueType, hash_func, eq_func);
+//   struct MyMap m;
+//   MyMap.init(&m);
+//   MyMap.insert(&m, key, value);
+//   MyMap.cleanup(&m);
+
+// internal:
+//   slots are stored inline in one array (no allocation per entry),
+//   each slot has a control byte: SWISS_MAP_EMPTY, or the top 7 bits of the hash (h2).
+//   a lookup loads 16 control bytes from the home position (hash & mask) and matches h2 in one SSE2 compare,
+//   candidates are compared with eq_func, the search stops at the first group containing an empty slot.
+//   probing is linear (not by aligned groups), so removal shifts later entries back into the hole
+//   (like Knuth's algorithm R) and no tombstone is left.
+//   the first 16 control bytes are mirrored after the end, so a group load never wraps.
+
+// NOTE keys and values are treated as POD, same as mut-map
+// NOTE removal rehashes the keys of the shifted entries
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#pragma mark ### helpers (for internal use only)
+
+#define SWISS_MAP_GROUP 16
+#define SWISS_MAP_EMPTY 0x80
+#define SWISS_MAP_MIN_BITS 4
+
+#define SWISS_MAP_CAP(mm) \
+  (1ULL << (mm)->bits)
+
+#define SWISS_MAP_H2(h) \
+  ((uint8_t)((h) >> 57))
+
+// bit i is set when ctrl[i] == c
+static inline uint32_t SWISS_MAP_MATCH(const uint8_t* ctrl, uint8_t c) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+  uint32_t bits = 0;
+  for (int i = 0; i < SWISS_MAP_GROUP; i++) {
+    bits |= (uint32_t)(ctrl[i] == c) << i;
+  }
+  return bits;
+#endif
+}
+
+static inline void SWISS_MAP_SET_CTRL(uint8_t* ctrl, size_t cap, size_t i, uint8_t c) {
+  ctrl[i] = c;
+  if (i < SWISS_MAP_GROUP) {
+    ctrl[cap + i] = c;
+  }
+}
+
+#pragma mark ### interface
+
+#define SWISS_MAP_DECL(MutMapType, KeyType, ValueType, hash_func, eq_func) \
+  typedef struct { KeyType k; ValueType v; } MutMapType##Slot;\
+  struct MutMapType { size_t size; size_t bits; MutMapType##Slot* slots; uint8_t* ctrl; };\
+  typedef struct { size_t i; struct MutMapType* mm; MutMapType##Slot* slot; } MutMapType##Iter;\
+  \
+  static void MutMapType##_SWISS_MAP_alloc(struct MutMapType* mm, size_t bits) {\
+    size_t cap = 1ULL << bits;\
+    mm->size = 0;\
+    mm->bits = bits;\
+    mm->slots = malloc(sizeof(MutMapType##Slot) * cap + cap + SWISS_MAP_GROUP);\
+    assert(mm->slots);\
+    mm->ctrl = (uint8_t*)(mm->slots + cap);\
+    memset(mm->ctrl, SWISS_MAP_EMPTY, cap + SWISS_MAP_GROUP);\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_init(struct MutMapType* mm) {\
+    MutMapType##_SWISS_MAP_alloc(mm, SWISS_MAP_MIN_BITS);\
+  }\
+  \
+  static size_t MutMapType##_SWISS_MAP_size(struct MutMapType* mm) {\
+    return mm->size;\
+  }\
+  \
+  /* returns the index of k, or the first empty index after its home when not found */\
+  static size_t MutMapType##_SWISS_MAP_probe(struct MutMapType* mm, KeyType k, uint64_t h, bool* found) {\
+    size_t mask = SWISS_MAP_CAP(mm) - 1;\
+    uint8_t h2 = SWISS_MAP_H2(h);\
+    for (size_t pos = h & mask;; pos = (pos + SWISS_MAP_GROUP) & mask) {\
+      uint32_t empties = SWISS_MAP_MATCH(mm->ctrl + pos, SWISS_MAP_EMPTY);\
+      /* entries after the first empty slot can not belong to this probe sequence */\
+      uint32_t matches = SWISS_MAP_MATCH(mm->ctrl + pos, h2) & (empties ? (empties & -empties) - 1 : 0xFFFF);\
+      for (; matches; matches &= matches - 1) {\
+        size_t i = (pos + __builtin_ctz(matches)) & mask;\
+        if (eq_func(k, mm->slots[i].k)) {\
+          *found = true;\
+          return i;\
+        }\
+      }\
+      if (empties) {\
+        *found = false;\
+        return (pos + __builtin_ctz(empties)) & mask;\
+      }\
+    }\
+  }\
+  \
+  static bool MutMapType##_SWISS_MAP_find(struct MutMapType* mm, KeyType k, ValueType* v) {\
+    bool found;\
+    size_t i = MutMapType##_SWISS_MAP_probe(mm, k, hash_func(k), &found);\
+    if (found && v) {\
+      *v = mm->slots[i].v;\
+    }\
+    return found;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_rehash(struct MutMapType* mm, size_t bits);\
+  static void MutMapType##_SWISS_MAP_insert(struct MutMapType* mm, KeyType k, ValueType v) {\
+    if (SWISS_MAP_CAP(mm) * 8 < (mm->size + 1) * 10) { /*factor of 0.8*/\
+      MutMapType##_SWISS_MAP_rehash(mm, mm->bits + 1);\
+    }\
+    \
+    uint64_t h = hash_func(k);\
+    bool found;\
+    size_t i = MutMapType##_SWISS_MAP_probe(mm, k, h, &found);\
+    if (!found) {\
+      SWISS_MAP_SET_CTRL(mm->ctrl, SWISS_MAP_CAP(mm), i, SWISS_MAP_H2(h));\
+      mm->slots[i].k = k;\
+      mm->size++;\
+    }\
+    mm->slots[i].v = v;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_remove(struct MutMapType* mm, KeyType k) {\
+    bool found;\
+    size_t hole = MutMapType##_SWISS_MAP_probe(mm, k, hash_func(k), &found);\
+    if (!found) {\
+      return;\
+    }\
+    \
+    size_t cap = SWISS_MAP_CAP(mm);\
+    size_t mask = cap - 1;\
+    for (size_t j = (hole + 1) & mask; mm->ctrl[j] != SWISS_MAP_EMPTY; j = (j + 1) & mask) {\
+      /* the entry at j can move back to the hole if its home is not in (hole, j] */\
+      size_t home = hash_func(mm->slots[j].k) & mask;\
+      if (((j - home) & mask) >= ((j - hole) & mask)) {\
+        mm->slots[hole] = mm->slots[j];\
+        SWISS_MAP_SET_CTRL(mm->ctrl, cap, hole, mm->ctrl[j]);\
+        hole = j;\
+      }\
+    }\
+    SWISS_MAP_SET_CTRL(mm->ctrl, cap, hole, SWISS_MAP_EMPTY);\
+    mm->size--;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_cleanup(struct MutMapType* mm) {\
+    free(mm->slots);\
+    mm->slots = NULL;\
+    mm->ctrl = NULL;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_iter_seek(MutMapType##Iter* it) {\
+    size_t cap = SWISS_MAP_CAP(it->mm);\
+    for (; it->i < cap; it->i++) {\
+      if (it->mm->ctrl[it->i] != SWISS_MAP_EMPTY) {\
+        it->slot = it->mm->slots + it->i;\
+        return;\
+      }\
+    }\
+    it->slot = NULL;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_iter_init(MutMapType##Iter* it, struct MutMapType* mm) {\
+    it->i = 0;\
+    it->mm = mm;\
+    MutMapType##_SWISS_MAP_iter_seek(it);\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_iter_next(MutMapType##Iter* it) {\
+    it->i++;\
+    MutMapType##_SWISS_MAP_iter_seek(it);\
+  }\
+  \
+  static bool MutMapType##_SWISS_MAP_iter_is_end(MutMapType##Iter* it) {\
+    return it->slot == NULL;\
+  }\
+  \
+  static void MutMapType##_SWISS_MAP_rehash(struct MutMapType* mm, size_t bits) {\
+    struct MutMapType new_mm;\
+    MutMapType##_SWISS_MAP_alloc(&new_mm, bits);\
+    size_t cap = SWISS_MAP_CAP(mm);\
+    size_t new_mask = SWISS_MAP_CAP(&new_mm) - 1;\
+    for (size_t i = 0; i < cap; i++) {\
+      if (mm->ctrl[i] == SWISS_MAP_EMPTY) {\
+        continue;\
+      }\
+      /* keys are distinct, just take the first empty slot */\
+      uint64_t h = hash_func(mm->slots[i].k);\
+      size_t j = h & new_mask;\
+      while (new_mm.ctrl[j] != SWISS_MAP_EMPTY) {\
+        j = (j + 1) & new_mask;\
+      }\
+      SWISS_MAP_SET_CTRL(new_mm.ctrl, new_mask + 1, j, SWISS_MAP_H2(h));\
+      new_mm.slots[j] = mm->slots[i];\
+      new_mm.size++;\
+    }\
+    MutMapType##_SWISS_MAP_cleanup(mm);\
+    *mm = new_mm;\
+  }\
+  \
+  static struct {\
+    void (*init)(struct MutMapType* mm);\
+    size_t (*size)(struct MutMapType* mm);\
+    bool (*find)(struct MutMapType* mm, KeyType k, ValueType* v);\
+    void (*rehash)(struct MutMapType* mm, size_t bits);\
+    void (*insert)(struct MutMapType* mm, KeyType k, ValueType v);\
+    void (*remove)(struct MutMapType* mm, KeyType k);\
+    void (*cleanup)(struct MutMapType* mm);\
+    void (*iter_init)(MutMapType##Iter* it, struct MutMapType* mm);\
+    void (*iter_next)(MutMapType##Iter* it);\
+    bool (*iter_is_end)(MutMapType##Iter* it);\
+  } const MutMapType = {\
+    .init = MutMapType##_SWISS_MAP_init,\
+    .size = MutMapType##_SWISS_MAP_size,\
+    .find = MutMapType##_SWISS_MAP_find,\
+    .rehash = MutMapType##_SWISS_MAP_rehash,\
+    .insert = MutMapType##_SWISS_MAP_insert,\
+    .remove = MutMapType##_SWISS_MAP_remove,\
+    .cleanup = MutMapType##_SWISS_MAP_cleanup,\
+    .iter_init = MutMapType##_SWISS_MAP_iter_init,\
+    .iter_next = MutMapType##_SWISS_MAP_iter_next,\
+    .iter_is_end = MutMapType##_SWISS_MAP_iter_is_end\
+  };
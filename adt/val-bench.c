@@ -0,0 +1,362 @@
+#include "val.h"
+#include "box.h"
+#include "cons.h"
+#include "string.h"
+#include "sym-table.h"
+#include "double.h"
+#include "utils/bench.h"
+#include <string.h>
+#include <stdlib.h>
+#include <tinycthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPS 10000000
+#define MAX_THREADS 4
+
+static int _retain_release(void* arg) {
+  Val v = (Val)arg;
+  for (int i = 0; i < OPS; i++) {
+    RETAIN(v);
+    RELEASE(v);
+  }
+  return 0;
+}
+
+// every thread works on an object allocated by itself
+static int _retain_release_own(void* arg) {
+  Val v = nb_box_new(0);
+  _retain_release((void*)v);
+  RELEASE(v);
+  return 0;
+}
+
+static void _run_threads(int n, thrd_start_t func, void* arg) {
+  thrd_t threads[MAX_THREADS];
+  for (int i = 0; i < n; i++) {
+    thrd_create(threads + i, func, arg);
+  }
+  for (int i = 0; i < n; i++) {
+    thrd_join(threads[i], NULL);
+  }
+}
+
+// lexer-like interning: mostly known token names, sometimes a new literal
+#define INTERN_OPS 1000000
+#define INTERN_VOCABULARY 1024
+static atomic_int intern_thread_seq;
+
+static int _intern_literals(void* arg) {
+  int seq = atomic_fetch_add(&intern_thread_seq, 1);
+  char buf[32];
+  uint64_t sum = 0;
+  for (int i = 0; i < INTERN_OPS; i++) {
+    int size;
+    if (i % 16) {
+      size = snprintf(buf, sizeof(buf), "token-%d", i % INTERN_VOCABULARY);
+    } else {
+      size = snprintf(buf, sizeof(buf), "literal-%d-%d", seq, i);
+    }
+    sum += val_strlit_new(size, buf);
+  }
+  *(volatile uint64_t*)arg = sum;
+  return 0;
+}
+
+// rebuilding the literal table by interning vs mapping it from an image
+static void _literal_table_startup() {
+  char path[] = "/tmp/nb-image-XXXXXX";
+  int fd = mkstemp(path);
+  if (!val_image_dump(path)) {
+    printf("  image dump failed\n");
+    return;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  void* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  unlink(path);
+  // the literal table follows a 24-byte header
+  NbSymTable* mapped = nb_sym_table_new_mapped((char*)image + 24, st.st_size - 24);
+  size_t n = nb_sym_table_size(mapped);
+
+  char name[64];
+  snprintf(name, sizeof(name), "literal table of %zu strings (interning)", n);
+  bench_run(name, 3) {
+    for (int r = 0; r < 3; r++) {
+      NbSymTable* t = nb_sym_table_new();
+      for (size_t i = 0; i < n; i++) {
+        size_t size;
+        char* s;
+        nb_sym_table_reverse_get(mapped, &size, &s, i);
+        nb_sym_table_get_set(t, size, s, NULL);
+      }
+      nb_sym_table_delete(t);
+    }
+  }
+  snprintf(name, sizeof(name), "literal table of %zu strings (image)", n);
+  bench_run(name, 1000) {
+    for (int r = 0; r < 1000; r++) {
+      nb_sym_table_delete(nb_sym_table_new_mapped((char*)image + 24, st.st_size - 24));
+    }
+  }
+  nb_sym_table_delete(mapped);
+  munmap(image, st.st_size);
+}
+
+#define LIST_SIZE 1000000
+
+static Val _box_list(int n) {
+  Val list = VAL_NIL;
+  for (int i = 0; i < n; i++) {
+    Val box = nb_box_new(i);
+    REPLACE(list, nb_cons_new(box, list));
+    RELEASE(box);
+  }
+  return list;
+}
+
+// release a long list, with budget the work is spread over later releases
+static void _release_list(size_t budget) {
+  Val list = _box_list(LIST_SIZE);
+  val_set_release_budget(budget);
+  uint64_t max_pause = 0;
+  uint64_t calls = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "release 1M-cons list (budget %zu)", budget);
+  bench_run(name, LIST_SIZE * 2) {
+    Val v = list;
+    do {
+      uint64_t t = bench_now_ns();
+      RELEASE(v);
+      t = bench_now_ns() - t;
+      if (t > max_pause) {
+        max_pause = t;
+      }
+      calls++;
+      v = nb_box_new(0);
+    } while (val_release_pending());
+    RELEASE(v);
+  }
+  printf("    %lu releases, max pause %.1f us\n", (unsigned long)calls, max_pause / 1000.0);
+  val_set_release_budget(0);
+}
+
+static ValPair _meth(Val self) {
+  return (ValPair){self, VAL_NIL};
+}
+
+// the method is defined in the root of an include chain of depth
+// (names are built in a buffer, nb_string_new_literal_c() is const and would be folded)
+static void _send_through_includes(int depth) {
+  char name[64];
+  snprintf(name, sizeof(name), "SendBench%d_0", depth);
+  uint32_t klass = klass_def(VAL_FROM_STR(val_strlit_new_c(name)), 0);
+  uint32_t method_id = val_strlit_new_c("bench_meth");
+  klass_def_method(klass, method_id, 0, _meth, false);
+  for (int i = 1; i <= depth; i++) {
+    snprintf(name, sizeof(name), "SendBench%d_%d", depth, i);
+    uint32_t k = klass_def(VAL_FROM_STR(val_strlit_new_c(name)), 0);
+    klass_include(k, klass);
+    klass = k;
+  }
+
+  Val obj = (Val)val_alloc(klass, sizeof(ValHeader));
+  snprintf(name, sizeof(name), "val_send (include depth %d)", depth);
+  bench_run(name, OPS) {
+    for (int i = 0; i < OPS; i++) {
+      val_send(obj, method_id, 0, NULL);
+    }
+  }
+  val_free((void*)obj);
+}
+
+static ValPair _meth3(Val self, Val a, Val b, Val c) {
+  return (ValPair){self + a + b + c, VAL_NIL};
+}
+
+static ValPair _meth6(Val self, Val a, Val b, Val c, Val d, Val e, Val f) {
+  return (ValPair){self + a + b + c + d + e + f, VAL_NIL};
+}
+
+// the method is called through its arity thunk, val_c_call2 is the generic call it replaces
+static void _dispatch_by_arity(int argc, ValMethodFunc func) {
+  char name[64];
+  snprintf(name, sizeof(name), "DispatchBench%d", argc);
+  uint32_t klass = klass_def(VAL_FROM_STR(val_strlit_new_c(name)), 0);
+  uint32_t method_id = val_strlit_new_c("bench_meth");
+  klass_def_method(klass, method_id, argc, func, false);
+  Val obj = (Val)val_alloc(klass, sizeof(ValHeader));
+  Val argv[] = {1, 2, 3, 4, 5, 6};
+  void* m = klass_find_method(klass, method_id);
+
+  snprintf(name, sizeof(name), "klass_call_method (arity %d)", argc);
+  bench_run(name, OPS) {
+    for (int i = 0; i < OPS; i++) {
+      klass_call_method(obj, m, argc, argv);
+    }
+  }
+  snprintf(name, sizeof(name), "val_c_call2 (arity %d)", argc);
+  bench_run(name, OPS) {
+    for (int i = 0; i < OPS; i++) {
+      val_c_call2(obj, (void*)func, argc, argv);
+    }
+  }
+  val_free((void*)obj);
+}
+
+// 5 byte strings are packed into the value, 12 byte strings are allocated
+static void _short_strings(size_t size) {
+  const char* text = "identifier_x";
+  char name[64];
+  snprintf(name, sizeof(name), "nb_string_new + val_hash + RELEASE (%zu bytes)", size);
+  bench_run(name, OPS) {
+    for (int i = 0; i < OPS; i++) {
+      Val s = nb_string_new(size, text);
+      val_hash(s);
+      RELEASE(s);
+    }
+  }
+}
+
+// a running value in [lo, 2 * lo), values in [2, 4) are immediate, values in [0.5, 1) are boxed
+static void _double_arith(double lo, const char* name) {
+  bench_run(name, OPS) {
+    Val x = nb_double_new(lo);
+    for (int i = 0; i < OPS; i++) {
+      double d = nb_double_get(x) * 1.25;
+      REPLACE(x, nb_double_new(d < lo * 2 ? d : d - lo));
+    }
+    RELEASE(x);
+  }
+}
+
+void val_bench() {
+  Val v = nb_box_new(0);
+
+  bench_run("retain/release (owner)", OPS) {
+    _retain_release((void*)v);
+  }
+
+  for (int n = 1; n <= MAX_THREADS; n *= 2) {
+    char name[64];
+    snprintf(name, sizeof(name), "retain/release (own objects, %d threads)", n);
+    bench_run(name, (uint64_t)OPS * n) {
+      _run_threads(n, _retain_release_own, NULL);
+    }
+  }
+
+  // refs beyond VAL_MAX_EMBED_RC are counted in the overflow table
+  Val hot = nb_box_new(0);
+  for (int i = 0; i < VAL_MAX_EMBED_RC + 10; i++) {
+    RETAIN(hot);
+  }
+  bench_run("retain/release (overflowed rc)", OPS) {
+    _retain_release((void*)hot);
+  }
+  for (int i = 0; i < VAL_MAX_EMBED_RC + 10; i++) {
+    RELEASE(hot);
+  }
+  RELEASE(hot);
+
+  // with -DNB_ALLOC_PROFILE, the profiler hooks are included
+  bench_run("nb_box_new + release", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      RELEASE(nb_box_new(i));
+    }
+  }
+
+  // string and token take the inline path, box goes through the klass function table
+  Val s = nb_string_new_literal_c("hash bench");
+  Val b1 = nb_box_new(3);
+  Val b2 = nb_box_new(3);
+  volatile uint64_t sink = 0;
+  bench_run("val_hash (literal string)", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      sink += val_hash(s);
+    }
+  }
+  bench_run("val_hash (box)", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      sink += val_hash(b1);
+    }
+  }
+  bench_run("val_eq (box)", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      sink += val_eq(b1, b2);
+    }
+  }
+  RELEASE(b1);
+  RELEASE(b2);
+
+  char text[1024];
+  memset(text, 'x', sizeof(text));
+  bench_run("val_hash_mem (1KB)", OPS / 100) {
+    for (int i = 0; i < OPS / 100; i++) {
+      sink += val_hash_mem(text, sizeof(text));
+    }
+  }
+  const void* texts[4] = {text, text, text, text};
+  size_t text_sizes[4] = {sizeof(text), sizeof(text), sizeof(text), sizeof(text)};
+  uint64_t text_hashes[4];
+  bench_run("val_hash_mem_many (1KB, per key)", OPS / 100) {
+    for (int i = 0; i < OPS / 100; i += 4) {
+      val_hash_mem_many(4, texts, text_sizes, text_hashes);
+      sink += text_hashes[0];
+    }
+  }
+
+  // internal tables
+  Val box_name = nb_string_new_literal_c("Box");
+  bench_run("klass_find", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      sink += klass_find(box_name, 0);
+    }
+  }
+  bench_run("val_strlit_new_c (existing)", OPS) {
+    for (int i = 0; i < OPS; i++) {
+      sink += val_strlit_new_c("retain/release");
+    }
+  }
+  for (int n = 1; n <= MAX_THREADS; n *= 2) {
+    char name[64];
+    snprintf(name, sizeof(name), "val_strlit_new (1/16 new, %d threads)", n);
+    uint64_t intern_sink;
+    bench_run(name, (uint64_t)INTERN_OPS * n) {
+      _run_threads(n, _intern_literals, &intern_sink);
+    }
+  }
+  _literal_table_startup();
+
+  _send_through_includes(0);
+  _send_through_includes(4);
+  _send_through_includes(16);
+
+  _double_arith(2.0, "double arith (immediate)");
+  _double_arith(0.5, "double arith (boxed)");
+
+  _short_strings(5);
+  _short_strings(12);
+
+  _dispatch_by_arity(0, _meth);
+  _dispatch_by_arity(3, _meth3);
+  _dispatch_by_arity(6, _meth6);
+
+  _release_list(0);
+  _release_list(1000);
+
+#ifdef NB_RC_BIASED
+  for (int n = 1; n <= MAX_THREADS; n *= 2) {
+    char name[64];
+    snprintf(name, sizeof(name), "retain/release (shared object, %d threads)", n);
+    bench_run(name, (uint64_t)OPS * n) {
+      _run_threads(n, _retain_release, (void*)v);
+    }
+  }
+#endif
+
+  RELEASE(v);
+}
@@ -1,6 +1,29 @@
 #include "val.h"
+#include "box.h"
+#include "array.h"
+#include "map.h"
+#include "cons.h"
+#include "dict.h"
+#include "string.h"
+#include "sym-table.h"
+#include "klass.h"
+#include <string.h>
 #include <ccut.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <tinycthread.h>
+
+// (box(n - 1) : ... : box(0) : nil)
+static Val _box_list(int n) {
+  Val list = VAL_NIL;
+  for (int i = 0; i < n; i++) {
+    Val box = nb_box_new(i);
+    REPLACE(list, nb_cons_new(box, list));
+    RELEASE(box);
+  }
+  return list;
+}
 
 static ValPair f0() {
   return (ValPair){0, 0};
@@ -39,13 +62,125 @@ static ValPair f8(Val a1, Val a2, Val a3, Val a4, Val a5, Val a6, Val a7, Val a8
   return (ValPair){(a1<<1) + (a2<<2) + (a3<<3) + (a4<<4) + (a5<<5) + (a6<<6) + (a7<<7) + (a8<<8), 8};
 }
 
+static ValPair _meth_a(Val self) {
+  return (ValPair){VAL_FROM_INT(1), VAL_NIL};
+}
+
+static ValPair _meth_b(Val self) {
+  return (ValPair){VAL_FROM_INT(2), VAL_NIL};
+}
+
+static ValPair _meth_eq_true(Val self, Val other) {
+  return (ValPair){VAL_TRUE, VAL_NIL};
+}
+
+static uint64_t _hash_7(Val v) {
+  return 7;
+}
+
+static Val _send_int(Val obj, const char* method) {
+  ValPair res = val_send(obj, val_strlit_new_c(method), 0, NULL);
+  return res.snd ? VAL_NIL : res.fst;
+}
+
+// allocates 100 boxes in gen 0 and 100 in a new gen, returns max gen after detach
+static int _alloc_and_detach_in_thread(void* arg) {
+  Val* boxes = arg;
+  for (int i = 0; i < 100; i++) {
+    boxes[i] = nb_box_new(i);
+  }
+  val_gens_set_current(val_gens_new_gen());
+  for (int i = 0; i < 100; i++) {
+    nb_box_new(i);
+  }
+  val_gens_set_current(0);
+  val_thread_detach();
+  return val_gens_max_gen();
+}
+
+#ifdef NB_ALLOC_PROFILE
+// allocates and frees 1000 boxes, keeps 10 of them
+static int _alloc_boxes_in_thread(void* arg) {
+  Val* kept = arg;
+  for (int i = 0; i < 1000; i++) {
+    Val b = nb_box_new(i);
+    if (i % 100 == 0) {
+      kept[i / 100] = b;
+    } else {
+      RELEASE(b);
+    }
+  }
+  return 0;
+}
+#endif
+
+#ifdef NB_RC_BIASED
+static int _retain_release_in_thread(void* arg) {
+  Val v = (Val)arg;
+  for (int i = 0; i < 1000; i++) {
+    RETAIN(v);
+  }
+  for (int i = 0; i < 1000; i++) {
+    RELEASE(v);
+  }
+  return 0;
+}
+
+static int _retain_in_thread(void* arg) {
+  RETAIN((Val)arg);
+  return 0;
+}
+
+static int _release_in_thread(void* arg) {
+  RELEASE((Val)arg);
+  return 0;
+}
+
+// replaces the string in arg with a slice owned by this thread, then the thread exits
+static int _slice_in_thread(void* arg) {
+  Val* v = arg;
+  *v = nb_string_slice(*v, 1, 20);
+  return 0;
+}
+#endif
+
+static bool _str_is(Val s, const char* expected) {
+  return nb_string_byte_size(s) == strlen(expected) && !strncmp(NB_STRING_BYTES(s), expected, strlen(expected));
+}
+
+// [array, map, list, dict, shared], elements are "s0".."s(n-1)", shared is also the last element of array
+static Val _build_evacuee(int n) {
+  Val shared = nb_string_new_c("shared");
+  Val arr = nb_array_new_empty();
+  Val map = nb_map_new();
+  Val list = VAL_NIL;
+  Val dict = nb_dict_new();
+  for (int i = 0; i < n; i++) {
+    char buf[16];
+    char k[16];
+    Val s = nb_string_new(sprintf(buf, "s%d", i), buf);
+    int ksize = sprintf(k, "k%04d", i);
+    REPLACE(arr, nb_array_append(arr, s));
+    REPLACE(map, nb_map_insert(map, VAL_FROM_INT(i), s));
+    REPLACE(list, nb_cons_new(s, list));
+    REPLACE(dict, nb_dict_insert(dict, k, ksize, s));
+    RELEASE(s);
+  }
+  REPLACE(arr, nb_array_append(arr, shared));
+  return nb_array_new(5, arr, map, list, dict, shared);
+}
+
 void val_suite() {
   ccut_test("rotl and rotr") {
     assert_eq(1239, NB_ROTR(NB_ROTL(1239, 3), 3));
   }
 
   ccut_test("header size") {
+#ifdef NB_RC_BIASED
+    assert_eq(sizeof(uint64_t) * 2, sizeof(ValHeader));
+#else
     assert_eq(sizeof(uint64_t), sizeof(ValHeader));
+#endif
   }
 
   ccut_test("from and to dbl") {
@@ -72,6 +207,43 @@ void val_suite() {
     assert_eq(3, VAL_TO_STR(VAL_FROM_STR(3)));
   }
 
+  ccut_test("well-known symbols") {
+    assert_eq(VAL_SYM_EQ, val_strlit_new_c("=="));
+    assert_eq(VAL_SYM_HASH, val_strlit_new_c("hash"));
+    assert_eq(VAL_SYM_MAIN, val_strlit_new_c("Main"));
+    assert_eq(4, val_strlit_byte_size(VAL_SYM_TO_S));
+    assert_true(strncmp("token", val_strlit_ptr(VAL_SYM_TOKEN), 5) == 0, "should be token");
+  }
+
+  ccut_test("startup image") {
+    uint32_t lit = val_strlit_new_c("in startup image");
+    char path[] = "/tmp/nb-image-XXXXXX";
+    close(mkstemp(path));
+    assert_true(val_image_dump(path), "should dump image");
+
+    // what init does with NB_IMAGE
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+    char* image = malloc(size);
+    assert_eq(1, fread(image, size, 1, f));
+    fclose(f);
+    unlink(path);
+    assert_mem_eq("NBIMAGE", image, 8);
+
+    // the literal table follows a 24-byte header
+    NbSymTable* table = nb_sym_table_new_mapped(image + 24, size - 24);
+    assert_true(table, "should map the literal table");
+    uint64_t id;
+    assert_true(nb_sym_table_get(table, strlen("Main"), "Main", &id), "should have well-known symbols");
+    assert_eq(VAL_SYM_MAIN, id);
+    assert_true(nb_sym_table_get(table, strlen("in startup image"), "in startup image", &id), "should have interned literals");
+    assert_eq(lit, id);
+    nb_sym_table_delete(table);
+    free(image);
+  }
+
   ccut_test("immediate value test") {
     assert_true(VAL_IS_IMM(VAL_FROM_INT(-12)), "should be immediate value");
     assert_true(VAL_IS_IMM(VAL_FROM_DBL(123.2)), "should be immediate value");
@@ -113,6 +285,368 @@ void val_suite() {
     val_free(h);
   }
 
+#ifdef NB_RC_BIASED
+  ccut_test("biased retain/release from other threads") {
+    Val v = nb_box_new(3);
+    ValHeader* h = (ValHeader*)v;
+    thrd_t threads[4];
+    for (int i = 0; i < 4; i++) {
+      thrd_create(threads + i, _retain_release_in_thread, h);
+    }
+    for (int i = 0; i < 4; i++) {
+      thrd_join(threads[i], NULL);
+    }
+    assert_eq(1, VAL_REF_COUNT(v));
+
+    // owner releases first, the other thread frees
+    thrd_t t;
+    thrd_create(&t, _retain_in_thread, h);
+    thrd_join(t, NULL);
+    assert_eq(2, VAL_REF_COUNT(v));
+    RELEASE(v);
+    assert_eq(1, VAL_REF_COUNT(v));
+    assert_eq(VAL_RC_MERGED, h->shared_rc & VAL_RC_MERGED);
+    thrd_create(&t, _release_in_thread, h);
+    thrd_join(t, NULL);
+  }
+
+  ccut_test("biased release of references counted by the owner") {
+    Val s = nb_string_new_c("a string long enough to be sliced");
+    Val t = nb_string_slice(s, 1, 20);
+    assert_eq(2, VAL_REF_COUNT(s));
+
+    // owner retains, the other thread releases
+    RETAIN(t);
+    thrd_t th;
+    thrd_create(&th, _release_in_thread, (void*)t);
+    thrd_join(th, NULL);
+    assert_eq(1, VAL_REF_COUNT(t));
+    RELEASE(t);
+    assert_eq(1, VAL_REF_COUNT(s));
+
+    // the owner thread returns a value and exits
+    Val r = s;
+    thrd_create(&th, _slice_in_thread, &r);
+    thrd_join(th, NULL);
+    assert_eq(2, VAL_REF_COUNT(s));
+    RELEASE(r);
+    assert_eq(1, VAL_REF_COUNT(s));
+    RELEASE(s);
+  }
+#endif
+
+  ccut_test("thread detach keeps gen 0 objects") {
+    Val boxes[100];
+    int max_gen;
+    thrd_t t;
+    thrd_create(&t, _alloc_and_detach_in_thread, boxes);
+    thrd_join(t, &max_gen);
+    assert_eq(0, max_gen);
+
+    // slots of the detached thread are not handed out again
+    Val others[100];
+    for (int i = 0; i < 100; i++) {
+      others[i] = nb_box_new(-1);
+    }
+    for (int i = 0; i < 100; i++) {
+      assert_eq(i, nb_box_get(boxes[i]));
+      nb_box_delete(boxes[i]);
+      nb_box_delete(others[i]);
+    }
+  }
+
+  ccut_test("retain/release beyond embedded rc") {
+    Val v = nb_box_new(3);
+    for (int i = 0; i < VAL_MAX_EMBED_RC + 10; i++) {
+      RETAIN(v);
+    }
+    assert_true(((ValHeader*)v)->rc_overflow, "should overflow");
+    for (int i = 0; i < VAL_MAX_EMBED_RC + 10; i++) {
+      RELEASE(v);
+    }
+    assert_true(!((ValHeader*)v)->rc_overflow, "should be back to embedded rc");
+    assert_eq(1, VAL_REF_COUNT(v));
+    RELEASE(v);
+  }
+
+  ccut_test("release long list without recursion") {
+    Val list = VAL_NIL;
+    for (int i = 0; i < 1000000; i++) {
+      REPLACE(list, nb_cons_new(VAL_FROM_INT(i), list));
+    }
+    RELEASE(list);
+    assert_eq(0, val_release_pending());
+  }
+
+  ccut_test("budgeted release") {
+    val_begin_check_memory();
+    Val list = _box_list(100);
+    val_set_release_budget(10);
+    RELEASE(list);
+    assert_true(val_release_pending() > 0, "should leave objects queued");
+
+    // 200 objects, each release destructs the new box and 9 queued objects
+    int calls = 0;
+    while (val_release_pending() && calls < 100) {
+      RELEASE(nb_box_new(calls));
+      calls++;
+    }
+    assert_eq(0, val_release_pending());
+    assert_true(calls <= 22, "should destruct up to budget per release");
+
+    list = _box_list(2);
+    val_set_release_budget(1);
+    RELEASE(list);
+    assert_true(val_release_pending() > 0, "should leave objects queued");
+    val_release_drain();
+    assert_eq(0, val_release_pending());
+    val_set_release_budget(0);
+    val_end_check_memory();
+  }
+
+#ifdef NB_ALLOC_PROFILE
+  ccut_test("alloc profile") {
+    val_alloc_profile_reset();
+    val_alloc_profile_set_sampling(2);
+    Val boxes[3];
+    for (int i = 0; i < 3; i++) {
+      boxes[i] = nb_box_new(i);
+    }
+    RELEASE(boxes[0]);
+    char buf[100] = {0};
+    Val s = nb_string_new(sizeof(buf), buf);
+    Val a = nb_array_new_empty();
+    for (int i = 0; i < 40; i++) {
+      REPLACE(a, nb_array_append(a, VAL_FROM_INT(i))); // realloc in place
+    }
+    val_alloc_profile_set_sampling(0);
+
+    ValAllocProfile prof;
+    assert_true(val_alloc_profile_snapshot(KLASS_BOX, &prof), "should be enabled");
+    assert_eq(3, prof.allocs);
+    assert_eq(1, prof.frees);
+    assert_eq(2, prof.live_objects);
+    assert_eq(2 * val_byte_size(boxes[1]), prof.live_bytes);
+    assert_eq(3, prof.size_hist[val_byte_size(boxes[1]) <= 16 ? 0 : 1]);
+
+    val_alloc_profile_snapshot(KLASS_STRING, &prof);
+    assert_eq(1, prof.live_objects);
+    assert_eq(val_byte_size(s), prof.live_bytes);
+
+    val_alloc_profile_snapshot(KLASS_ARRAY, &prof);
+    assert_eq(1, prof.live_objects);
+    assert_eq(val_byte_size(a), prof.live_bytes);
+
+    ValAllocSample samples[4];
+    assert_eq(4, val_alloc_profile_samples(samples, 4));
+    assert_true(samples[3].frames > 0, "should capture backtrace");
+
+    RELEASE(boxes[1]);
+    RELEASE(boxes[2]);
+    RELEASE(s);
+    RELEASE(a);
+    val_alloc_profile_snapshot(KLASS_BOX, &prof);
+    assert_eq(0, prof.live_objects);
+    assert_eq(0, prof.live_bytes);
+    val_alloc_profile_reset();
+  }
+
+  ccut_test("alloc profile from threads") {
+    val_alloc_profile_reset();
+    Val kept[4][10];
+    thrd_t threads[4];
+    for (int i = 0; i < 4; i++) {
+      thrd_create(threads + i, _alloc_boxes_in_thread, kept[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+      thrd_join(threads[i], NULL);
+    }
+
+    ValAllocProfile prof;
+    val_alloc_profile_snapshot(KLASS_BOX, &prof);
+    assert_eq(4000, prof.allocs);
+    assert_eq(3960, prof.frees);
+    assert_eq(40, prof.live_objects);
+    assert_eq(40 * val_byte_size(kept[0][0]), prof.live_bytes);
+
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 10; j++) {
+        RELEASE(kept[i][j]);
+      }
+    }
+    val_alloc_profile_snapshot(KLASS_BOX, &prof);
+    assert_eq(0, prof.live_bytes);
+    val_alloc_profile_reset();
+  }
+#else
+  ccut_test("alloc profile compiled out") {
+    ValAllocProfile prof;
+    assert_false(val_alloc_profile_snapshot(KLASS_BOX, &prof), "should be disabled");
+    assert_eq(0, val_alloc_profile_samples(NULL, 0));
+  }
+#endif
+
+  ccut_test("method lookup through includes") {
+    uint32_t base = klass_def(nb_string_new_literal_c("MBase"), 0);
+    uint32_t mid = klass_def(nb_string_new_literal_c("MMid"), 0);
+    uint32_t top = klass_def(nb_string_new_literal_c("MTop"), 0);
+    klass_def_method(base, val_strlit_new_c("a"), 0, _meth_a, false);
+    klass_def_method(base, val_strlit_new_c("b"), 0, _meth_a, false);
+    klass_include(mid, base);
+    klass_include(top, mid);
+    Val obj = (Val)val_alloc(top, sizeof(ValHeader));
+
+    assert_eq(VAL_FROM_INT(1), _send_int(obj, "a"));
+    assert_eq(VAL_FROM_INT(1), _send_int(obj, "b"));
+    assert_eq(VAL_NIL, _send_int(obj, "c"));
+    assert_eq(VAL_FROM_INT(1), _send_int(obj, "a")); // cached
+
+    // defining a method in an included klass invalidates caches
+    klass_def_method(mid, val_strlit_new_c("b"), 0, _meth_b, false);
+    klass_def_method(base, val_strlit_new_c("c"), 0, _meth_b, false);
+    assert_eq(VAL_FROM_INT(1), _send_int(obj, "a"));
+    assert_eq(VAL_FROM_INT(2), _send_int(obj, "b"));
+    assert_eq(VAL_FROM_INT(2), _send_int(obj, "c"));
+
+    // later includes take priority, own methods take priority over includes
+    uint32_t other = klass_def(nb_string_new_literal_c("MOther"), 0);
+    klass_def_method(other, val_strlit_new_c("a"), 0, _meth_b, false);
+    klass_include(top, other);
+    assert_eq(VAL_FROM_INT(2), _send_int(obj, "a"));
+    klass_include(top, mid); // moves mid to the end
+    assert_eq(VAL_FROM_INT(1), _send_int(obj, "a"));
+    klass_def_method(top, val_strlit_new_c("a"), 0, _meth_b, false);
+    assert_eq(VAL_FROM_INT(2), _send_int(obj, "a"));
+    assert_eq(klass_find_method(mid, val_strlit_new_c("b")), klass_find_method(top, val_strlit_new_c("b")));
+
+    val_free((void*)obj);
+  }
+
+  ccut_test("method thunks by arity") {
+    uint32_t k = klass_def(nb_string_new_literal_c("Arities"), 0);
+    Val obj = (Val)val_alloc(k, sizeof(ValHeader));
+    ValMethodFunc funcs[] = {f1, f2, f3, f4, f5, f6, f7, f8};
+    Val argv[] = {2, 3, 4, 5, 6, 7, 8};
+    char name[16];
+    for (int argc = 0; argc < 8; argc++) {
+      snprintf(name, sizeof(name), "arity%d", argc);
+      uint32_t id = val_strlit_new_c(name);
+      klass_def_method(k, id, argc, funcs[argc], false);
+      Method* m = klass_find_method(k, id);
+      assert_eq(argc <= METHOD_THUNK_MAX_ARGC, m->thunk != NULL);
+
+      ValPair ret = val_send(obj, id, argc, argv);
+      assert_eq(val_c_call2(obj, (void*)funcs[argc], argc, argv).fst, ret.fst);
+      assert_eq(argc + 1, ret.snd);
+    }
+    val_free((void*)obj);
+  }
+
+  ccut_test("val_hash_mem_many") {
+    char buf[512];
+    for (int i = 0; i < 512; i++) {
+      buf[i] = (char)(i * 31 + 7);
+    }
+    const void* memories[11];
+    size_t sizes[11];
+    uint64_t hashes[11];
+    for (int i = 0; i < 11; i++) {
+      memories[i] = buf + i * 13;
+      sizes[i] = (i * i * 7) % 300;
+    }
+    val_hash_mem_many(11, memories, sizes, hashes);
+    for (int i = 0; i < 11; i++) {
+      assert_eq(val_hash_mem(memories[i], sizes[i]), hashes[i]);
+    }
+  }
+
+  ccut_test("hash and eq dispatch") {
+    uint32_t k = klass_def(nb_string_new_literal_c("HashEq"), 0);
+    Val obj = (Val)val_alloc(k, sizeof(ValHeader));
+
+    // falls back to methods
+    klass_def_method(k, VAL_SYM_HASH, 0, _meth_a, false);
+    klass_def_method(k, VAL_SYM_EQ, 1, _meth_eq_true, false);
+    assert_eq(1, val_hash(obj));
+    assert_true(val_eq(obj, VAL_NIL), "should call ==");
+
+    klass_set_hash_func(k, _hash_7);
+    assert_eq(7, val_hash(obj));
+    klass_set_hash_func(k, NULL);
+    assert_eq(1, val_hash(obj));
+
+    // fast paths
+    Val s = nb_string_new_c("foo");
+    assert_true(val_eq(nb_string_new_literal_c("foo"), s), "literal should eq string");
+    assert_true(val_eq(s, nb_string_new_literal_c("foo")), "string should eq literal");
+    assert_eq(val_hash(s), val_hash(nb_string_new_literal_c("foo")));
+    assert_false(val_eq(VAL_FROM_INT(3), s), "int should not eq string");
+    assert_false(val_eq(VAL_FROM_INT(3), VAL_FROM_INT(4)), "ints should not eq");
+
+    RELEASE(s);
+    val_free((void*)obj);
+  }
+
+  ccut_test("gens evacuate") {
+    int n = 300;
+    int32_t gen = val_gens_new_gen();
+    val_gens_set_current(gen);
+    Val root = _build_evacuee(n);
+    Val garbage = _build_evacuee(n);
+
+    // dict lookups should give the same results after evacuation
+    char dict_found[n][16];
+    for (int i = 0; i < n; i++) {
+      char k[16];
+      int ksize = sprintf(k, "k%04d", i);
+      Val v;
+      if (nb_dict_find(nb_array_get(root, 3), k, ksize, &v)) {
+        sprintf(dict_found[i], "%.*s", (int)nb_string_byte_size(v), NB_STRING_BYTES(v));
+      } else {
+        dict_found[i][0] = 0;
+      }
+    }
+
+    ValEvacuateStats stats;
+    Val res = val_gens_evacuate(root, gen - 1, &stats);
+    assert_neq(root, res);
+    assert_true(stats.copied_objects > n, "should copy all reachable objects");
+    assert_true(stats.dropped_bytes > stats.copied_bytes / 2, "garbage should be dropped");
+
+    val_gens_set_current(gen - 1);
+    val_gens_drop();
+
+    Val arr = nb_array_get(res, 0);
+    Val map = nb_array_get(res, 1);
+    Val list = nb_array_get(res, 2);
+    Val dict = nb_array_get(res, 3);
+    Val shared = nb_array_get(res, 4);
+    assert_eq(n + 1, nb_array_size(arr));
+    assert_eq(shared, nb_array_get(arr, n));
+    assert_true(_str_is(shared, "shared"), "shared should be copied");
+
+    for (int i = 0; i < n; i++) {
+      char expected[16];
+      char k[16];
+      sprintf(expected, "s%d", i);
+      int ksize = sprintf(k, "k%04d", i);
+      Val s = nb_array_get(arr, i);
+      assert_true(_str_is(s, expected), "array element %d", i);
+      assert_eq(s, nb_map_find(map, VAL_FROM_INT(i)));
+      Val v;
+      if (nb_dict_find(dict, k, ksize, &v)) {
+        assert_true(_str_is(v, dict_found[i]), "dict value of %s", k);
+      } else {
+        assert_eq(0, dict_found[i][0]);
+      }
+      // list is built in reverse order
+      assert_eq(nb_array_get(arr, n - 1 - i), nb_cons_head(list));
+      list = nb_cons_tail(list);
+    }
+    assert_eq(VAL_NIL, list);
+    RELEASE(res);
+  }
+
   ccut_test("val_c_call") {
     Val argv[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
     ValPair ret;
@@ -1,13 +1,24 @@
 #include "val.h"
-#include "utils/mut-map.h"
+#include "utils/swiss-map.h"
+#include "utils/hash.h"
 #include "utils/arena.h"
+// the rc overflow table and the profiler's size table are updated by any thread allocating or retaining
+#define RC_TABLE_CONCURRENT
+#include "utils/rc-table.h"
 #include "klass.h"
 #include "string.h"
+#include "token.h"
 #include "sym-table.h"
 #include "gens.h"
 #include <siphash.h>
+#include <tinycthread.h>
 #include <execinfo.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // TODO move static global fields into vm initialization?
 
@@ -22,7 +33,7 @@ typedef struct {
 } ConstSearchKey;
 
 static uint64_t _const_search_key_hash(ConstSearchKey k) {
-  return val_hash_mem(&k, sizeof(ConstSearchKey));
+  return fast_hash_u64(((uint64_t)k.parent << 32) | k.name_str);
 }
 
 static uint64_t _const_search_key_eq(ConstSearchKey k1, ConstSearchKey k2) {
@@ -30,31 +41,65 @@ static uint64_t _const_search_key_eq(ConstSearchKey k1, ConstSearchKey k2) {
 }
 
 MUT_ARRAY_DECL(Klasses, Klass*);
-MUT_MAP_DECL(GlobalRefCounts, Val, int64_t, val_hash, val_eq);
-MUT_MAP_DECL(KlassSearchMap, ConstSearchKey, uint32_t, _const_search_key_hash, _const_search_key_eq);
-MUT_MAP_DECL(ConstSearchMap, ConstSearchKey, Val, _const_search_key_hash, _const_search_key_eq);
+MUT_ARRAY_DECL(HashFuncs, ValHashFunc);
+MUT_ARRAY_DECL(EqFuncs, ValEqFunc);
+SWISS_MAP_DECL(KlassSearchMap, ConstSearchKey, uint32_t, _const_search_key_hash, _const_search_key_eq);
+SWISS_MAP_DECL(ConstSearchMap, ConstSearchKey, Val, _const_search_key_hash, _const_search_key_eq);
 MUT_ARRAY_DECL(Allocators, void*);
+MUT_ARRAY_DECL(Vals, Val);
+
+#ifdef NB_RC_BIASED
+// objects whose shared_rc went negative, for the owner thread to merge
+typedef struct {
+  struct Vals objs;
+  _Atomic(size_t) size; // checked by the owner without the lock
+} RcQueue;
+MUT_ARRAY_DECL(RcQueues, RcQueue*);
+#endif
 
 typedef struct {
   struct Klasses klasses; // array index by klass_id
+  struct HashFuncs hash_funcs; // klass->hash_func by klass_id, never NULL, so val_hash is one load + one call
+  struct EqFuncs eq_funcs; // klass->eq_func by klass_id, never NULL
   struct KlassSearchMap klass_search_map; // { (parent, name_str_lit) => klass* }
   struct ConstSearchMap const_search_map; // { (parent, name_str_lit) => Val }
-  struct GlobalRefCounts global_ref_counts;
+  RcTable overflow_rcs; // { obj => rc - 1 } for objects with rc_overflow
+  _Atomic(uint32_t) method_epoch; // bumped when methods or includes change, invalidates method caches
+  atomic_flag flat_methods_lock;
+#ifdef NB_RC_BIASED
+  struct RcQueues rc_queues; // index by owner id - 1, NULL after the owner thread is detached
+  atomic_flag rc_queues_lock;
+#endif
   bool global_tracing; // for begin/end trace
   NbSymTable* literal_table;
+  const void* image; // mapped startup image, kept for the process lifetime
+  size_t image_size;
 } Runtime;
 
 static uint8_t nb_hash_key[16];
 static Runtime runtime = {
-  .global_tracing = false
+  .global_tracing = false,
+  .method_epoch = 1,
+  .flat_methods_lock = ATOMIC_FLAG_INIT,
+#ifdef NB_RC_BIASED
+  .rc_queues_lock = ATOMIC_FLAG_INIT,
+#endif
 };
 
 // thread local runtime
 typedef struct {
   Gens* gens;
+#ifdef NB_RC_BIASED
+  uint32_t rc_owner; // owner id stamped into objects allocated by this thread, 0 if not assigned yet
+  RcQueue* rc_queue;
+#endif
+  struct Vals release_queue; // objects with rc = 0 waiting for destruct, initialized on first push
+  bool releasing;            // inside the destruct loop, nested releases are queued
+  size_t release_budget;     // max objects destructed per val_release, 0 for unlimited
 } TLRuntime;
 
 static __thread TLRuntime tl_runtime;
+static tss_t tl_runtime_key; // set to gens of threads other than the main thread, its destructor detaches the thread
 
 #pragma mark ### helpers
 
@@ -65,25 +110,99 @@ void nb_map_init_module();
 void nb_string_init_module();
 void nb_cons_init_module();
 void nb_token_init_module();
+void nb_double_init_module();
+size_t nb_double_thread_detach();
+#ifdef NB_ALLOC_PROFILE
+static void _profile_init();
+#endif
+static void _klass_funcs_push();
+static void _thread_exit(void* gens);
+#ifdef NB_RC_BIASED
+static void _rc_detach();
+#endif
+
+// prefixes the literal table image (see nb_sym_table_dump)
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t klass_count;
+  uint64_t const_count;
+} ImageHeader;
+static NbSymTable* _image_load(const char* path, ImageHeader* header);
+static size_t _map_bits_for(size_t count);
+
+// in the order of VAL_SYM_* ids
+static const char* well_known_syms[VAL_SYM_COUNT] = {
+  [VAL_SYM_EQ] = "==",
+  [VAL_SYM_NE] = "!=",
+  [VAL_SYM_LT] = "<",
+  [VAL_SYM_LE] = "<=",
+  [VAL_SYM_GT] = ">",
+  [VAL_SYM_GE] = ">=",
+  [VAL_SYM_ADD] = "+",
+  [VAL_SYM_SUB] = "-",
+  [VAL_SYM_MUL] = "*",
+  [VAL_SYM_DIV] = "/",
+  [VAL_SYM_MOD] = "%",
+  [VAL_SYM_HASH] = "hash",
+  [VAL_SYM_TO_S] = "to_s",
+  [VAL_SYM_TOKEN] = "token",
+  [VAL_SYM_YIELD] = "yield",
+  [VAL_SYM_PEG] = "peg",
+  [VAL_SYM_TAIL] = "tail",
+  [VAL_SYM_STYLE] = "style",
+  [VAL_SYM_MAIN] = "Main"
+};
 
 static void _init() __attribute__((constructor(0)));
 static void _init() {
+#ifdef NB_ALLOC_PROFILE
+  _profile_init();
+#endif
+
   // TODO random key (and re-gen key after fork? how to fork without re-gen key?)
   for (long i = 0; i < 16; i++) {
     nb_hash_key[i] = i*i;
   }
 
+#ifdef NB_RC_BIASED
+  RcQueues.init(&runtime.rc_queues, 0);
+#endif
   tl_runtime.gens = nb_gens_new_gens();
+  if (tss_create(&tl_runtime_key, _thread_exit) != thrd_success) {
+    fatal_err("failed to create thread local key");
+  }
 
-  Klasses.init(&runtime.klasses, KLASS_USER + 10);
+  // with an image, literals are already interned and registries are presized
+  ImageHeader image_header = {0};
+  const char* image_path = getenv("NB_IMAGE");
+  NbSymTable* image_table = image_path ? _image_load(image_path, &image_header) : NULL;
+  size_t klasses_cap = KLASS_USER + 10;
+  if (image_header.klass_count > klasses_cap) {
+    klasses_cap = image_header.klass_count;
+  }
+
+  Klasses.init(&runtime.klasses, klasses_cap);
+  HashFuncs.init(&runtime.hash_funcs, klasses_cap);
+  EqFuncs.init(&runtime.eq_funcs, klasses_cap);
   KlassSearchMap.init(&runtime.klass_search_map);
-  GlobalRefCounts.init(&runtime.global_ref_counts);
+  rc_table_init(&runtime.overflow_rcs);
   ConstSearchMap.init(&runtime.const_search_map);
+  if (image_table) {
+    KlassSearchMap.rehash(&runtime.klass_search_map, _map_bits_for(image_header.klass_count));
+    ConstSearchMap.rehash(&runtime.const_search_map, _map_bits_for(image_header.const_count));
+  }
 
-  runtime.literal_table = nb_sym_table_new();
+  runtime.literal_table = image_table ? image_table : nb_sym_table_new();
+  for (uint32_t i = 0; i < VAL_SYM_COUNT; i++) {
+    if (val_strlit_new_c(well_known_syms[i]) != i) {
+      fatal_err("well-known symbols must be interned first");
+    }
+  }
 
   for (int i = 0; i < KLASS_USER; i++) {
     Klasses.push(&runtime.klasses, NULL);
+    _klass_funcs_push();
   }
 
   nb_box_init_module();
@@ -93,29 +212,83 @@ static void _init() {
   nb_string_init_module();
   nb_cons_init_module();
   nb_token_init_module();
+  nb_double_init_module();
+}
+
+// other threads get their gens on first use
+static Gens* _gens() {
+  if (!tl_runtime.gens) {
+    tl_runtime.gens = nb_gens_new_gens();
+    tss_set(tl_runtime_key, tl_runtime.gens);
+  }
+  return tl_runtime.gens;
+}
+
+void val_thread_detach() {
+  if (!tl_runtime.gens) {
+    return;
+  }
+  val_release_drain();
+#ifdef NB_RC_BIASED
+  _rc_detach();
+#endif
+  nb_double_thread_detach();
+  if (tl_runtime.release_queue.data) {
+    Vals.cleanup(&tl_runtime.release_queue);
+  }
+  nb_gens_delete_gens(tl_runtime.gens);
+  tl_runtime = (TLRuntime){0};
+  tss_set(tl_runtime_key, NULL);
+}
+
+static void _thread_exit(void* gens) {
+  val_thread_detach();
 }
 
+#ifdef NB_RC_BIASED
+static void _rc_queues_lock() {
+  while (atomic_flag_test_and_set_explicit(&runtime.rc_queues_lock, memory_order_acquire)) {
+  }
+}
+
+static void _rc_queues_unlock() {
+  atomic_flag_clear_explicit(&runtime.rc_queues_lock, memory_order_release);
+}
+
+static uint32_t _rc_owner() {
+  if (!tl_runtime.rc_owner) {
+    RcQueue* q = malloc(sizeof(RcQueue));
+    Vals.init(&q->objs, 0);
+    atomic_init(&q->size, 0);
+    _rc_queues_lock();
+    RcQueues.push(&runtime.rc_queues, q);
+    tl_runtime.rc_owner = (uint32_t)RcQueues.size(&runtime.rc_queues);
+    _rc_queues_unlock();
+    tl_runtime.rc_queue = q;
+  }
+  return tl_runtime.rc_owner;
+}
+
+// non-owner threads, and the owner after merged, count with shared_rc
+static bool _is_shared_rc(ValHeader* p) {
+  return p->owner != tl_runtime.rc_owner || (atomic_load_explicit(&p->shared_rc, memory_order_relaxed) & VAL_RC_MERGED);
+}
+#endif
+
 static void _inc_ref_count(Val v) {
   ValHeader* p = (ValHeader*)v;
 
   if (p->rc_overflow) {
-    int64_t ref_count;
-    if (GlobalRefCounts.find(&runtime.global_ref_counts, v, &ref_count)) {
-      GlobalRefCounts.insert(&runtime.global_ref_counts, v, ref_count + 1);
-    } else {
+    if (rc_table_add(&runtime.overflow_rcs, v, 1) < 0) {
       // todo error
     }
+  } else if (p->extra_rc == VAL_MAX_EMBED_RC - 1) {
+    // extra_rc is full, move the count to the table
+    p->extra_rc = 0;
+    p->rc_overflow = true;
+    rc_table_set(&runtime.overflow_rcs, v, VAL_MAX_EMBED_RC);
   } else {
-    uint64_t* up = (uint64_t*)p;
-    up[0]++;
-    if (p->rc_overflow) {
-      int64_t ref_count;
-      if (GlobalRefCounts.find(&runtime.global_ref_counts, v, &ref_count)) {
-        // todo error
-      } else {
-        GlobalRefCounts.insert(&runtime.global_ref_counts, v, VAL_MAX_EMBED_RC);
-      }
-    }
+    p->extra_rc++;
   }
 }
 
@@ -123,16 +296,12 @@ static void _dec_ref_count(Val v) {
   ValHeader* p = (ValHeader*)v;
 
   if (p->rc_overflow) {
-    int64_t ref_count;
-    if (GlobalRefCounts.find(&runtime.global_ref_counts, v, &ref_count)) {
-      if (ref_count == VAL_MAX_EMBED_RC) {
-        GlobalRefCounts.remove(&runtime.global_ref_counts, v);
-        p->rc_overflow = false;
-        p->extra_rc = (VAL_MAX_EMBED_RC - 1);
-      } else {
-        GlobalRefCounts.insert(&runtime.global_ref_counts, v, ref_count - 1);
-      }
-    } else {
+    int64_t ref_count = rc_table_add(&runtime.overflow_rcs, v, -1);
+    if (ref_count == VAL_MAX_EMBED_RC - 1) {
+      rc_table_remove(&runtime.overflow_rcs, v);
+      p->rc_overflow = false;
+      p->extra_rc = (VAL_MAX_EMBED_RC - 1);
+    } else if (ref_count < 0) {
       // todo error
     }
   } else {
@@ -144,8 +313,109 @@ static void _clear_rc(ValHeader* r) {
   r->extra_rc = 0;
   r->rc_overflow = false;
   r->perm = false;
+#ifdef NB_RC_BIASED
+  r->owner = _rc_owner();
+  atomic_store_explicit(&r->shared_rc, 0, memory_order_relaxed);
+#endif
+}
+
+#ifdef NB_RC_BIASED
+static void _release_destroy(ValHeader* p);
+
+// move the owner count into shared_rc and clear VAL_RC_QUEUED, returns the total count.
+// prereq: called by the owner, or by the thread that queued the object after the owner is detached
+static int32_t _rc_merge(ValHeader* p) {
+  int32_t count = 0;
+  int32_t old = atomic_load_explicit(&p->shared_rc, memory_order_acquire);
+  if (!(old & VAL_RC_MERGED)) {
+    if (p->rc_overflow) {
+      count = (int32_t)rc_table_get(&runtime.overflow_rcs, (Val)p) + 1;
+      rc_table_remove(&runtime.overflow_rcs, (Val)p);
+      p->rc_overflow = false;
+    } else {
+      count = p->extra_rc + 1;
+    }
+    p->extra_rc = 0;
+  }
+
+  int32_t merged;
+  do {
+    merged = old & VAL_RC_MERGED ? old : old + count * VAL_RC_ONE + VAL_RC_MERGED;
+    merged &= ~VAL_RC_QUEUED;
+  } while (!atomic_compare_exchange_weak_explicit(&p->shared_rc, &old, merged, memory_order_acq_rel, memory_order_acquire));
+  return merged / VAL_RC_ONE;
 }
 
+// called by a non-owner thread which made shared_rc negative, the owner may hold no reference now
+static void _rc_enqueue(ValHeader* p) {
+  int32_t old = atomic_fetch_or_explicit(&p->shared_rc, VAL_RC_QUEUED, memory_order_acq_rel);
+  if (old & VAL_RC_QUEUED) {
+    return;
+  }
+
+  _rc_queues_lock();
+  RcQueue* q = *RcQueues.at(&runtime.rc_queues, p->owner - 1);
+  if (q) {
+    Vals.push(&q->objs, (Val)p);
+    atomic_store_explicit(&q->size, Vals.size(&q->objs), memory_order_relaxed);
+  }
+  _rc_queues_unlock();
+
+  // the owner is detached, its count no longer changes and can be merged here
+  if (!q && _rc_merge(p) == 0) {
+    _release_destroy(p);
+  }
+}
+
+// merge objects queued by other threads, and destroy those without references
+static void _rc_drain_queue() {
+  RcQueue* q = tl_runtime.rc_queue;
+  if (!q || !atomic_load_explicit(&q->size, memory_order_relaxed)) {
+    return;
+  }
+
+  _rc_queues_lock();
+  struct Vals objs = q->objs;
+  Vals.init(&q->objs, 0);
+  atomic_store_explicit(&q->size, 0, memory_order_relaxed);
+  _rc_queues_unlock();
+
+  for (size_t i = 0; i < Vals.size(&objs); i++) {
+    ValHeader* p = (ValHeader*)*Vals.at(&objs, i);
+    if (_rc_merge(p) == 0) {
+      _release_destroy(p);
+    }
+  }
+  Vals.cleanup(&objs);
+}
+
+// after the owner id is unregistered, objects queued meanwhile are merged here,
+// the others are merged by the next thread making their shared_rc negative
+static void _rc_detach() {
+  RcQueue* q = tl_runtime.rc_queue;
+  if (!q) {
+    return;
+  }
+  _rc_drain_queue();
+
+  _rc_queues_lock();
+  *RcQueues.at(&runtime.rc_queues, tl_runtime.rc_owner - 1) = NULL;
+  _rc_queues_unlock();
+
+  // objects released from now on are not owned by this thread
+  tl_runtime.rc_owner = 0;
+  tl_runtime.rc_queue = NULL;
+  for (size_t i = 0; i < Vals.size(&q->objs); i++) {
+    ValHeader* p = (ValHeader*)*Vals.at(&q->objs, i);
+    if (_rc_merge(p) == 0) {
+      _release_destroy(p);
+    }
+  }
+  Vals.cleanup(&q->objs);
+  free(q);
+}
+#endif
+
 static Klass* _klass_new(uint32_t klass_id, Val name, uint32_t parent_id) {
   Klass* k = val_alloc(KLASS_KLASS, sizeof(Klass));
   k->id = klass_id;
@@ -154,6 +424,8 @@ static Klass* _klass_new(uint32_t klass_id, Val name, uint32_t parent_id) {
 
   IdMethods.init(&k->id_methods);
   Includes.init(&k->includes, 0);
+  IdMethods.init(&k->flat_methods);
+  k->flat_epoch = 0;
   IdFieldIndexes.init(&k->id_field_indexes);
   Fields.init(&k->fields, 0);
 
@@ -162,6 +434,8 @@ static Klass* _klass_new(uint32_t klass_id, Val name, uint32_t parent_id) {
   k->destruct_func = NULL;
   k->delete_func = NULL;
   k->debug_func = NULL;
+  k->size_func = NULL;
+  k->trace_func = NULL;
   val_perm(k);
 
   ConstSearchKey key = {.parent = k->parent_id, .name_str = VAL_TO_STR(k->name)};
@@ -178,6 +452,7 @@ static void _klass_delete(Klass* k) {
 
   IdMethods.cleanup(&k->id_methods);
   Includes.cleanup(&k->includes);
+  IdMethods.cleanup(&k->flat_methods);
   IdFieldIndexes.cleanup(&k->id_field_indexes);
   Fields.cleanup(&k->fields);
 
@@ -190,10 +465,44 @@ static Method* _method_new(uint32_t method_id, int32_t min_argc, int32_t max_arg
   METHOD_IS_FINAL(meth) = is_final;
   METHOD_MIN_ARGC(meth) = min_argc;
   METHOD_MAX_ARGC(meth) = max_argc;
+  meth->thunk = NULL;
   val_perm(meth);
   return meth;
 }
 
+// direct calls by arity, so the arguments are passed in registers without copying argv to the stack
+static ValPair _thunk0(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val))func)(obj);
+}
+
+static ValPair _thunk1(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val))func)(obj, argv[0]);
+}
+
+static ValPair _thunk2(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val, Val))func)(obj, argv[0], argv[1]);
+}
+
+static ValPair _thunk3(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val, Val, Val))func)(obj, argv[0], argv[1], argv[2]);
+}
+
+static ValPair _thunk4(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val, Val, Val, Val))func)(obj, argv[0], argv[1], argv[2], argv[3]);
+}
+
+static ValPair _thunk5(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val, Val, Val, Val, Val))func)(obj, argv[0], argv[1], argv[2], argv[3], argv[4]);
+}
+
+static ValPair _thunk6(Val obj, ValMethodFunc func, Val* argv) {
+  return ((ValPair (*)(Val, Val, Val, Val, Val, Val, Val))func)(obj, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
+static const MethodThunk method_thunks[METHOD_THUNK_MAX_ARGC + 1] = {
+  _thunk0, _thunk1, _thunk2, _thunk3, _thunk4, _thunk5, _thunk6
+};
+
 static Method* _search_own_method(Klass* klass, uint32_t method_id) {
   Method* method;
   if (IdMethods.find(&klass->id_methods, method_id, &method)) {
@@ -203,6 +512,97 @@ static Method* _search_own_method(Klass* klass, uint32_t method_id) {
   }
 }
 
+// default hash_funcs entry: dispatch to the "hash" method
+static uint64_t _send_hash(Val v) {
+  ValPair res = val_send(v, VAL_SYM_HASH, 0, NULL);
+  if (res.snd) {
+    val_throw(res.snd); // error: raise in hash function
+  }
+  // TODO to uint 64
+  return VAL_TO_INT(res.fst);
+}
+
+// default eq_funcs entry: dispatch to the "==" method
+static bool _send_eq(Val l, Val r) {
+  ValPair res = val_send(l, VAL_SYM_EQ, 1, &r);
+  if (res.snd) {
+    val_throw(res.snd); // error: raise in eq function
+  }
+  return VAL_IS_TRUE(res.fst);
+}
+
+// keep hash_funcs and eq_funcs in sync with klasses
+static void _klass_funcs_push() {
+  HashFuncs.push(&runtime.hash_funcs, _send_hash);
+  EqFuncs.push(&runtime.eq_funcs, _send_eq);
+}
+
+#pragma mark ### method cache
+
+// direct-mapped { (klass_id, method_id) => Method* } in front of the flat method tables.
+// it is per-thread so entries are not torn by other threads, stale entries are detected by epoch.
+#define METHOD_CACHE_BITS 9
+
+typedef struct {
+  uint32_t klass_id;
+  uint32_t method_id;
+  uint32_t epoch; // 0 for empty entry
+  Method* method; // NULL for not found
+} MethodCacheEntry;
+
+static __thread MethodCacheEntry method_cache[1 << METHOD_CACHE_BITS];
+
+static void _invalidate_method_caches() {
+  atomic_fetch_add_explicit(&runtime.method_epoch, 1, memory_order_release);
+}
+
+static uint32_t _method_cache_index(uint32_t klass_id, uint32_t method_id) {
+  uint64_t h = ((uint64_t)klass_id << 32 | method_id) * 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(h >> (64 - METHOD_CACHE_BITS));
+}
+
+static void _flat_methods_merge(struct IdMethods* to, struct IdMethods* from) {
+  IdMethodsIter it;
+  for (IdMethods.iter_init(&it, from); !IdMethods.iter_is_end(&it); IdMethods.iter_next(&it)) {
+    IdMethods.insert(to, it.slot->k, it.slot->v);
+  }
+}
+
+// prereq: flat_methods_lock is held
+static void _flat_methods_build(Klass* klass, uint32_t epoch) {
+  if (atomic_load_explicit(&klass->flat_epoch, memory_order_acquire) == epoch) {
+    return;
+  }
+  IdMethods.cleanup(&klass->flat_methods);
+  IdMethods.init(&klass->flat_methods);
+
+  // same priority as searching own methods then includes from last to first
+  int size = Includes.size(&klass->includes);
+  for (int i = 0; i < size; i++) {
+    Klass* included = *Klasses.at(&runtime.klasses, *Includes.at(&klass->includes, i));
+    _flat_methods_build(included, epoch);
+    _flat_methods_merge(&klass->flat_methods, &included->flat_methods);
+  }
+  _flat_methods_merge(&klass->flat_methods, &klass->id_methods);
+
+  atomic_store_explicit(&klass->flat_epoch, epoch, memory_order_release);
+}
+
+static Method* _find_flat_method(Klass* klass, uint32_t method_id, uint32_t epoch) {
+  if (atomic_load_explicit(&klass->flat_epoch, memory_order_acquire) != epoch) {
+    while (atomic_flag_test_and_set_explicit(&runtime.flat_methods_lock, memory_order_acquire)) {
+    }
+    _flat_methods_build(klass, epoch);
+    atomic_flag_clear_explicit(&runtime.flat_methods_lock, memory_order_release);
+  }
+  Method* method;
+  if (IdMethods.find(&klass->flat_methods, method_id, &method)) {
+    return method;
+  } else {
+    return NULL;
+  }
+}
+
 static void _check_final_method_conflict(Klass* klass, uint32_t method_id) {
   Method* prev_meth = _search_own_method(klass, method_id);
   if (prev_meth) {
@@ -244,6 +644,7 @@ uint32_t klass_def(Val name, uint32_t parent) {
     uint32_t klass_id = Klasses.size(&runtime.klasses);
     Klass* k = _klass_new(klass_id, name, parent);
     Klasses.push(&runtime.klasses, k);
+    _klass_funcs_push();
     return klass_id;
   }
 }
@@ -260,6 +661,9 @@ void klass_pop(uint32_t klass_id) {
     _klass_delete(*Klasses.at(&runtime.klasses, i));
   }
   runtime.klasses.size = klass_id + 1;
+  runtime.hash_funcs.size = klass_id + 1;
+  runtime.eq_funcs.size = klass_id + 1;
+  _invalidate_method_caches();
 }
 
 Val klass_val(uint32_t klass_id) {
@@ -309,12 +713,26 @@ void klass_set_hash_func(uint32_t klass_id, ValHashFunc func) {
   Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
   assert(klass);
   klass->hash_func = func;
+  *HashFuncs.at(&runtime.hash_funcs, klass_id) = (func ? func : _send_hash);
 }
 
 void klass_set_eq_func(uint32_t klass_id, ValEqFunc func) {
   Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
   assert(klass);
   klass->eq_func = func;
+  *EqFuncs.at(&runtime.eq_funcs, klass_id) = (func ? func : _send_eq);
+}
+
+void klass_set_size_func(uint32_t klass_id, ValSizeFunc func) {
+  Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
+  assert(klass);
+  klass->size_func = func;
+}
+
+void klass_set_trace_func(uint32_t klass_id, ValTraceFunc func) {
+  Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
+  assert(klass);
+  klass->trace_func = func;
 }
 
 void klass_def_method(uint32_t klass_id, uint32_t method_id, int32_t argc, ValMethodFunc func, bool is_final) {
@@ -324,6 +742,7 @@ void klass_def_method(uint32_t klass_id, uint32_t method_id, int32_t argc, ValMe
   Method* meth = _method_new(method_id, argc, argc, is_final);
   METHOD_IS_CFUNC(meth) = true;
   METHOD_FUNC_TAKES_ARGV(meth) = false;
+  meth->thunk = (argc >= 0 && argc <= METHOD_THUNK_MAX_ARGC) ? method_thunks[argc] : NULL;
   meth->as.func = func;
 
   // TODO !! deallocate old method if overwriting
@@ -331,7 +750,7 @@ void klass_def_method(uint32_t klass_id, uint32_t method_id, int32_t argc, ValMe
   //      but: do not link methods if `super` is calling the method in other klass
 
   IdMethods.insert(&klass->id_methods, method_id, meth);
-
+  _invalidate_method_caches();
 }
 
 void klass_def_method_v(uint32_t klass_id, uint32_t method_id, int32_t min_argc, int32_t max_argc, ValMethodFuncV func, bool is_final) {
@@ -344,24 +763,23 @@ void klass_def_method_v(uint32_t klass_id, uint32_t method_id, int32_t min_argc,
   meth->as.func2 = func;
 
   IdMethods.insert(&klass->id_methods, method_id, meth);
+  _invalidate_method_caches();
 }
 
 void* klass_find_method(uint32_t klass_id, uint32_t method_id) {
-  Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
-  Method* m = _search_own_method(klass, method_id);
-  if (m) {
-    return m;
+  uint32_t epoch = atomic_load_explicit(&runtime.method_epoch, memory_order_acquire);
+  MethodCacheEntry* e = method_cache + _method_cache_index(klass_id, method_id);
+  if (e->epoch == epoch && e->klass_id == klass_id && e->method_id == method_id) {
+    return e->method;
   }
 
-  int size = Includes.size(&klass->includes);
-  for (int i = size - 1; i >= 0; i--) {
-    uint32_t include_id = *Includes.at(&klass->includes, i);
-    Method *m = klass_find_method(include_id, method_id);
-    if (m) {
-      return m;
-    }
-  }
-  return NULL;
+  Klass* klass = *Klasses.at(&runtime.klasses, klass_id);
+  Method* m = _find_flat_method(klass, method_id, epoch);
+  e->klass_id = klass_id;
+  e->method_id = method_id;
+  e->epoch = epoch;
+  e->method = m;
+  return m;
 }
 
 ValPair klass_call_method(Val obj, void* m, int argc, Val* argv) {
@@ -389,6 +807,7 @@ void klass_include(uint32_t klass_id, uint32_t included_id) {
     }
   }
   Includes.push(&klass->includes, included_id);
+  _invalidate_method_caches();
 }
 
 void klass_debug() {
@@ -398,7 +817,7 @@ void klass_debug() {
     Klass* k = *Klasses.at(&runtime.klasses, i);
     if (k) {
       printf("index:%d, id:%d, name:%.*s, is_struct:%d, is_unsafe:%d\n",
-      i, k->id, (int)nb_string_ptr(k->name), nb_string_ptr(k->name), (int)KLASS_IS_STRUCT(k), (int)KLASS_IS_UNSAFE(k));
+      i, k->id, (int)nb_string_byte_size(k->name), NB_STRING_BYTES(k->name), (int)KLASS_IS_STRUCT(k), (int)KLASS_IS_UNSAFE(k));
       ConstSearchKey key = {.parent = k->parent_id, .name_str = VAL_TO_STR(k->name)};
       uint32_t res;
       assert(KlassSearchMap.find(&runtime.klass_search_map, key, &res));
@@ -437,6 +856,81 @@ size_t val_strlit_byte_size(uint32_t sid) {
   return size;
 }
 
+#pragma mark ### startup image
+
+#define IMAGE_MAGIC "NBIMAGE"
+#define IMAGE_VERSION 1
+
+static size_t _map_bits_for(size_t count) {
+  size_t bits = SWISS_MAP_MIN_BITS;
+  while ((1ULL << bits) * 8 < count * 10) {
+    bits++;
+  }
+  return bits;
+}
+
+// a single mmap, the literal table uses the mapped strings and index in place
+static NbSymTable* _image_load(const char* path, ImageHeader* header) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ImageHeader)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
+  void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  ImageHeader* h = p;
+  NbSymTable* t = NULL;
+  if (!memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) && h->version == IMAGE_VERSION) {
+    t = nb_sym_table_new_mapped(h + 1, size - sizeof(ImageHeader));
+  }
+  // ids of well-known symbols are constants
+  for (uint32_t i = 0; t && i < VAL_SYM_COUNT; i++) {
+    uint64_t id;
+    if (!nb_sym_table_get(t, strlen(well_known_syms[i]), well_known_syms[i], &id) || id != i) {
+      nb_sym_table_delete(t);
+      t = NULL;
+    }
+  }
+  if (!t) {
+    munmap(p, size);
+    log_err("ignored invalid image: %s", path);
+    return NULL;
+  }
+
+  runtime.image = p;
+  runtime.image_size = size;
+  *header = *h;
+  return t;
+}
+
+bool val_image_dump(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  ImageHeader header = {
+    .magic = IMAGE_MAGIC,
+    .version = IMAGE_VERSION,
+    .klass_count = (uint32_t)Klasses.size(&runtime.klasses),
+    .const_count = ConstSearchMap.size(&runtime.const_search_map)
+  };
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && nb_sym_table_dump(runtime.literal_table, f);
+  return (fclose(f) == 0) && ok;
+}
+
+bool val_image_loaded() {
+  return runtime.image != NULL;
+}
+
 void val_debug(Val v) {
   printf("debug val 0x%lx (%s)", v, VAL_IS_IMM(v) ? "immediate" : "pointer");
   if (v == VAL_UNDEF) {
@@ -466,46 +960,56 @@ bool val_eq(Val l, Val r) {
   if (l == r) {
     return true;
   }
-  if (VAL_IS_IMM(l) && VAL_IS_IMM(r)) {
-    return false;
+  if (VAL_IS_IMM(l)) {
+    // other immediate values are equal only when bits are equal
+    // (literal strings are interned, short strings are packed with zero padding)
+    if (!VAL_IS_STR(l) && !VAL_IS_SSTR(l)) {
+      return false;
+    }
+    if (VAL_IS_IMM(r) && !(VAL_IS_STR(l) ? VAL_IS_SSTR(r) : VAL_IS_STR(r))) {
+      return false;
+    }
+    return nb_string_eq(l, r);
   }
 
   uint32_t klass_id = VAL_KLASS(l);
-  Klass* k = *Klasses.at(&runtime.klasses, klass_id);
-  if (k->eq_func) {
-    return k->eq_func(l, r);
-  }
-
-  ValPair res = val_send(l, val_strlit_new_c("=="), 1, &r);
-  if (res.snd) {
-    val_throw(res.snd); // error: raise in eq function
+  if (klass_id == KLASS_STRING) {
+    return nb_string_eq(l, r);
+  } else if (klass_id == KLASS_TOKEN) {
+    return nb_token_eq(l, r);
   }
-  return VAL_IS_TRUE(res.fst);
+  return (*EqFuncs.at(&runtime.eq_funcs, klass_id))(l, r);
 }
 
 uint64_t val_hash(Val v) {
-  if (VAL_IS_IMM(v) && !VAL_IS_STR(v)) {
+  if (VAL_IS_INT(v)) {
     return siphash(nb_hash_key, (const uint8_t*)&v, 8);
-  } else {
-    uint32_t klass_id = VAL_KLASS(v);
-    Klass* k = *Klasses.at(&runtime.klasses, klass_id);
-    if (k->hash_func) {
-      return k->hash_func(v);
+  }
+  if (VAL_IS_IMM(v)) {
+    if (VAL_IS_STR(v) || VAL_IS_SSTR(v)) {
+      return nb_string_hash(v);
     }
+    return siphash(nb_hash_key, (const uint8_t*)&v, 8);
+  }
 
-    ValPair res = val_send(v, val_strlit_new_c("hash"), 0, NULL);
-    if (res.snd) {
-      val_throw(res.snd); // error: raise in hash function
-    }
-    // TODO to uint 64
-    return VAL_TO_INT(res.fst);
+  uint32_t klass_id = VAL_KLASS(v);
+  if (klass_id == KLASS_STRING) {
+    return nb_string_hash(v);
+  } else if (klass_id == KLASS_TOKEN) {
+    return nb_token_hash(v);
   }
+  return (*HashFuncs.at(&runtime.hash_funcs, klass_id))(v);
 }
 
+// siphash() and siphash_many() pick the implementation for the cpu on first call
 uint64_t val_hash_mem(const void* memory, size_t size) {
   return siphash(nb_hash_key, (const uint8_t*)memory, size);
 }
 
+void val_hash_mem_many(size_t n, const void* const* memories, const size_t* sizes, uint64_t* hashes) {
+  siphash_many(nb_hash_key, (const unsigned char* const*)memories, sizes, hashes, n);
+}
+
 ValPair val_send(Val obj, uint32_t method_id, int32_t argc, Val* args) {
   uint32_t klass_id = VAL_KLASS(obj);
   Method* m = klass_find_method(klass_id, method_id);
@@ -515,7 +1019,7 @@ ValPair val_send(Val obj, uint32_t method_id, int32_t argc, Val* args) {
 noreturn void val_throw(Val obj) {
   // todo
   if (VAL_KLASS(obj) == KLASS_STRING) {
-    fprintf(stderr, "%.*s\n", (int)nb_string_byte_size(obj), nb_string_ptr(obj));
+    fprintf(stderr, "%.*s\n", (int)nb_string_byte_size(obj), NB_STRING_BYTES(obj));
   }
   _Exit(-2);
 }
@@ -534,28 +1038,214 @@ void val_def_const(uint32_t namespace, uint32_t name_str, Val v) {
   }
 }
 
+#pragma mark ### allocation profiler
+
+#ifdef NB_ALLOC_PROFILE
+
+typedef struct {
+  _Atomic(uint64_t) allocs;
+  _Atomic(uint64_t) frees;
+  _Atomic(int64_t) live_objects;
+  _Atomic(int64_t) live_bytes;
+  _Atomic(uint64_t) size_hist[VAL_ALLOC_PROFILE_BUCKETS];
+} AllocProfile;
+
+// klass ids beyond the table are counted in the last entry
+static AllocProfile alloc_profiles[VAL_ALLOC_PROFILE_KLASSES];
+static RcTable alloc_sizes; // { obj => byte size }, to account live bytes on free
+static _Atomic(uint64_t) alloc_seq;
+static _Atomic(uint64_t) alloc_sample_every; // 0 for no sampling
+static _Atomic(uint64_t) alloc_sample_seq;
+static ValAllocSample alloc_samples[VAL_ALLOC_PROFILE_SAMPLES]; // ring buffer
+
+static void _profile_init() {
+  rc_table_init(&alloc_sizes);
+}
+
+static AllocProfile* _profile_of(uint32_t klass_id) {
+  return alloc_profiles + (klass_id < VAL_ALLOC_PROFILE_KLASSES ? klass_id : VAL_ALLOC_PROFILE_KLASSES - 1);
+}
+
+// bucket i holds sizes in (2^(i+3), 2^(i+4)], bucket 0 also holds sizes <= 8
+static int _profile_bucket(size_t size) {
+  int i = size <= 16 ? 0 : 60 - __builtin_clzll(size - 1);
+  return i < VAL_ALLOC_PROFILE_BUCKETS ? i : VAL_ALLOC_PROFILE_BUCKETS - 1;
+}
+
+static void _profile_alloc(ValHeader* p, size_t size) {
+  AllocProfile* prof = _profile_of(p->klass);
+  atomic_fetch_add_explicit(&prof->allocs, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&prof->live_objects, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&prof->live_bytes, size, memory_order_relaxed);
+  atomic_fetch_add_explicit(&prof->size_hist[_profile_bucket(size)], 1, memory_order_relaxed);
+  rc_table_set(&alloc_sizes, (uintptr_t)p, size);
+
+  uint64_t every = atomic_load_explicit(&alloc_sample_every, memory_order_relaxed);
+  if (every && atomic_fetch_add_explicit(&alloc_seq, 1, memory_order_relaxed) % every == 0) {
+    uint64_t i = atomic_fetch_add_explicit(&alloc_sample_seq, 1, memory_order_relaxed);
+    ValAllocSample* sample = alloc_samples + i % VAL_ALLOC_PROFILE_SAMPLES;
+    sample->klass = p->klass;
+    sample->size = size;
+    sample->frames = backtrace(sample->callstack, VAL_ALLOC_PROFILE_FRAMES);
+  }
+}
+
+static void _profile_realloc(ValHeader* old, ValHeader* p, size_t osize, size_t nsize) {
+  AllocProfile* prof = _profile_of(p->klass);
+  atomic_fetch_add_explicit(&prof->live_bytes, (int64_t)nsize - (int64_t)osize, memory_order_relaxed);
+  rc_table_remove(&alloc_sizes, (uintptr_t)old);
+  rc_table_set(&alloc_sizes, (uintptr_t)p, nsize);
+}
+
+static void _profile_free(ValHeader* p) {
+  int64_t size = rc_table_get(&alloc_sizes, (uintptr_t)p);
+  if (size < 0) {
+    return; // allocated before reset
+  }
+  rc_table_remove(&alloc_sizes, (uintptr_t)p);
+  AllocProfile* prof = _profile_of(p->klass);
+  atomic_fetch_add_explicit(&prof->frees, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&prof->live_objects, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&prof->live_bytes, size, memory_order_relaxed);
+}
+
+bool val_alloc_profile_snapshot(uint32_t klass_id, ValAllocProfile* out) {
+  AllocProfile* prof = _profile_of(klass_id);
+  out->allocs = atomic_load_explicit(&prof->allocs, memory_order_relaxed);
+  out->frees = atomic_load_explicit(&prof->frees, memory_order_relaxed);
+  out->live_objects = atomic_load_explicit(&prof->live_objects, memory_order_relaxed);
+  out->live_bytes = atomic_load_explicit(&prof->live_bytes, memory_order_relaxed);
+  for (int i = 0; i < VAL_ALLOC_PROFILE_BUCKETS; i++) {
+    out->size_hist[i] = atomic_load_explicit(&prof->size_hist[i], memory_order_relaxed);
+  }
+  return true;
+}
+
+void val_alloc_profile_set_sampling(uint64_t every) {
+  atomic_store(&alloc_sample_every, every);
+}
+
+size_t val_alloc_profile_samples(ValAllocSample* out, size_t max) {
+  uint64_t total = atomic_load(&alloc_sample_seq);
+  size_t n = total < VAL_ALLOC_PROFILE_SAMPLES ? total : VAL_ALLOC_PROFILE_SAMPLES;
+  if (n > max) {
+    n = max;
+  }
+  // latest samples first
+  for (size_t i = 0; i < n; i++) {
+    out[i] = alloc_samples[(total - 1 - i) % VAL_ALLOC_PROFILE_SAMPLES];
+  }
+  return n;
+}
+
+// NOTE not thread safe, other threads should not allocate during reset
+void val_alloc_profile_reset() {
+  memset(alloc_profiles, 0, sizeof(alloc_profiles));
+  rc_table_cleanup(&alloc_sizes);
+  rc_table_init(&alloc_sizes);
+  atomic_store(&alloc_seq, 0);
+  atomic_store(&alloc_sample_seq, 0);
+}
+
+void val_alloc_profile_debug() {
+  printf("--- alloc profile ---\n");
+  for (uint32_t i = 0; i < VAL_ALLOC_PROFILE_KLASSES; i++) {
+    ValAllocProfile prof;
+    val_alloc_profile_snapshot(i, &prof);
+    if (!prof.allocs) {
+      continue;
+    }
+    Klass* k = i < Klasses.size(&runtime.klasses) ? *Klasses.at(&runtime.klasses, i) : NULL;
+    if (k) {
+      printf("id:%u, name:%.*s", i, (int)nb_string_byte_size(k->name), NB_STRING_BYTES(k->name));
+    } else {
+      printf("id:%u%s", i, i == VAL_ALLOC_PROFILE_KLASSES - 1 ? "+" : "");
+    }
+    printf(", allocs:%lu, frees:%lu, live_objects:%ld, live_bytes:%ld\n  sizes:",
+      (unsigned long)prof.allocs, (unsigned long)prof.frees, (long)prof.live_objects, (long)prof.live_bytes);
+    for (int b = 0; b < VAL_ALLOC_PROFILE_BUCKETS; b++) {
+      if (prof.size_hist[b]) {
+        printf(" <=%lu:%lu", 16UL << b, (unsigned long)prof.size_hist[b]);
+      }
+    }
+    printf("\n");
+  }
+
+  ValAllocSample samples[VAL_ALLOC_PROFILE_SAMPLES];
+  size_t n = val_alloc_profile_samples(samples, VAL_ALLOC_PROFILE_SAMPLES);
+  for (size_t i = 0; i < n; i++) {
+    printf("sample: klass:%u, size:%zu\n", samples[i].klass, samples[i].size);
+    char** strs = backtrace_symbols(samples[i].callstack, samples[i].frames);
+    for (int j = 0; j < samples[i].frames; j++) {
+      printf("  %s\n", strs[j]);
+    }
+    free(strs);
+  }
+  printf("\n");
+}
+
+#define PROFILE_ALLOC(p, size) _profile_alloc((p), (size))
+#define PROFILE_REALLOC(old, p, osize, nsize) _profile_realloc((old), (p), (osize), (nsize))
+#define PROFILE_FREE(p) _profile_free(p)
+
+#else
+
+bool val_alloc_profile_snapshot(uint32_t klass_id, ValAllocProfile* out) {
+  memset(out, 0, sizeof(ValAllocProfile));
+  return false;
+}
+
+void val_alloc_profile_set_sampling(uint64_t every) {
+}
+
+size_t val_alloc_profile_samples(ValAllocSample* out, size_t max) {
+  return 0;
+}
+
+void val_alloc_profile_reset() {
+}
+
+void val_alloc_profile_debug() {
+  printf("--- alloc profile (not enabled, build with -DNB_ALLOC_PROFILE) ---\n\n");
+}
+
+#define PROFILE_ALLOC(p, size)
+#define PROFILE_REALLOC(old, p, osize, nsize)
+#define PROFILE_FREE(p)
+
+#endif
+
 #pragma mark ### memory function interface
 
 void val_begin_check_memory() {
-  nb_gens_set_current(tl_runtime.gens, -1);
+  nb_gens_set_current(_gens(), -1);
 }
 
 void val_end_check_memory() {
-  assert(nb_gens_get_current(tl_runtime.gens) == -1);
-  nb_gens_check_memory(tl_runtime.gens);
-  nb_gens_set_current(tl_runtime.gens, 0);
+  assert(nb_gens_get_current(_gens()) == -1);
+  val_release_drain();
+  nb_gens_check_memory(_gens());
+  nb_gens_set_current(_gens(), 0);
 }
 
 void* val_alloc(uint32_t klass_id, size_t size) {
-  ValHeader* p = nb_gens_malloc(tl_runtime.gens, size);
+  return val_alloc_recycled(nb_gens_malloc(_gens(), size), klass_id, size);
+}
+
+void* val_alloc_recycled(void* _p, uint32_t klass_id, size_t size) {
+  ValHeader* p = _p;
   memset(p, 0, size);
   p->klass = klass_id;
+#ifdef NB_RC_BIASED
+  p->owner = _rc_owner();
+#endif
+  PROFILE_ALLOC(p, size);
 
   return p;
 }
 
 void* val_dup(void* p, size_t osize, size_t nsize) {
-  ValHeader* r = nb_gens_malloc(tl_runtime.gens, nsize);
+  ValHeader* r = nb_gens_malloc(_gens(), nsize);
 
   if (nsize > osize) {
     memcpy(r, p, osize);
@@ -564,6 +1254,7 @@ void* val_dup(void* p, size_t osize, size_t nsize) {
     memcpy(r, p, nsize);
   }
   _clear_rc(r);
+  PROFILE_ALLOC(r, nsize);
 
   return r;
 }
@@ -571,15 +1262,27 @@ void* val_dup(void* p, size_t osize, size_t nsize) {
 void* val_realloc(void* p, size_t osize, size_t nsize) {
   assert(nsize > osize);
 
-  p = nb_gens_realloc(tl_runtime.gens, p, osize, nsize);
-  return p;
+  void* r = nb_gens_realloc(_gens(), p, osize, nsize);
+  PROFILE_REALLOC((ValHeader*)p, (ValHeader*)r, osize, nsize);
+  return r;
 }
 
 void val_free(void* _p) {
   ValHeader* p = _p;
   assert(p->extra_rc == 0);
+  PROFILE_FREE(p);
+
+  nb_gens_free(_gens(), p, 0);
+}
+
+void val_free_recycled(void* p) {
+  nb_gens_free(_gens(), p, 0);
+}
 
-  nb_gens_free(tl_runtime.gens, p);
+void val_recycle(void* _p) {
+  ValHeader* p = _p;
+  assert(p->extra_rc == 0);
+  PROFILE_FREE(p);
 }
 
 void val_perm(void* _p) {
@@ -587,6 +1290,24 @@ void val_perm(void* _p) {
   p->perm = true;
 }
 
+size_t val_byte_size(Val v) {
+  if (VAL_IS_IMM(v)) {
+    return 0;
+  }
+  Klass* k = *Klasses.at(&runtime.klasses, VAL_KLASS(v));
+  return (k && k->size_func) ? k->size_func((void*)v) : 0;
+}
+
+void val_trace(Val v, ValVisitFunc visit, void* ctx) {
+  if (VAL_IS_IMM(v)) {
+    return;
+  }
+  Klass* k = *Klasses.at(&runtime.klasses, VAL_KLASS(v));
+  if (k && k->trace_func) {
+    k->trace_func((void*)v, visit, ctx);
+  }
+}
+
 // same as val_retain
 void val_retain(Val v) {
   if (VAL_IS_IMM(v)) {
@@ -597,9 +1318,80 @@ void val_retain(Val v) {
     return;
   }
 
+#ifdef NB_RC_BIASED
+  if (_is_shared_rc(p)) {
+    atomic_fetch_add_explicit(&p->shared_rc, VAL_RC_ONE, memory_order_relaxed);
+    return;
+  }
+#endif
   _inc_ref_count(v);
 }
 
+static void _destroy(ValHeader* p) {
+  uint32_t klass_id = VAL_KLASS((Val)p);
+  Klass* k = *Klasses.at(&runtime.klasses, klass_id);
+  if (k->delete_func) {
+    k->delete_func(p);
+  } else {
+    // gens > 0 reuse memory by size, it must be computed before destruct
+    size_t size = 0;
+    if (k->size_func && nb_gens_get_current(_gens()) > 0) {
+      size = k->size_func(p);
+    }
+    if (k->destruct_func) {
+      k->destruct_func(p);
+    }
+    assert(p->extra_rc == 0);
+    PROFILE_FREE(p);
+    nb_gens_free(_gens(), p, size);
+  }
+}
+
+// destruct queued objects, up to limit
+static void _release_drain(size_t limit) {
+  struct Vals* q = &tl_runtime.release_queue;
+  tl_runtime.releasing = true;
+  for (size_t n = 0; n < limit && Vals.size(q); n++) {
+    _destroy((ValHeader*)Vals.pop(q));
+  }
+  tl_runtime.releasing = false;
+}
+
+// destruct_func releases children, they are queued instead of recursing,
+// so releasing a long list or a deep tree doesn't grow the C stack.
+static void _release_destroy(ValHeader* p) {
+  if (tl_runtime.releasing) {
+    struct Vals* q = &tl_runtime.release_queue;
+    if (!q->data) {
+      Vals.init(q, 0);
+    }
+    Vals.push(q, (Val)p);
+    return;
+  }
+
+  tl_runtime.releasing = true;
+  _destroy(p);
+  size_t budget = tl_runtime.release_budget;
+  _release_drain(budget ? budget - 1 : SIZE_MAX);
+}
+
+void val_set_release_budget(size_t budget) {
+  tl_runtime.release_budget = budget;
+}
+
+void val_release_drain() {
+  if (!tl_runtime.releasing) {
+    _release_drain(SIZE_MAX);
+  }
+#ifdef NB_RC_BIASED
+  _rc_drain_queue();
+#endif
+}
+
+size_t val_release_pending() {
+  return Vals.size(&tl_runtime.release_queue);
+}
+
 void val_release(Val v) {
   if (VAL_IS_IMM(v)) {
     return;
@@ -609,48 +1401,168 @@ void val_release(Val v) {
     return;
   }
 
-  if (!p->rc_overflow && p->extra_rc == 0) {
-    uint32_t klass_id = VAL_KLASS((Val)p);
-    Klass* k = *Klasses.at(&runtime.klasses, klass_id);
-    if (k->delete_func) {
-      k->delete_func(p);
-    } else {
-      if (k->destruct_func) {
-        k->destruct_func(p);
+#ifdef NB_RC_BIASED
+  if (_is_shared_rc(p)) {
+    int32_t old = atomic_fetch_sub_explicit(&p->shared_rc, VAL_RC_ONE, memory_order_acq_rel);
+    if (old & VAL_RC_MERGED) {
+      // a queued object is destroyed by the queue
+      if (old == (VAL_RC_ONE | VAL_RC_MERGED)) {
+        _release_destroy(p);
       }
-      val_free(p);
+    } else if (old < VAL_RC_ONE && !(old & VAL_RC_QUEUED)) {
+      _rc_enqueue(p);
+    }
+    return;
+  }
+
+  if (!p->rc_overflow && p->extra_rc == 0) {
+    // owner gives up, the last shared reference (or the queue) will destroy the object
+    int32_t old = atomic_fetch_or_explicit(&p->shared_rc, VAL_RC_MERGED, memory_order_acq_rel);
+    if (old < VAL_RC_ONE && !(old & VAL_RC_QUEUED)) {
+      _release_destroy(p);
     }
   } else {
     _dec_ref_count(v);
   }
+  _rc_drain_queue();
+#else
+  if (!p->rc_overflow && p->extra_rc == 0) {
+    _release_destroy(p);
+  } else {
+    _dec_ref_count(v);
+  }
+#endif
 }
 
 int64_t val_global_ref_count(Val v) {
-  int64_t res;
-  bool found = GlobalRefCounts.find(&runtime.global_ref_counts, v, &res);
-  return found ? res : -1;
+  return rc_table_get(&runtime.overflow_rcs, v);
 }
 
 #pragma mark ### gens control (just delegates gens)
 
 int32_t val_gens_new_gen() {
-  return nb_gens_new_gen(tl_runtime.gens);
+  return nb_gens_new_gen(_gens());
+}
+
+int32_t val_gens_new_gen_reserved(size_t reserve_bytes, bool huge_pages) {
+  return nb_gens_new_gen_reserved(_gens(), reserve_bytes, huge_pages);
 }
 
 int32_t val_gens_max_gen() {
-  return nb_gens_max_gen(tl_runtime.gens);
+  return nb_gens_max_gen(_gens());
 }
 
 int32_t val_gens_get_current() {
-  return nb_gens_get_current(tl_runtime.gens);
+  return nb_gens_get_current(_gens());
 }
 
+// queued objects are destructed in the gen they are released
 void val_gens_set_current(int32_t i) {
-  nb_gens_set_current(tl_runtime.gens, i);
+  val_release_drain();
+  nb_gens_set_current(_gens(), i);
 }
 
 void val_gens_drop() {
-  nb_gens_drop(tl_runtime.gens);
+  val_release_drain();
+  nb_gens_drop(_gens());
+}
+
+void val_gens_set_slab_enabled(bool enabled) {
+  nb_gens_set_slab_enabled(_gens(), enabled);
+}
+
+uint64_t val_gens_reclaimed_bytes(int32_t gen) {
+  return nb_gens_reclaimed_bytes(_gens(), gen);
+}
+
+void val_gens_set_budget(int32_t gen, uint64_t bytes) {
+  nb_gens_set_budget(_gens(), gen, bytes);
+}
+
+void val_gens_set_chunk_cache_limit(size_t bytes) {
+  nb_gens_set_chunk_cache_limit(_gens(), bytes);
+}
+
+void val_gens_trim_chunk_cache(size_t keep_bytes) {
+  nb_gens_trim_chunk_cache(_gens(), keep_bytes);
+}
+
+static uint64_t _ptr_hash(Val v) {
+  return (v >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+static bool _ptr_eq(Val l, Val r) {
+  return l == r;
+}
+
+SWISS_MAP_DECL(Forwards, Val, Val, _ptr_hash, _ptr_eq);
+
+typedef struct {
+  NbGensSpan* span;
+  struct Forwards forwards; // { old => copied }
+  struct Vals pending;      // copied objects whose slots are not evacuated yet
+  ValEvacuateStats stats;
+} Evacuation;
+
+// returns a new reference of the evacuated value
+static Val _evacuate_val(Evacuation* e, Val v) {
+  if (VAL_IS_IMM(v) || VAL_IS_PERM(v) || !nb_gens_span_contains(e->span, (void*)v)) {
+    RETAIN(v);
+    return v;
+  }
+
+  Val copied;
+  if (Forwards.find(&e->forwards, v, &copied)) {
+    RETAIN(copied);
+    return copied;
+  }
+
+  Klass* k = *Klasses.at(&runtime.klasses, VAL_KLASS(v));
+  if (!k || !k->size_func || !k->trace_func) {
+    // leaving it in place would dangle after the gen is dropped
+    fatal_err("val_gens_evacuate: klass %u has no size_func or trace_func", (unsigned)VAL_KLASS(v));
+  }
+
+  size_t size = k->size_func((void*)v);
+  copied = (Val)val_dup((void*)v, size, size);
+  Forwards.insert(&e->forwards, v, copied);
+  Vals.push(&e->pending, copied);
+  e->stats.copied_bytes += size;
+  e->stats.copied_objects++;
+  return copied;
+}
+
+static void _evacuate_slot(Val* slot, void* ctx) {
+  *slot = _evacuate_val(ctx, *slot);
+}
+
+Val val_gens_evacuate(Val root, int32_t target_gen, ValEvacuateStats* stats) {
+  Gens* g = _gens();
+  int32_t prev_gen = nb_gens_get_current(g);
+  nb_gens_set_current(g, target_gen);
+
+  Evacuation e = {.span = nb_gens_span_new(g, target_gen)};
+  Forwards.init(&e.forwards);
+  Vals.init(&e.pending, 0);
+
+  // iterative, so long lists don't overflow the C stack
+  Val res = _evacuate_val(&e, root);
+  while (Vals.size(&e.pending)) {
+    Val copied = Vals.pop(&e.pending);
+    Klass* k = *Klasses.at(&runtime.klasses, VAL_KLASS(copied));
+    k->trace_func((void*)copied, _evacuate_slot, &e);
+  }
+
+  e.stats.dropped_bytes = nb_gens_span_bytes(e.span) - e.stats.copied_bytes;
+  if (stats) {
+    *stats = e.stats;
+  }
+
+  Vals.cleanup(&e.pending);
+  Forwards.cleanup(&e.forwards);
+  nb_gens_span_delete(e.span);
+  nb_gens_set_current(g, prev_gen);
+  return res;
 }
 
 #pragma mark ### trace
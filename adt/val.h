@@ -6,6 +6,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdnoreturn.h>
+#ifdef NB_RC_BIASED
+#include <stdatomic.h>
+#endif
 #include "utils/intrinsics.h"
 #include "utils/dbg.h"
 
@@ -25,6 +28,7 @@ lowest 8 bits in the tagged pointer
     ...xxxx xxx1 int
     ...xxxx xx10 dbl
     ...0000 1100 str (also entries in sym table, limited to 32 bits)
+    ...1sss 1100 short str, sss is the byte size (0..7), the bytes are in the upper 7 bytes
     ...0000 0000 nil   0x00 = 0
     ...0000 1000 false 0x08 = 8
     ...0001 0100 true  0x14 = 20
@@ -48,7 +52,7 @@ special values for internal use only
 #define VAL_IS_TRUE(_v_) ((_v_) & ~VAL_FALSE)
 #define VAL_IS_FALSE(_v_) (!VAL_IS_TRUE(_v_))
 
-// immediate value: int, dbl, true, str, nil, false
+// immediate value: int, dbl, true, str, short str, nil, false
 static inline bool VAL_IS_IMM(Val v) {
   return (v & 7) || VAL_IS_FALSE(v);
 }
@@ -61,7 +65,9 @@ static inline double VAL_UINT_AS_DBL(uint64_t u) {
   ValCast c = {.u = u};
   return c.d;
 }
-#define VAL_DBL_CAN_IMM(_dbl_) (VAL_DBL_AS_UINT(_dbl_) & (1ULL << 62))
+// the highest 2 exponent bits must be 10 (2 <= |d| < 2^513) to become a dbl tag after rotation,
+// other doubles are boxed (see double.h)
+#define VAL_DBL_CAN_IMM(_dbl_) ((VAL_DBL_AS_UINT(_dbl_) >> 61 & 3) == 2)
 #define VAL_IS_DBL(_v_) (((_v_) & 3) == 2)
 #define VAL_FROM_DBL(_dbl_) NB_ROTL(VAL_DBL_AS_UINT(_dbl_), 3)
 #define VAL_TO_DBL(_v_) VAL_UINT_AS_DBL(NB_ROTR((_v_), 3))
@@ -83,12 +89,18 @@ static inline int64_t VAL_UINT_AS_INT(uint64_t u) {
 #define VAL_TO_INT(_v_) (VAL_UINT_AS_INT(_v_) >> 1)
 
 // TODO rename STR -> SLIT
-#define VAL_IS_STR(_v_) (((_v_) & 0x0f) == 0x0c)
+#define VAL_IS_STR(_v_) (((_v_) & 0x8f) == 0x0c)
 // NOTE we use the whole 64 bit value as hash keys... etc.
 //      so when generating, the id is added by (1 << 32) for each new value
 #define VAL_FROM_STR(_sid_) (((uint64_t)(_sid_) << 32) | 0x0c)
 #define VAL_TO_STR(_v_) ((Val)(_v_) >> 32)
 
+// short strings are packed by nb_string_new(), they need no allocation and no ref counting.
+// unused bytes are 0, so equal short strings have equal bits
+#define VAL_SSTR_MAX 7
+#define VAL_IS_SSTR(_v_) (((_v_) & 0x8f) == 0x8c)
+#define VAL_SSTR_SIZE(_v_) (((_v_) >> 4) & 7)
+
 #pragma mark ### object
 
 // klass can be combined with 32bit method id for the method search? (think about the HAMT method table)
@@ -107,9 +119,23 @@ typedef struct {
   uint16_t flags: 12;    // 12 bits available, can be used as counters, etc...
 
   uint32_t klass;
+
+#ifdef NB_RC_BIASED
+  // biased ref counting (build with -DNB_RC_BIASED), values can be shared across threads.
+  // the owner thread counts with extra_rc (non-atomic), other threads count with shared_rc (atomic).
+  // shared_rc stores count * VAL_RC_ONE, signed: it goes negative when other threads release references counted by the owner.
+  // VAL_RC_MERGED is set when the owner count is moved into shared_rc, after that every thread counts with shared_rc.
+  // VAL_RC_QUEUED is set when shared_rc first goes negative, the object is queued for the owner to merge
+  // (or merged by the releasing thread if the owner is detached).
+  uint32_t owner;
+  _Atomic(int32_t) shared_rc;
+#endif
 } ValHeader;
 
 #define VAL_MAX_EMBED_RC (1<<12)
+#define VAL_RC_MERGED 1
+#define VAL_RC_QUEUED 2
+#define VAL_RC_ONE 4
 #define VAL_IS_PERM(_p_) (((ValHeader*)(_p_))->perm)
 
 enum {
@@ -165,7 +191,7 @@ inline static uint32_t VAL_KLASS(Val v) {
     if (VAL_IS_DBL(v)) {
       return KLASS_DOUBLE;
     }
-    if (VAL_IS_STR(v)) {
+    if (VAL_IS_STR(v) || VAL_IS_SSTR(v)) {
       return KLASS_STRING;
     }
     debug("IMM v of unkown klass: %lu", v);
@@ -188,7 +214,16 @@ inline static int64_t VAL_REF_COUNT(Val v) {
   } else if (h->perm) {
     return -1;
   } else {
+#ifdef NB_RC_BIASED
+    int32_t shared = atomic_load_explicit(&h->shared_rc, memory_order_relaxed);
+    if (shared & VAL_RC_MERGED) {
+      return shared / VAL_RC_ONE;
+    }
+    // flags are in the low bits, floor division gives the count
+    return h->extra_rc + 1 + (shared >> 2);
+#else
     return h->extra_rc + 1;
+#endif
   }
 }
 
@@ -207,6 +242,9 @@ ValPair val_c_call2(Val obj, void* cfunc, uint64_t argc, Val* argv);
 
 uint64_t val_hash_mem(const void* memory, size_t size);
 
+// hashes[i] = val_hash_mem(memories[i], sizes[i]), several keys are hashed at once
+void val_hash_mem_many(size_t n, const void* const* memories, const size_t* sizes, uint64_t* hashes);
+
 uint64_t val_hash(Val v);
 
 bool val_eq(Val l, Val r);
@@ -223,6 +261,44 @@ size_t val_strlit_byte_size(uint32_t l);
 
 const char* val_strlit_ptr(uint32_t l);
 
+// startup image: the literal table and sizes of the klass / const registries.
+// when env NB_IMAGE is the path of an image, init maps it (one mmap, no per-string allocation),
+// literals interned by the dumping process keep their ids, and interning them again is a lookup.
+// klasses and consts hold C functions and heap values, so init code still defines them, the image only presizes their tables.
+// an invalid image, or one of another version, is ignored.
+bool val_image_dump(const char* path);
+
+// true if init mapped an image
+bool val_image_loaded();
+
+// well-known symbols, they are interned first at init, so the literal ids are constants.
+// example: val_send(v, VAL_SYM_HASH, 0, NULL)
+enum {
+  VAL_SYM_EQ,   // "=="
+  VAL_SYM_NE,   // "!="
+  VAL_SYM_LT,   // "<"
+  VAL_SYM_LE,   // "<="
+  VAL_SYM_GT,   // ">"
+  VAL_SYM_GE,   // ">="
+  VAL_SYM_ADD,  // "+"
+  VAL_SYM_SUB,  // "-"
+  VAL_SYM_MUL,  // "*"
+  VAL_SYM_DIV,  // "/"
+  VAL_SYM_MOD,  // "%"
+  VAL_SYM_HASH, // "hash"
+  VAL_SYM_TO_S, // "to_s"
+
+  // spellbreak actions and contexts
+  VAL_SYM_TOKEN, // "token"
+  VAL_SYM_YIELD, // "yield"
+  VAL_SYM_PEG,   // "peg"
+  VAL_SYM_TAIL,  // "tail"
+  VAL_SYM_STYLE, // "style"
+  VAL_SYM_MAIN,  // "Main"
+
+  VAL_SYM_COUNT
+};
+
 noreturn void val_throw(Val obj);
 
 void val_def_const(uint32_t namespace, uint32_t name_str, Val v);
@@ -247,6 +323,12 @@ typedef ValPair (*ValMethodFuncV)(Val, int32_t, Val*);
 typedef uint64_t (*ValHashFunc)(Val);
 typedef bool (*ValEqFunc)(Val, Val);
 
+// byte size of the object, including header
+typedef size_t (*ValSizeFunc)(void*);
+// visit each Val slot referenced (retained) by the object, visit may replace the slot
+typedef void (*ValVisitFunc)(Val* slot, void* ctx);
+typedef void (*ValTraceFunc)(void*, ValVisitFunc visit, void* ctx);
+
 // define internal default klasses (with klass_id < KLASS_USER)
 // todo do not expose this func
 // for custom structs, see struct.h
@@ -294,6 +376,11 @@ void klass_set_hash_func(uint32_t klass_id, ValHashFunc func);
 
 void klass_set_eq_func(uint32_t klass_id, ValEqFunc func);
 
+// size and trace funcs are required for objects to be evacuated from a generation (see val_gens_evacuate)
+void klass_set_size_func(uint32_t klass_id, ValSizeFunc func);
+
+void klass_set_trace_func(uint32_t klass_id, ValTraceFunc func);
+
 // for fixed argc
 void klass_def_method(uint32_t klass_id, uint32_t method_id, int32_t argc, ValMethodFunc func, bool is_final);
 
@@ -329,9 +416,37 @@ void* val_dup(void* p, size_t osize, size_t nsize);
 void* val_realloc(void* p, size_t osize, size_t nsize);
 void val_free(void* p);
 void val_perm(void* p);
+
+// for a delete_func keeping freed objects of its klass for reuse (see klass_set_delete_func):
+// val_recycle does the bookkeeping of val_free but keeps the memory,
+// val_alloc_recycled initializes the memory again like val_alloc does, and returns it
+// val_free_recycled gives the memory kept by val_recycle back to the allocator
+void val_recycle(void* p);
+void* val_alloc_recycled(void* p, uint32_t klass_id, size_t size);
+void val_free_recycled(void* p);
 void val_retain(Val p);
 void val_release(Val p);
 
+// children of a destructed object are released through a per-thread queue, not recursion.
+// by default the outermost val_release drains the whole queue.
+// with budget > 0, a val_release destructs at most budget objects and leaves the rest queued,
+// the queue is also drained by val_release_drain, val_gens_set_current and val_gens_drop.
+void val_set_release_budget(size_t budget);
+void val_release_drain();
+size_t val_release_pending();
+
+// free the calling thread's gens, release queue and pooled boxes, called automatically when a thread exits.
+// gen 0 objects of the thread stay valid (its slab pages are handed over), objects in gens > 0 are freed.
+// under NB_RC_BIASED, objects queued for the thread are merged, and the counts the thread still holds
+// are merged by the next thread releasing them.
+void val_thread_detach();
+
+// byte size of the object by klass size_func, 0 for immediate value or klass without size_func
+size_t val_byte_size(Val v);
+
+// call visit on each Val slot of the object by klass trace_func
+void val_trace(Val v, ValVisitFunc visit, void* ctx);
+
 // for convenient in-place-update
 #define AS_VAL(_obj_) *((Val*)(&(_obj_)))
 #define REPLACE(_obj_, _expr_) do {\
@@ -343,11 +458,53 @@ void val_release(Val p);
 #define RETAIN(_obj_) val_retain((Val)(_obj_))
 #define RELEASE(_obj_) val_release((Val)(_obj_))
 
+#pragma mark ### allocation profiler
+
+// build with -DNB_ALLOC_PROFILE to count allocations per klass, otherwise the hooks are compiled out,
+// then snapshot returns false and the other functions do nothing.
+// klass ids >= VAL_ALLOC_PROFILE_KLASSES are counted together in the last entry.
+
+#define VAL_ALLOC_PROFILE_KLASSES 256
+#define VAL_ALLOC_PROFILE_BUCKETS 16  // size_hist[i] counts sizes in (8 << i, 16 << i]
+#define VAL_ALLOC_PROFILE_SAMPLES 256 // ring buffer of sampled allocations
+#define VAL_ALLOC_PROFILE_FRAMES 16
+
+typedef struct {
+  uint64_t allocs; // val_alloc and val_dup
+  uint64_t frees;
+  int64_t live_objects;
+  int64_t live_bytes;
+  uint64_t size_hist[VAL_ALLOC_PROFILE_BUCKETS];
+} ValAllocProfile;
+
+typedef struct {
+  uint32_t klass;
+  size_t size;
+  int frames;
+  void* callstack[VAL_ALLOC_PROFILE_FRAMES];
+} ValAllocSample;
+
+bool val_alloc_profile_snapshot(uint32_t klass_id, ValAllocProfile* out);
+
+// capture backtrace for every Nth allocation, 0 to disable
+void val_alloc_profile_set_sampling(uint64_t every);
+
+// copy latest samples into out, returns the number copied
+size_t val_alloc_profile_samples(ValAllocSample* out, size_t max);
+
+void val_alloc_profile_reset();
+
+// print per-klass counts, size histograms and sampled backtraces, like klass_debug()
+void val_alloc_profile_debug();
+
 #pragma mark ### gens control (just delegates gens)
 
 // create new generation (but not select it)
 int32_t val_gens_new_gen();
 
+// create new generation backed by a lazily committed region (see nb_gens_new_gen_reserved)
+int32_t val_gens_new_gen_reserved(size_t reserve_bytes, bool huge_pages);
+
 // return max gen number
 int32_t val_gens_max_gen();
 
@@ -360,6 +517,40 @@ void val_gens_set_current(int32_t i);
 // drop generations after current
 void val_gens_drop();
 
+// total bytes of released objects reused in gen (> 0)
+uint64_t val_gens_reclaimed_bytes(int32_t gen);
+
+// limit bytes allocated in gen (> 0), see nb_gens_set_budget for what happens when exceeded
+void val_gens_set_budget(int32_t gen, uint64_t bytes);
+
+// toggle slab allocation of small objects in gen 0
+void val_gens_set_slab_enabled(bool enabled);
+
+// max bytes of arena chunks retained for reuse by later gens
+void val_gens_set_chunk_cache_limit(size_t bytes);
+
+// free retained arena chunks until at most keep_bytes remain
+void val_gens_trim_chunk_cache(size_t keep_bytes);
+
+typedef struct {
+  size_t copied_bytes;
+  size_t copied_objects;
+  size_t dropped_bytes; // bytes in gens > target_gen that are not copied
+} ValEvacuateStats;
+
+// deep copy objects reachable from root that live in gens > target_gen into target_gen,
+// shared objects are copied once and stay shared.
+// every klass of the copied objects must have size_func and trace_func, or the process exits.
+// returns the copied root (a new reference), then gens > target_gen can be dropped.
+// stats can be NULL.
+// usage:
+//   val_gens_set_current(gen);
+//   Val ast = parse(...);
+//   Val res = val_gens_evacuate(ast, gen - 1, NULL);
+//   val_gens_set_current(gen - 1);
+//   val_gens_drop();
+Val val_gens_evacuate(Val root, int32_t target_gen, ValEvacuateStats* stats);
+
 #pragma mark ### trace function
 
 // global tracing flag, for debug use
@@ -13,7 +13,7 @@ void sb_build_patterns_dict(Compiler* compiler) {
     if (IS_A(e, "PatternIns")) {
       Val name = AT(e, 0);
       Val pattern = AT(e, 1);
-      REPLACE(compiler->patterns_dict, nb_dict_insert(compiler->patterns_dict, nb_string_ptr(name), nb_string_byte_size(name), pattern));
+      REPLACE(compiler->patterns_dict, nb_dict_insert(compiler->patterns_dict, NB_STRING_BYTES(name), nb_string_byte_size(name), pattern));
     }
   }
 }
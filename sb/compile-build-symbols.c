@@ -37,7 +37,7 @@ void sb_build_symbols(Compiler* compiler) {
       Val elems = AT(e, 1);
       if (StructsTable.find(&compiler->symbols->structs, struct_name, NULL)) {
         // todo resumable error handling
-        fatal_err("re-definition of struct: %.*s", (int)nb_string_byte_size(struct_name), nb_string_ptr(struct_name));
+        fatal_err("re-definition of struct: %.*s", (int)nb_string_byte_size(struct_name), NB_STRING_BYTES(struct_name));
       }
       StructsTableValue v = {
         .min_elems = 0,
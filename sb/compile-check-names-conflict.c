@@ -40,14 +40,14 @@ Val sb_check_names_conflict(Val ast) {
       k.type = PEG_NAME;
     } else {
       Val node_klass_name = klass_name(VAL_KLASS(e));
-      err = nb_string_new_f("unrecognized node: %.*s", (int)nb_string_byte_size(node_klass_name), nb_string_ptr(node_klass_name));
+      err = nb_string_new_f("unrecognized node: %.*s", (int)nb_string_byte_size(node_klass_name), NB_STRING_BYTES(node_klass_name));
       goto terminate;
     }
 
     k.name = AT(e, 0);
     int v;
     if (UsedNames.find(&used_names, k, &v)) {
-      err = nb_string_new_f("name already used: %.*s", (int)nb_string_byte_size(k.name), nb_string_ptr(k.name));
+      err = nb_string_new_f("name already used: %.*s", (int)nb_string_byte_size(k.name), NB_STRING_BYTES(k.name));
       goto terminate;
     }
     UsedNames.insert(&used_names, k, 1);
@@ -11,7 +11,7 @@ void sb_compile_context_dict_insert(Compiler* compiler, Val name, char kind, int
   }
 
   buf[0] = kind;
-  memcpy(buf + 1, nb_string_ptr(name), size);
+  memcpy(buf + 1, NB_STRING_BYTES(name), size);
 
   REPLACE(compiler->context_dict, nb_dict_insert(compiler->context_dict, buf, size + 1, VAL_FROM_INT(offset)));
 
@@ -31,7 +31,7 @@ int32_t sb_compile_context_dict_find(Val context_dict, Val name, char kind) {
   }
 
   buf[0] = kind;
-  memcpy(buf + 1, nb_string_ptr(name), size);
+  memcpy(buf + 1, NB_STRING_BYTES(name), size);
 
   Val res;
   int offset;
@@ -38,7 +38,7 @@ static void _expand_lex_def(struct ContextMap* context_map, Val name) {
       Val child_nodes;
       bool found = ContextMap.find(context_map, ref_name, &child_nodes);
       if (!found) {
-        COMPILE_ERROR("partial context not found: %.*s", (int)nb_string_byte_size(ref_name), nb_string_ptr(ref_name));
+        COMPILE_ERROR("partial context not found: %.*s", (int)nb_string_byte_size(ref_name), NB_STRING_BYTES(ref_name));
       }
       for (Val child_curr = child_nodes; child_curr != VAL_NIL; child_curr = TAIL(child_curr)) {
         if (child_curr != VAL_NIL) {
@@ -74,7 +74,7 @@ static void _print_network(DepNode** dep_network, int size) {
   for (int i = 0; i < size; i++) {
     DepNode* head = dep_network[i];
     while(head) {
-      printf("%.*s ", (int)nb_string_byte_size(head->ctx_name), nb_string_ptr(head->ctx_name));
+      printf("%.*s ", (int)nb_string_byte_size(head->ctx_name), NB_STRING_BYTES(head->ctx_name));
       head = head->next;
     }
     printf("\n");
@@ -154,7 +154,7 @@ void sb_inline_partial_references(Compiler* compiler) {
     Val child = HEAD(curr_ins);
     if (IS_A(child, "Lex")) { // Lex[context, rules]
       Val name = AT(child, 0);
-      if (nb_string_ptr(name)[0] != '*') {
+      if (NB_STRING_BYTES(name)[0] != '*') {
         Val converted;
         ContextMap.find(&context_map, name, &converted);
         res = nb_cons_new(child, res);
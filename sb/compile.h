@@ -122,5 +122,5 @@ static int SYMBOLS_LOOKUP_VAR_ID(struct VarsTable* vars_table, Val name) {
 #pragma mark ## helpers
 
 static Val LITERALIZE(Val str) {
-  return nb_string_new_literal(nb_string_byte_size(str), nb_string_ptr(str));
+  return nb_string_new_literal(nb_string_byte_size(str), NB_STRING_BYTES(str));
 }
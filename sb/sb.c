@@ -57,14 +57,10 @@ static ValPair char_no_escape(Spellbreak* ctx, Val capture_i) {
 }
 
 static ValPair concat_char(Spellbreak* ctx, Val left_s, Val right_c) {
-  int c = VAL_TO_INT(right_c);
+  char c = (char)VAL_TO_INT(right_c);
   // TODO refcount and transient optimize
-  const char* from = nb_string_ptr(left_s);
-  size_t size = nb_string_byte_size(left_s);
-  Val res_s = nb_string_new_transient(size);
-  char* to = (char*)nb_string_ptr(res_s);
-  memcpy(to, from, size);
-  to[size] = c;
+  // a single char is a short string, so short results need no allocation
+  Val res_s = nb_string_concat(left_s, nb_string_new(1, &c));
   return (ValPair){res_s, VAL_NIL};
 }
 
@@ -78,7 +74,7 @@ static ValPair peg(Spellbreak* sb, Val s) {
   int token_pos = ce->token_pos;
 
   Val parser;
-  if (!nb_dict_find(sb->context_dict, nb_string_ptr(s), nb_string_byte_size(s), &parser)) {
+  if (!nb_dict_find(sb->context_dict, NB_STRING_BYTES(s), nb_string_byte_size(s), &parser)) {
     return (ValPair){VAL_NIL, nb_string_new_literal_c("bad context name str")};
   }
   int token_size = TokenStream.size(&sb->token_stream) - ce->token_pos;
@@ -163,6 +159,9 @@ static void _sb_destruct(void* p) {
 
 #define METHOD(k, func, argc) klass_def_method(k, val_strlit_new_c(#func), argc, func, true)
 #define METHOD2(k, func, min_argc, max_argc) klass_def_method_v(k, val_strlit_new_c(#func), min_argc, max_argc, (ValMethodFuncV)func, true)
+// for actions with well-known symbols
+#define SYM_METHOD(k, sym, func, argc) klass_def_method(k, sym, argc, func, true)
+#define SYM_METHOD2(k, sym, func, min_argc, max_argc) klass_def_method_v(k, sym, min_argc, max_argc, (ValMethodFuncV)func, true)
 #define STR(v) nb_string_new_literal_c(v)
 
 void sb_init_module(void) {
@@ -201,16 +200,18 @@ uint32_t sb_syntax_new(uint32_t name_str) {
   klass_set_data(klass, klass_data);
   klass_set_destruct_func(klass, _sb_destruct);
 
-  METHOD(klass, peg, 1);
-  METHOD(klass, yield, 1);
-  METHOD(klass, tail, 1);
-  METHOD2(klass, style, 1, 2);
-  METHOD2(klass, token, 1, 3);
+  SYM_METHOD(klass, VAL_SYM_PEG, peg, 1);
+  SYM_METHOD(klass, VAL_SYM_YIELD, yield, 1);
+  SYM_METHOD(klass, VAL_SYM_TAIL, tail, 1);
+  SYM_METHOD2(klass, VAL_SYM_STYLE, style, 1, 2);
+  SYM_METHOD2(klass, VAL_SYM_TOKEN, token, 1, 3);
 
   klass_set_unsafe(klass);
   return klass;
 }
 
+#undef SYM_METHOD2
+#undef SYM_METHOD
 #undef METHOD2
 #undef METHOD
 
@@ -65,7 +65,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
 
     _encode_callback_expr(compiler, lhs);
     LABEL_REF(compiler->labels, _iseq_size(compiler) + 1);
-    if (nb_string_byte_size(op) == 2 && nb_string_ptr(op)[0] == '&' && nb_string_ptr(op)[1] == '&') {
+    if (nb_string_byte_size(op) == 2 && NB_STRING_BYTES(op)[0] == '&' && NB_STRING_BYTES(op)[1] == '&') {
       ins = JUNLESS;
     } else {
       ins = JIF;
@@ -101,7 +101,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
     int size = nb_string_byte_size(tok);
     // TODO handle the cases of more than 2 digits
     char s[size];
-    strncpy(s, nb_string_ptr(tok) + 1, size - 1);
+    strncpy(s, NB_STRING_BYTES(tok) + 1, size - 1);
     s[size - 1] = '\0';
     int i = atoi(s);
     if (i > compiler->terms_size) {
@@ -134,7 +134,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
     bool found = StructsTable.find(compiler->structs_table, klass_name, &structs_table_value);
     if (!found) {
       // TODO resumable and report syntax error at position
-      fatal_err("struct not found: %.*s", (int)nb_string_byte_size(klass_name), nb_string_ptr(klass_name));
+      fatal_err("struct not found: %.*s", (int)nb_string_byte_size(klass_name), NB_STRING_BYTES(klass_name));
     }
 
     // validate arity
@@ -148,10 +148,10 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
       }
     }
     if (has_more_elems && elems_size > structs_table_value.max_elems) {
-      fatal_err("struct %.*s requies no more than %d members", (int)nb_string_byte_size(klass_name), nb_string_ptr(klass_name), structs_table_value.max_elems);
+      fatal_err("struct %.*s requies no more than %d members", (int)nb_string_byte_size(klass_name), NB_STRING_BYTES(klass_name), structs_table_value.max_elems);
     }
     if (!has_more_elems && elems_size < structs_table_value.min_elems) {
-      fatal_err("struct %.*s requies at least %d members", (int)nb_string_byte_size(klass_name), nb_string_ptr(klass_name), structs_table_value.min_elems);
+      fatal_err("struct %.*s requies at least %d members", (int)nb_string_byte_size(klass_name), NB_STRING_BYTES(klass_name), structs_table_value.min_elems);
     }
 
     // encode
@@ -215,7 +215,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
 
     int var_id = SYMBOLS_LOOKUP_VAR_ID(compiler->local_vars, var_name);
     if (var_id < 0) {
-      fatal_err("assigning local var %.*s not declared", (int)nb_string_byte_size(var_name), nb_string_ptr(var_name));
+      fatal_err("assigning local var %.*s not declared", (int)nb_string_byte_size(var_name), NB_STRING_BYTES(var_name));
     }
     _encode_callback_expr(compiler, value);
     ENCODE(compiler->iseq, uint16_t, STORE);
@@ -228,7 +228,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
 
     int var_id = SYMBOLS_LOOKUP_VAR_ID(compiler->global_vars, var_name);
     if (var_id < 0) {
-      fatal_err("assigning global var %.*s not declared", (int)nb_string_byte_size(var_name), nb_string_ptr(var_name));
+      fatal_err("assigning global var %.*s not declared", (int)nb_string_byte_size(var_name), NB_STRING_BYTES(var_name));
     }
     _encode_callback_expr(compiler, value);
     ENCODE(compiler->iseq, uint16_t, STORE_GLOB);
@@ -240,7 +240,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
     
     int var_id = SYMBOLS_LOOKUP_VAR_ID(compiler->local_vars, var_name);
     if (var_id < 0) {
-      fatal_err("referencing local var %.*s not declared", (int)nb_string_byte_size(var_name), nb_string_ptr(var_name));
+      fatal_err("referencing local var %.*s not declared", (int)nb_string_byte_size(var_name), NB_STRING_BYTES(var_name));
     }
     ENCODE(compiler->iseq, uint16_t, LOAD);
     ENCODE(compiler->iseq, uint32_t, var_id + LOCAL_VAR_OFFSET);
@@ -251,7 +251,7 @@ static void _encode_callback_expr(CallbackCompiler* compiler, Val expr) {
 
     int var_id = SYMBOLS_LOOKUP_VAR_ID(compiler->global_vars, var_name);
     if (var_id < 0) {
-      fatal_err("referencing global var %.*s not declared", (int)nb_string_byte_size(var_name), nb_string_ptr(var_name));
+      fatal_err("referencing global var %.*s not declared", (int)nb_string_byte_size(var_name), NB_STRING_BYTES(var_name));
     }
     ENCODE(compiler->iseq, uint16_t, LOAD_GLOB);
     ENCODE(compiler->iseq, uint32_t, var_id);
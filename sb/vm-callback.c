@@ -12,10 +12,11 @@ MUT_ARRAY_DECL(ContainerInfos, ContainerInfo);
 
 ValPair sb_vm_callback_exec(uint16_t* pc, struct Vals* stack, Val* global_vars, int32_t vars_start_index) {
   // TODO optimize container_infos:
-  // - idea 1: use stack allocation when container_infos is not too large
-  // - idea 2: eliminate the struct since some code doesn't require it
+  // - idea: eliminate the struct since some code doesn't require it
+  ContainerInfo container_infos_buf[8];
   struct ContainerInfos container_infos;
-  ContainerInfos.init(&container_infos, 5);
+  ContainerInfos.init_buf(&container_infos, container_infos_buf, 8);
+  Val stack_storage_buf[16];
   struct Vals stack_storage; // in case stack given
   bool use_stack_storage = false;
   Val ret = VAL_NIL;
@@ -23,7 +24,7 @@ ValPair sb_vm_callback_exec(uint16_t* pc, struct Vals* stack, Val* global_vars,
 
   if (!stack) {
     use_stack_storage = true;
-    Vals.init(&stack_storage, 10);
+    Vals.init_buf(&stack_storage, stack_storage_buf, 16);
     stack = &stack_storage;
   }
   int bp = Vals.size(stack);
@@ -223,7 +224,8 @@ terminate:
   if (use_stack_storage) {
     Vals.cleanup(stack);
   } else {
-    stack->size = bp;
+    Vals.truncate(stack, bp);
   }
+  ContainerInfos.cleanup(&container_infos);
   return (ValPair){ret, VAL_NIL};
 }
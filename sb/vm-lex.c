@@ -43,7 +43,7 @@ ValPair sb_vm_lex_exec(Spellbreak* sb) {
 })
 # define CTX_POP() ContextStack.pop(&sb->context_stack)
 
-  CTX_PUSH(val_strlit_new_c("Main"));
+  CTX_PUSH(VAL_SYM_MAIN);
   for (;;) {
 begin:
     matched = false;
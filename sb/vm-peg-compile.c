@@ -2,6 +2,7 @@
 #include "vm-peg-op-codes.h"
 #include <adt/cons.h>
 #include <adt/utils/mut-map.h>
+#include <adt/utils/hash.h>
 
 #pragma mark ## decls
 
@@ -18,7 +19,7 @@ static uint32_t kRefRule = 0;
 static uint32_t kCallback = 0;
 
 static uint64_t _rule_num_key_hash(uint32_t k) {
-  return val_hash_mem(&k, sizeof(uint32_t));
+  return fast_hash_u64(k);
 }
 
 static bool _rule_num_key_eq(uint32_t k1, uint32_t k2) {
@@ -368,7 +369,7 @@ static void _encode_rule_body_unit(PegCompiler* compiler, Val e) {
     Val terms = nb_struct_get(e, 2);
     Val callback = nb_struct_get(e, 3);
     int op_size = nb_string_byte_size(op);
-    const char* op_ptr = nb_string_ptr(op);
+    const char* op_ptr = NB_STRING_BYTES(op);
 
     if (op_size == 1 && op_ptr[0] == '/') {
       _encode_branch_or(compiler, lhs, terms, callback);
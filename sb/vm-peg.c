@@ -56,8 +56,11 @@ ValPair sb_vm_peg_exec(uint16_t* peg, int32_t token_size, Token* tokens) {
 # define _TOP() Vals.at(&stack, Vals.size(&stack) - 1)
 
   // TODO use dual stack?
-  BranchStack.init(&br_stack, 5);
-  Vals.init(&stack, 10);
+  // both start on the C stack and move to the heap when they grow
+  Branch br_stack_buf[8];
+  Val stack_buf[16];
+  BranchStack.init_buf(&br_stack, br_stack_buf, 8);
+  Vals.init_buf(&stack, stack_buf, 16);
   _PUSH(0); // main rule_id: 0
 
 # define CASE(op) case op:
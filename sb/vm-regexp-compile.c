@@ -8,7 +8,7 @@ Val sb_vm_regexp_from_string(struct Iseq* iseq, Val s) {
     return nb_string_new_literal_c("not string");
   }
 
-  const char* ptr = nb_string_ptr(s);
+  const char* ptr = NB_STRING_BYTES(s);
   int size = nb_string_byte_size(s);
 
   int original_iseq_pos = Iseq.size(iseq);
@@ -111,7 +111,7 @@ static void _push_quantified(struct Stack* stack, struct Labels* labels, Val nod
   Val e = nb_struct_get(node, 0);
   Val quantifier = nb_struct_get(node, 1);
 
-  const char* ptr = nb_string_ptr(quantifier);
+  const char* ptr = NB_STRING_BYTES(quantifier);
   int len = nb_string_byte_size(quantifier);
 
   if (len == 1) { // greedy
@@ -272,7 +272,7 @@ static void _push_group(struct Stack* stack, int* max_capture, Val group_node) {
   Val content = nb_struct_get(group_node, 1);
 
   int special_size = nb_string_byte_size(special);
-  const char* special_ptr = nb_string_ptr(special);
+  const char* special_ptr = NB_STRING_BYTES(special);
 
 # define IF_MATCH(str) if (str_compare(special_size, special_ptr, strlen(str), str) == 0)
 
@@ -311,7 +311,7 @@ static void _encode_char(struct Iseq* iseq, Val char_node, bool ignore_case) {
 
 static void _encode_anchor(struct Iseq* iseq, Val anchor) {
   Val str = nb_struct_get(anchor, 0);
-  const char* s = nb_string_ptr(str);
+  const char* s = NB_STRING_BYTES(str);
   switch (s[0]) {
     case '^': {
       ENCODE(iseq, uint16_t, ANCHOR_BOL);
@@ -354,7 +354,7 @@ static void _encode_anchor(struct Iseq* iseq, Val anchor) {
 }
 
 static void _encode_predef_char_group(struct Iseq* iseq, Val node) {
-  const char* ptr = nb_string_ptr(nb_struct_get(node, 0));
+  const char* ptr = NB_STRING_BYTES(nb_struct_get(node, 0));
   if (ptr[0] == '.') {
     ENCODE(iseq, uint16_t, CG_ANY);
     return;
@@ -36,7 +36,7 @@ static void _compile_quantified_reg(struct Iseq* iseq, int chr, const char* type
   Val regexp = _struct("Regexp", 1, (Val[]){quantified});
   Val err = sb_vm_regexp_compile(iseq, VAL_NIL, regexp);
   if (err != VAL_NIL) {
-    fatal_err("%.*s", (int)nb_string_byte_size(err), nb_string_ptr(err));
+    fatal_err("%.*s", (int)nb_string_byte_size(err), NB_STRING_BYTES(err));
   }
 
   val_gens_set_current(0);
@@ -77,8 +77,10 @@ static bool _is_digit_char(int c) {
 // captures[0] stores max index of captures
 // captures[1] stores $0.size
 static bool _exec(uint16_t* init_pc, int64_t size, const char* init_s, int32_t* captures) {
+  // starts on the C stack, so matching a simple pattern costs no malloc
+  Thread ts_buf[16];
   struct Threads ts;
-  Threads.init(&ts, 10);
+  Threads.init_buf(&ts, ts_buf, 16);
   const char* s_end = init_s + size;
 
 # define CHECK_END if (t->s == s_end) goto thread_dead